@@ -0,0 +1,293 @@
+/**
+ * \file fontdecode.c
+ *
+ * Streaming decoders for the glyph bitmap codecs.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fontem.h"
+
+/** Modes of an LZ run */
+#define LZ_LITERAL	0
+#define LZ_MATCH	1
+
+/** Where a span reader is in the counts of a row: before the first, after
+ * a count of 255, which another follows, or after the last */
+#define SPANS_START	0
+#define SPANS_MORE	1
+#define SPANS_END	2
+
+/** Longest Huffman code */
+#define HUFFMAN_MAX_BITS 15
+
+/** Start decoding the bitmap of 'glyph'. */
+void font_reader_init(struct glyph_reader *reader, const struct font *font,
+		      const struct glyph *glyph)
+{
+	reader->data = font_get_bitmap(font, glyph);
+	reader->table = font->codec_data;
+	reader->codec = font_get_codec(font, glyph);
+	reader->count = 0;
+	reader->pos = 0;
+	reader->nbits = 0;
+	reader->col = 0;
+	reader->cols = glyph->cols;
+	reader->skip = font_get_stride(font, glyph) - glyph->cols;
+	reader->mode = SPANS_START;
+	reader->span.skip = reader->span.edges = reader->span.fill = 0;
+	reader->row_done = 0;
+}
+
+static inline int next_bit(struct glyph_reader *reader)
+{
+	if (reader->nbits == 0) {
+		reader->bits = *(reader->data++);
+		reader->nbits = 8;
+	}
+	reader->nbits--;
+	return (reader->bits >> reader->nbits) & 1;
+}
+
+/** Decode one canonical Huffman code, as in zlib's "puff". */
+static uint8_t next_huffman(struct glyph_reader *reader)
+{
+	const uint8_t *counts = reader->table;
+	const uint8_t *symbols = reader->table + HUFFMAN_MAX_BITS + 1;
+	int code = 0, first = 0, index = 0;
+
+	for (int len = 1; len <= HUFFMAN_MAX_BITS; len++) {
+		code |= next_bit(reader);
+		int count = counts[len];
+		if (code - count < first)
+			return symbols[index + (code - first)];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	return 0;
+}
+
+/** Unpack the next pixel of a FONT_CODEC_BPP bitmap, scaled to 0-255. */
+static uint8_t next_packed(struct glyph_reader *reader)
+{
+	unsigned int depth = 1 << (reader->codec - FONT_CODEC_BPP1);
+	unsigned int max = (1 << depth) - 1;
+
+	// Up to a word of the row is loaded at once, and shifted out a pixel
+	// at a time; reading stops at the end of the row, which is byte aligned
+	if (reader->nbits == 0) {
+		unsigned int left = (reader->cols * depth + 7) / 8 - reader->col * depth / 8;
+		unsigned int bytes = left < sizeof(reader->bits) ? left : sizeof(reader->bits);
+
+		reader->bits = 0;
+		for (unsigned int i = 0; i < bytes; i++)
+			reader->bits = reader->bits << 8 | *(reader->data++);
+		reader->nbits = bytes * 8;
+	}
+	reader->nbits -= depth;
+	uint8_t val = (reader->bits >> reader->nbits) & max;
+
+	// The rest of the last byte of a row is padding
+	if (++reader->col == reader->cols) {
+		reader->col = 0;
+		reader->nbits = 0;
+	}
+	return val * (255 / max);
+}
+
+/** Read the next span of the row of a FONT_CODEC_SPANS bitmap into 'span'.
+ * Returns 0, with 'span' untouched, once the row has no more, and the next
+ * call starts the next row. Renderers can fill opaque pixels in bulk and
+ * blend only the edges. */
+int font_reader_span(struct glyph_reader *reader, struct glyph_span *span)
+{
+	while (reader->count == 0) {
+		if (reader->mode == SPANS_END) {
+			reader->mode = SPANS_START;
+			return 0;
+		}
+		reader->count = *(reader->data++);
+		reader->mode = reader->count == 255 ? SPANS_MORE : SPANS_END;
+	}
+	reader->count--;
+
+	span->skip = *(reader->data++);
+	span->edges = *(reader->data++);
+	span->coverage = reader->data;
+	reader->data += span->edges;
+	span->fill = *(reader->data++);
+	return 1;
+}
+
+/** Return the next pixel of a FONT_CODEC_SPANS bitmap, for renderers that
+ * go a pixel at a time. */
+static uint8_t next_span_pixel(struct glyph_reader *reader)
+{
+	struct glyph_span *span = &reader->span;
+	uint8_t val = 0;
+
+	// Past the last span of the row, pixels are clear
+	if (!span->skip && !span->edges && !span->fill && !reader->row_done)
+		reader->row_done = !font_reader_span(reader, span);
+
+	if (span->skip) {
+		span->skip--;
+	} else if (span->edges) {
+		span->edges--;
+		val = *(span->coverage++);
+	} else if (span->fill) {
+		span->fill--;
+		val = 0xff;
+	}
+
+	// A row whose spans reach its end has yet to say it has no more
+	if (++reader->col == reader->cols) {
+		if (!reader->row_done)
+			font_reader_span(reader, span);
+		reader->col = 0;
+		reader->row_done = 0;
+	}
+	return val;
+}
+
+/** Return the next row of the bitmap if the codec stores whole rows, so
+ * that they can be copied or blended at once, or NULL if pixels must be
+ * read with font_reader_next(). */
+const uint8_t *font_reader_row(struct glyph_reader *reader)
+{
+	const uint8_t *row;
+
+	switch (reader->codec) {
+	case FONT_CODEC_RAW:
+		row = reader->data;
+		reader->data += reader->cols + reader->skip;
+		return row;
+
+	case FONT_CODEC_ROWS:
+		if (reader->count == 0) {
+			uint32_t entry = 0;
+
+			for (unsigned int b = 0; b < reader->table[0]; b++)
+				entry |= (uint32_t)*(reader->data++) << (8 * b);
+			reader->count = entry & 1 ? *(reader->data++) + 2 : 1;
+			reader->row = reader->table + (entry >> 1);
+		}
+		reader->count--;
+		return reader->row;
+
+	default:
+		return NULL;
+	}
+}
+
+/** Return the next pixel of the bitmap, in row order. */
+uint8_t font_reader_next(struct glyph_reader *reader)
+{
+	uint8_t val;
+
+	switch (reader->codec) {
+	case FONT_CODEC_RLE:
+		if (reader->count == 0) {
+			reader->count = (*reader->data & 0x3f) + 1;
+			reader->mode = *(reader->data++) >> 6;
+		}
+		reader->count--;
+		if (reader->mode == 0)
+			return *(reader->data++);
+		return reader->mode == 3 ? 0xff : 0;
+
+	case FONT_CODEC_PAL4:
+		if (reader->count == 0) {
+			reader->value = reader->table[*reader->data >> 6];
+			reader->count = (*(reader->data++) & 0x3f) + 1;
+		}
+		reader->count--;
+		return reader->value;
+
+	case FONT_CODEC_PAL16:
+		if (reader->count == 0) {
+			reader->value = reader->table[*reader->data >> 4];
+			reader->count = (*(reader->data++) & 0x0f) + 1;
+		}
+		reader->count--;
+		return reader->value;
+
+	case FONT_CODEC_LZ:
+		if (reader->count == 0) {
+			uint8_t token = *(reader->data++);
+			if (token & 0x80) {
+				reader->mode = LZ_MATCH;
+				reader->count = (token & 0x7f) + 3;
+				reader->distance = *(reader->data++);
+			} else {
+				reader->mode = LZ_LITERAL;
+				reader->count = token + 1;
+			}
+		}
+		reader->count--;
+		if (reader->mode == LZ_LITERAL)
+			val = *(reader->data++);
+		else
+			val = reader->window[(uint8_t)(reader->pos - reader->distance)];
+		reader->window[reader->pos++] = val;
+		return val;
+
+	case FONT_CODEC_HUFFMAN:
+		return next_huffman(reader);
+
+	case FONT_CODEC_BPP1:
+	case FONT_CODEC_BPP2:
+	case FONT_CODEC_BPP4:
+		return next_packed(reader);
+
+	case FONT_CODEC_SPANS:
+		return next_span_pixel(reader);
+
+	case FONT_CODEC_ROWS:
+		if (reader->col == 0)
+			font_reader_row(reader);
+		val = reader->row[reader->col];
+		if (++reader->col == reader->cols)
+			reader->col = 0;
+		return val;
+
+	default:
+		val = *(reader->data++);
+		if (++reader->col == reader->cols) {
+			reader->col = 0;
+			reader->data += reader->skip;
+		}
+		return val;
+	}
+}
+
+/** Return the name of 'codec', as given to "fontem --codec". */
+const char *font_codec_name(uint8_t codec)
+{
+	static const char *names[] = {
+		[FONT_CODEC_RAW]	= "raw",
+		[FONT_CODEC_RLE]	= "rle",
+		[FONT_CODEC_PAL4]	= "pal4",
+		[FONT_CODEC_PAL16]	= "pal16",
+		[FONT_CODEC_LZ]		= "lz",
+		[FONT_CODEC_HUFFMAN]	= "huffman",
+		[FONT_CODEC_MIXED]	= "mixed",
+		[FONT_CODEC_ROWS]	= "rows",
+		[FONT_CODEC_BPP1]	= "bpp1",
+		[FONT_CODEC_BPP2]	= "bpp2",
+		[FONT_CODEC_BPP4]	= "bpp4",
+		[FONT_CODEC_SPANS]	= "spans",
+	};
+
+	return codec < sizeof(names) / sizeof(names[0]) ? names[codec] : "unknown";
+}
+
+// vim: set softtabstop=8 shiftwidth=8 tabstop=8:
@@ -9,41 +9,135 @@
 #include <ctype.h>
 #include <config.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <locale.h>
 #include <popt.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <wchar.h>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
 
-#define DEFAULT_CHAR_LIST "!@#$%^&*()_+-={}|[]\\:\";'<>?,./`~" \
-	" " \
-	"ABCDEFGHIJKLMNOPQRSTUVWXYZ" \
-	"abcdefghijklmnopqrstuvwxyz" \
-	"0123456789" \
-	"ÄÖÜßäöü"
-
-#define FONT_DPI 100
-
-/** Font library handle */
-FT_Library library;
-char *section = NULL;
-
-void store_glyph(FT_Face *face, FT_GlyphSlotRec *glyph, int ch, int size, char *name, FILE *c, char **post, int *post_len, int *post_count, int with_kerning, wchar_t *char_list, int compress, int rotate, int mono);
-static char *get_section(char *name);
-static int cmp_wchar(const void *p1, const void *p2);
-
-static char *mb(wchar_t wchar)
-{
-	static char ch_mb[16];
-	int mb_len = wctomb(ch_mb, wchar);
-
-	ch_mb[mb_len] = '\0';
-	return ch_mb;
-}
+#include "generator.h"
+#include "resource/fontem.h"
+
+/** Size of a buffer big enough for any string returned by get_section() */
+#define SECTION_BUFLEN 512
+
+/** What store_glyph() needs to write the table of glyphs. */
+struct options {
+	const char	*name;          /** C-sane output name */
+	const struct kern_classes *kerning; /** Kerning classes, or NULL */
+	const struct atlas *atlas;      /** Atlas holding the bitmaps */
+};
+
+/** Names of the arrays a struct font points to. */
+struct font_syms {
+	const char	*codepoints;    /** Character codes */
+	const char	*lookup;        /** Lookup table */
+	const char	*kerning;       /** Kerning class matrix */
+	const char	*atlas;         /** Bitmaps */
+	const char	*codec;         /** Codec table */
+	const char	*glyphs;        /** Glyph metrics */
+	const char	*glyph_codecs;  /** Codec of each glyph */
+};
+
+/** A font to generate: the options given for it, and what they work out to. */
+struct job {
+	struct source	*fonts;         /** Fonts given by --font, the first naming the font */
+	size_t		font_count;
+	int		font_size;      /** Font size */
+	const char	*char_list;     /** --chars, as given */
+	int		chars_given;    /** Whether --chars was given */
+	const char	**chars_from;   /** Files given by --chars-from */
+	size_t		chars_from_count;
+	const char	**traces;       /** Files given by --chars-from-trace */
+	size_t		trace_count;
+	const char	*output_name;   /** Output name */
+	const char	*output_dir;    /** Output directory */
+	const char	*append;        /** Appended to file and symbol names */
+	const char	*section;       /** Section for font data, or NULL */
+	const char	*format;        /** Output format */
+	const char	*machine_name;  /** Target of --format=obj, or NULL */
+	const char	*codec_name;    /** Codec, or NULL for --rle or raw */
+	int		bpp;            /** Bits per pixel of --bpp, or 0 */
+	const char	*optimize_mode; /** What a mixed codec favours, or NULL */
+	const char	*atlas_mode;    /** Atlas layout */
+	const char	*lookup_mode;   /** Glyph lookup */
+	const char	*strings_file;  /** File given by --strings, or NULL */
+	const char	*tint_spec;     /** --tint, as given, or NULL */
+	long		flash_budget;   /** Most bytes the bitmaps may take, or 0 */
+	int		rle;            /** Whether --rle was given */
+	int		rotate;         /** Whether to rotate bitmaps */
+	int		mono;           /** Whether to render monochrome bitmaps */
+	int		sdf;            /** Whether to render signed distance fields */
+	int		outlines;       /** Whether to write outlines instead of bitmaps */
+	int		subpixel;       /** Horizontal phases to render glyphs at, or 0 */
+	int		lcd;            /** Whether to render red, green and blue coverage */
+	int		glyph32;        /** Whether to lay the font out for 32-bit glyph_t */
+	int		force;          /** Whether to regenerate output that is up to date */
+
+	char		*output_name_c; /** C-sane output name */
+	char		*append_sane;   /** C-sane 'append' */
+	int		literal;        /** Whether 'char_list' lists characters, not ranges */
+	wchar_t		*base_list;     /** Sorted characters of 'char_list' */
+	size_t		base_count;
+	const wchar_t	*list;          /** Sorted characters to generate */
+	size_t		count;
+	int		emit_c, emit_asm, emit_obj, emit_h;
+	int		machine;        /** Machine of --format=obj */
+	int		atlas;          /** ATLAS_ layout */
+	int		lookup;         /** FONT_LOOKUP_ type, or LOOKUP_AUTO */
+	int		codec;          /** FONT_CODEC_ encoding */
+	int		optimize;       /** OPTIMIZE_ goal of a mixed codec */
+	size_t		budget;         /** Most bytes the bitmaps may take */
+	char		*c_name, *h_name, *data_name, *bin_name;
+	char		*font_sym;      /** Name of the struct font */
+	struct text_string *strings;    /** Strings to lay out */
+	size_t		string_count;
+	char		**run_syms;     /** Name of the struct font_run of each string */
+	uint16_t	*tints;         /** Colors to tint the glyphs for */
+	size_t		tint_count;
+	char		*tint_sym;      /** Name of the struct font_tint */
+	char		*sdf_sym;       /** Name of the struct font_sdf */
+	char		*outlines_sym;  /** Name of the struct font_outlines */
+	char		*subpixel_sym;  /** Name of the struct font_subpixel */
+	uint64_t	hash;           /** Hash of the inputs */
+	int		current;        /** Whether the output is up to date */
+	const struct rendering *rendering; /** Glyphs to write the font from */
+};
+
+/** A face loaded at one size, shared by the jobs that use it. */
+struct loaded_face {
+	const char		*filename;
+	int			size;
+	FT_Face			face;
+	struct loaded_face	*next;
+};
+
+static int write_source(const struct job *job, const struct built_font *bf,
+			FILE *c, FILE *h, FILE *data);
+static void store_atlas(FILE *c, const struct font_data *fd, const struct atlas *atlas, const char *aname,
+			const char *section);
+static void finish_header(FILE *h, const char *name_c, int size, const char *append_sane);
+static void store_codec_data(FILE *c, const struct font_data *fd, const char *sym, const char *section);
+static int store_glyphs(FILE *c, const struct font_data *fd, const struct options *opts,
+			const struct font_syms *syms, const char *section);
+static void store_font(FILE *c, const struct font_data *fd, const char *qualifier, const char *sym,
+		       const char *section, int lookup, size_t table_len, const struct atlas *atlas,
+		       const struct font_syms *syms);
+static void store_run(FILE *c, const struct job *job, const struct font_data *fd, size_t idx,
+		      const char *glyphs_sym);
+static void store_tint(FILE *c, const struct job *job, const struct font_data *fd);
+static void store_outlines(FILE *c, const struct job *job, const struct font_data *fd);
+static int store_subpixel(FILE *c, const struct job *job, const struct font_data *fd,
+			  const struct font_syms *syms, int lookup, size_t table_len);
+int store_glyph(const struct glyph_data *gd, size_t idx, const struct options *opts, FILE *c);
+static const char *get_section(char *str, const char *section, const char *name);
 
 static char *validate_identifier(const char *identifier)
 {
@@ -62,34 +156,156 @@ static char *validate_identifier(const char *identifier)
 	return result;
 }
 
-int main(int argc, const char *argv[])
+/** Print 'list', which is sorted, as ranges that --chars would accept. */
+static void print_ranges(FILE *f, const wchar_t *list, size_t count)
 {
-	setlocale(LC_ALL, "");
+	for (size_t i = 0; i < count; i++) {
+		size_t j = i;
+
+		while (j + 1 < count && list[j + 1] == list[j] + 1)
+			j++;
+		fprintf(f, "%sU+%04X", i ? "," : "", (unsigned int)list[i]);
+		if (j > i)
+			fprintf(f, "-U+%04X", (unsigned int)list[j]);
+		i = j;
+	}
+}
+
+/** Append 'file' to the list of 'count' files at '*list'. */
+static void add_file(const char ***list, size_t *count, const char *file)
+{
+	*list = realloc(*list, (*count + 1) * sizeof(char *));
+	(*list)[(*count)++] = file;
+}
 
-	int len, error;
-	int rle = 0;
-	int rotate = 0;
-	int mono = 0;
+/** Append the font given as "file[:chars]" to the fonts of 'job'. */
+static void add_font(struct job *job, const char *arg)
+{
+	const char *slash = strrchr(arg, '/');
+	const char *colon = strchr(slash ? slash : arg, ':');
+
+	job->fonts = realloc(job->fonts, (job->font_count + 1) * sizeof(struct source));
+	struct source *src = &job->fonts[job->font_count++];
+	memset(src, 0, sizeof(*src));
+	src->filename = colon ? strndup(arg, colon - arg) : arg;
+	src->chars = colon ? colon + 1 : NULL;
+}
+
+/** Return the bytes the glyph for 'ch' would take in the font: its bitmap,
+ * as encoded by the worker, its metrics and its character code. */
+static size_t glyph_cost(const struct job *job, wchar_t ch, const struct render_options *opts)
+{
+	struct glyph_data gd;
+	int found;
+
+	if (render_char(char_source(job->fonts, job->font_count, ch, &found)->face, ch, opts, &gd))
+		return 0;
+	free(gd.bitmap);
+	if (gd.outline) {
+		const struct outline_data *od = gd.outline;
+
+		gd.length = od->point_count * 2 * sizeof(int16_t) + (od->point_count + 7) / 8 +
+			    od->contour_count * sizeof(uint16_t) + sizeof(struct font_outline_glyph);
+		free(od->points);
+		free(od->on);
+		free(od->ends);
+		free(gd.outline);
+	}
+	return gd.length + sizeof(struct glyph) + sizeof(glyph_t);
+}
+
+/** Return how many fewer bytes the glyphs of 'subset' take than those of
+ * 'list'; both are sorted. Only the characters in one list but not the
+ * other are rendered. */
+static long subset_saving(const struct job *job, const wchar_t *list, size_t count,
+			  const wchar_t *subset, size_t subset_count,
+			  const struct render_options *opts)
+{
+	size_t i = 0, j = 0;
+	long saving = 0;
+
+	while (i < count || j < subset_count) {
+		if (j == subset_count || (i < count && list[i] < subset[j]))
+			saving += glyph_cost(job, list[i++], opts);
+		else if (i == count || subset[j] < list[i])
+			saving -= glyph_cost(job, subset[j++], opts);
+		else {
+			i++;
+			j++;
+		}
+	}
+	return saving;
+}
 
-	char *font_filename = NULL;
-	char *char_list = strdup(DEFAULT_CHAR_LIST);
-	char *output_name = NULL;
-	char *output_dir = ".";
-	char *append = "";
-	char *append_sane = NULL;
-	int font_size = 10;
+/** Fill 'job' with the defaults of the command line options. */
+static void job_defaults(struct job *job)
+{
+	memset(job, 0, sizeof(*job));
+	job->font_size = 10;
+	job->char_list = DEFAULT_CHAR_LIST;
+	job->output_dir = ".";
+	job->append = "";
+	job->format = "c";
+	job->atlas_mode = "1d";
+	job->lookup_mode = "auto";
+}
+
+/** Parse the options in 'argv' into 'job', on top of what it already holds.
+ * 'jobs' and 'manifest' receive --jobs and --manifest. Returns non-zero if
+ * the options are not valid. */
+static int parse_options(int argc, const char *argv[], struct job *job, int *jobs,
+			 const char **manifest)
+{
+	char *font_arg = NULL, *chars_file = NULL, *trace_file = NULL;
+	int fonts_given = 0;
+
+	// The lists of files may be shared with the job this one started from
+	const char **chars_from = job->chars_from, **traces = job->traces;
+	job->chars_from = NULL;
+	job->traces = NULL;
+	size_t chars_from_count = job->chars_from_count, trace_count = job->trace_count;
+	job->chars_from_count = job->trace_count = 0;
+	for (size_t i = 0; i < chars_from_count; i++)
+		add_file(&job->chars_from, &job->chars_from_count, chars_from[i]);
+	for (size_t i = 0; i < trace_count; i++)
+		add_file(&job->traces, &job->trace_count, traces[i]);
+	const struct source *fonts = job->fonts;
+	size_t font_count = job->font_count;
+	job->fonts = malloc((font_count + 1) * sizeof(struct source));
+	memcpy(job->fonts, fonts, font_count * sizeof(struct source));
 
 	struct poptOption opts[] = {
-		{ "font",    'f', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &font_filename, 1, "Font filename",		     "file"    },
-		{ "size",    's', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT,    &font_size,     1, "Font size",			     "integer" },
-		{ "chars",   'c', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &char_list,     1, "List of characters to produce",   "string"  },
-		{ "name",    'n', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &output_name,   1, "Output name (without extension)", "file"    },
-		{ "dir",     'd', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &output_dir,    1, "Output directory",		     "dir"     },
-		{ "section", 0,	  POPT_ARG_STRING,			       &section,       1, "Section for font data",	     "name"    },
-		{ "rle",     0,	  POPT_ARG_VAL | POPT_ARGFLAG_SHOW_DEFAULT,    &rle,	       1, "Use RLE compression",	     "rle"     },
-		{ "append",  0,	  POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &append,	       1, "Append str to filename, structs", ""	       },
-		{ "rotate",  'r', POPT_ARG_VAL | POPT_ARGFLAG_SHOW_DEFAULT,    &rotate,	       1, "Rotate bitmap by 90 cw",	     ""	       },
-		{ "mono",    'm', POPT_ARG_VAL | POPT_ARGFLAG_SHOW_DEFAULT,    &mono,	       1, "Mono typeface",		     ""	       },
+		{ "font",    'f', POPT_ARG_STRING,			       &font_arg,	    5, "Font filename, and the characters to take from it", "file[:chars]" },
+		{ "size",    's', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT,    &job->font_size,     1, "Font size",			     "integer" },
+		{ "chars",   'c', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &job->char_list,     4, "List of characters to produce",   "string"  },
+		{ "chars-from", 0, POPT_ARG_STRING,			       &chars_file,	    2, "Produce the characters used in a file", "file" },
+		{ "chars-from-trace", 0, POPT_ARG_STRING,		       &trace_file,	    3, "Produce the characters in a glyph trace", "file" },
+		{ "name",    'n', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &job->output_name,   1, "Output name (without extension)", "file"    },
+		{ "dir",     'd', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &job->output_dir,    1, "Output directory",		     "dir"     },
+		{ "section", 0,	  POPT_ARG_STRING,			       &job->section,	    1, "Section for font data",	     "name"    },
+		{ "rle",     0,	  POPT_ARG_VAL | POPT_ARGFLAG_SHOW_DEFAULT,    &job->rle,	    1, "Use RLE compression",	     "rle"     },
+		{ "codec",   0,	  POPT_ARG_STRING,			       &job->codec_name,    1, "Bitmap codec (raw, rle, pal4, pal16, lz, huffman, mixed, rows, bpp1, bpp2, bpp4, spans)", "codec" },
+		{ "bpp",     0,	  POPT_ARG_INT,				       &job->bpp,	    1, "Pack coverage into N bits per pixel (1, 2, 4)", "N" },
+		{ "optimize", 0,  POPT_ARG_STRING,			       &job->optimize_mode, 1, "What mixed codecs favour (size, speed)", "goal" },
+		{ "flash-budget", 0, POPT_ARG_LONG,			       &job->flash_budget,  1, "Most bytes the bitmaps may take",  "bytes"   },
+		{ "append",  0,	  POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &job->append,	    1, "Append str to filename, structs", ""	       },
+		{ "rotate",  'r', POPT_ARG_VAL | POPT_ARGFLAG_SHOW_DEFAULT,    &job->rotate,	    1, "Rotate bitmap by 90 cw",	     ""	       },
+		{ "mono",    'm', POPT_ARG_VAL | POPT_ARGFLAG_SHOW_DEFAULT,    &job->mono,	    1, "Mono typeface",		     ""	       },
+		{ "jobs",    'j', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT,    jobs,		    1, "Worker threads (0 = one per CPU)", "integer" },
+		{ "format",  0,	  POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &job->format,	    1, "Output format (c, blob, asm, obj)", "format" },
+		{ "machine", 0,	  POPT_ARG_STRING,			       &job->machine_name,  1, "Target of --format=obj (x86_64, i386, arm, aarch64)", "name" },
+		{ "atlas",   0,	  POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &job->atlas_mode,    1, "Bitmap atlas layout (1d, 2d)",	     "mode"    },
+		{ "lookup",  0,	  POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &job->lookup_mode,   1, "Glyph lookup (auto, search, direct, ranges, pages, eytzinger)", "type" },
+		{ "strings", 0,	  POPT_ARG_STRING,			       &job->strings_file,  1, "Lay out the strings in a file", "file" },
+		{ "tint",    0,	  POPT_ARG_STRING,			       &job->tint_spec,	    1, "Colors to tint the glyphs for (RGB565:color,...)", "colors" },
+		{ "sdf",     0,	  POPT_ARG_VAL,					       &job->sdf,	    1, "Render signed distance fields", "" },
+		{ "sdf-size", 0,  POPT_ARG_INT,				       &job->font_size,	    6, "Render distance fields at a size", "integer" },
+		{ "outlines", 0,  POPT_ARG_VAL,					       &job->outlines,	    1, "Write outlines instead of bitmaps", "" },
+		{ "subpixel", 0,  POPT_ARG_INT,				       &job->subpixel,	    1, "Render glyphs at N horizontal phases", "N" },
+		{ "lcd",     0,	  POPT_ARG_VAL,					       &job->lcd,	    1, "Render for LCDs with RGB stripes", "" },
+		{ "glyph32", 0,	  POPT_ARG_VAL,					       &job->glyph32,	    1, "Lay asm and obj fonts out for 32-bit glyph_t", "" },
+		{ "manifest", 0,  POPT_ARG_STRING,			       manifest,	    1, "Generate every font listed in a file", "file" },
+		{ "force",   0,	  POPT_ARG_VAL,					       &job->force,	    1, "Regenerate even if up to date",   ""	       },
 		POPT_AUTOHELP
 		POPT_TABLEEND
 	};
@@ -103,108 +319,780 @@ int main(int argc, const char *argv[])
 			/* No-op */
 			break;
 
+		case 2:
+			add_file(&job->chars_from, &job->chars_from_count, chars_file);
+			break;
+
+		case 3:
+			add_file(&job->traces, &job->trace_count, trace_file);
+			break;
+
+		case 4:
+			job->chars_given = 1;
+			break;
+
+		case 5:
+			// Fonts given here replace those of the job this one
+			// started from
+			if (!fonts_given++)
+				job->font_count = 0;
+			add_font(job, font_arg);
+			break;
+
+		case 6:
+			job->sdf = 1;
+			break;
+
 		default:
 			fprintf(stderr, "ERROR: Unexpected option value '%d'.\n", rc);
 			return 1;
 		}
 	}
+	if (rc < -1) {
+		fprintf(stderr, "ERROR: %s: %s\n",
+			poptBadOption(ctx, POPT_BADOPTION_NOALIAS), poptStrerror(rc));
+		return 1;
+	}
 
 	poptFreeContext(ctx);
+	return 0;
+}
+
+/** Check the options of 'job', work out its output names and the hash of its
+ * inputs, and see whether its output is already up to date. Returns
+ * non-zero if the job can't be done. */
+static int prepare_job(struct job *job, FT_Library library)
+{
+	int len;
 
-	if (font_filename == NULL) {
+	if (job->font_count == 0) {
 		fprintf(stderr, "ERROR: You must specify a font filename.\n");
 		return 1;
 	}
 
-	if (output_name == NULL) {
+	if (job->output_name == NULL) {
 		fprintf(stderr, "ERROR: You must specify an output name.\n");
 		return 1;
 	}
 
-	// Make a copy of 'append' with C-sane characters
-	append_sane = validate_identifier(append);
+	// Make copies of the names with C-sane characters
+	job->output_name_c = validate_identifier(job->output_name);
+	job->append_sane = validate_identifier(job->append);
 
-	// Convert the char list into wide characters and sort it
-	size_t char_count = mbstowcs(NULL, char_list, 0);
-	if (char_count == (size_t)-1) {
-		perror("converting char list");
+	// Convert the char list into wide characters and sort it; a list of
+	// ranges only covers the characters the font has
+	job->literal = parse_char_list(job->char_list, &job->base_list, &job->base_count);
+	if (job->literal < 0)
 		return 1;
+	for (size_t i = 0; i < job->font_count; i++) {
+		struct source *src = &job->fonts[i];
+
+		if (src->chars && parse_char_list(src->chars, &src->list, &src->count) < 0) {
+			fprintf(stderr, "ERROR: Invalid characters for '%s'.\n", src->filename);
+			return 1;
+		}
 	}
-	wchar_t *wide_char_list = (wchar_t *)calloc(char_count + 1, sizeof(wchar_t));
-	char_count = mbstowcs(wide_char_list, char_list, char_count + 1);
-	qsort(wide_char_list, char_count, sizeof(wchar_t), cmp_wchar);
 
-	// Init the font library
-	error = FT_Init_FreeType(&library);
-	if (error) {
-		fprintf(stderr, "ERROR: Can't initialize FreeType.\n");
+	// Work out the output file names
+	const char *format = job->format;
+	job->emit_c = !strcmp(format, "c");
+	job->emit_asm = !strcmp(format, "asm");
+	job->emit_obj = !strcmp(format, "obj");
+	if (!job->emit_c && !job->emit_asm && !job->emit_obj && strcmp(format, "blob")) {
+		fprintf(stderr, "ERROR: Unknown output format '%s'.\n", format);
 		return 1;
 	}
+	// Everything but a font pack comes with a header
+	job->emit_h = job->emit_c || job->emit_asm || job->emit_obj;
 
-	// Load the font
-	FT_Face face;
-	error = FT_New_Face(library, font_filename, 0, &face);
-	if (error) {
-		fprintf(stderr, "ERROR: Can't load '%s'.\n", font_filename);
+	job->machine = machine_id(job->machine_name);
+	if (job->emit_obj && job->machine == -1) {
+		if (job->machine_name)
+			fprintf(stderr, "ERROR: Unknown machine '%s'.\n", job->machine_name);
+		else
+			fprintf(stderr, "ERROR: Give --machine to write objects on this host.\n");
 		return 1;
 	}
 
-	// Set the size
-	error = FT_Set_Char_Size(face, font_size * 64, 0, FONT_DPI, 0);
-	if (error) {
-		fprintf(stderr, "ERROR: Can't set the font size to %d", font_size);
+	if (!strcmp(job->atlas_mode, "1d")) {
+		job->atlas = ATLAS_1D;
+	} else if (!strcmp(job->atlas_mode, "2d")) {
+		job->atlas = ATLAS_2D;
+	} else {
+		fprintf(stderr, "ERROR: Unknown atlas mode '%s'.\n", job->atlas_mode);
+		return 1;
+	}
+	if (job->atlas == ATLAS_2D && !job->emit_h) {
+		fprintf(stderr, "ERROR: A 2D atlas is not available in font packs.\n");
+		return 1;
+	}
+	job->lookup = lookup_type(job->lookup_mode);
+	if (job->lookup == -1) {
+		fprintf(stderr, "ERROR: Unknown lookup type '%s'.\n", job->lookup_mode);
+		return 1;
+	}
+
+	// --bpp=N is the same as --codec=bppN
+	if (job->bpp) {
+		static const char *packed[] = { NULL, "bpp1", "bpp2", NULL, "bpp4" };
+
+		if (job->bpp < 0 || job->bpp > 4 || packed[job->bpp] == NULL) {
+			fprintf(stderr, "ERROR: --bpp takes 1, 2 or 4 bits per pixel.\n");
+			return 1;
+		}
+		if (job->codec_name && strcmp(job->codec_name, packed[job->bpp])) {
+			fprintf(stderr, "ERROR: --bpp conflicts with --codec=%s.\n", job->codec_name);
+			return 1;
+		}
+		job->codec_name = packed[job->bpp];
+	}
+
+	job->codec = job->rle ? FONT_CODEC_RLE : FONT_CODEC_RAW;
+	if (job->codec_name) {
+		job->codec = codec_id(job->codec_name);
+		if (job->codec == -1) {
+			fprintf(stderr, "ERROR: Unknown codec '%s'.\n", job->codec_name);
+			return 1;
+		}
+		if (job->rle && job->codec != FONT_CODEC_RLE) {
+			fprintf(stderr, "ERROR: --rle conflicts with --codec=%s.\n", job->codec_name);
+			return 1;
+		}
+	}
+	if (job->codec > FONT_CODEC_RLE && job->rotate) {
+		fprintf(stderr, "ERROR: The %s codec needs unrotated 8-bit bitmaps.\n",
+			job->codec_name);
+		return 1;
+	}
+
+	job->optimize = OPTIMIZE_SIZE;
+	if (job->optimize_mode) {
+		if (!strcmp(job->optimize_mode, "speed")) {
+			job->optimize = OPTIMIZE_SPEED;
+		} else if (strcmp(job->optimize_mode, "size")) {
+			fprintf(stderr, "ERROR: Unknown optimization '%s'.\n", job->optimize_mode);
+			return 1;
+		}
+		if (job->codec != FONT_CODEC_MIXED) {
+			fprintf(stderr, "ERROR: --optimize needs --codec=mixed.\n");
+			return 1;
+		}
+	}
+	if (job->flash_budget < 0) {
+		fprintf(stderr, "ERROR: Invalid flash budget %ld.\n", job->flash_budget);
 		return 1;
 	}
+	job->budget = job->flash_budget ? (size_t)job->flash_budget : NO_BUDGET;
 
-	char *font_name = face->family_name;
+	if (job->atlas == ATLAS_2D && (job->codec != FONT_CODEC_RAW || job->rotate)) {
+		fprintf(stderr, "ERROR: A 2D atlas needs uncompressed, unrotated 8-bit bitmaps.\n");
+		return 1;
+	}
 
-	// Open the output files
+	const char *output_dir = job->output_dir, *output_name = job->output_name;
+	const char *append = job->append;
+	int font_size = job->font_size;
 	len = strlen(output_dir) + strlen(output_name) + strlen(append) + 32;
-	char *c_name = malloc(len);
-	snprintf(c_name, len, "%s/font-%s-%d%s.c",
+	job->c_name = malloc(len);
+	snprintf(job->c_name, len, "%s/font-%s-%d%s.%s",
+		 output_dir,
+		 output_name,
+		 font_size,
+		 append,
+		 job->emit_asm ? "S" : job->emit_obj ? "o" : "c");
+	job->data_name = malloc(len);
+	snprintf(job->data_name, len, "%s/font-%s-%d%s-data.bin",
 		 output_dir,
 		 output_name,
 		 font_size,
 		 append);
-	FILE *c = fopen(c_name, "w");
-	if (c == NULL) {
-		fprintf(stderr, "ERROR: Can't open '%s' for writing: %s\n",
-			c_name, strerror(errno));
-		return 1;
-	}
-
-	char *h_name = malloc(len);
-	snprintf(h_name, len, "%s/font-%s-%d%s.h",
+	job->h_name = malloc(len);
+	snprintf(job->h_name, len, "%s/font-%s-%d%s.h",
 		 output_dir,
 		 output_name,
 		 font_size,
 		 append);
-	FILE *h = fopen(h_name, "w");
-	if (h == NULL) {
+	job->bin_name = malloc(len);
+	snprintf(job->bin_name, len, "%s/font-%s-%d%s.bin",
+		 output_dir,
+		 output_name,
+		 font_size,
+		 append);
+	job->font_sym = malloc(strlen(job->output_name_c) + strlen(job->append_sane) + 32);
+	sprintf(job->font_sym, "font_%s_%d%s", job->output_name_c, font_size, job->append_sane);
+
+	// Strings are laid out as C, alongside the font
+	if (job->strings_file) {
+		if (!job->emit_c) {
+			fprintf(stderr, "ERROR: --strings needs --format=c.\n");
+			return 1;
+		}
+		if (read_strings(job->strings_file, &job->strings, &job->string_count))
+			return 1;
+		job->run_syms = calloc(job->string_count + 1, sizeof(char *));
+		for (size_t i = 0; i < job->string_count; i++) {
+			job->run_syms[i] = malloc(strlen(job->output_name_c) + strlen(job->append_sane) +
+						  strlen(job->strings[i].name) + 32);
+			sprintf(job->run_syms[i], "run_%s_%d%s_%s", job->output_name_c, font_size,
+				job->append_sane, job->strings[i].name);
+		}
+	}
+
+	// Tinted glyphs are written as C, alongside the font
+	if (job->tint_spec) {
+		if (strncmp(job->tint_spec, "RGB565:", 7)) {
+			fprintf(stderr, "ERROR: Unknown tint format '%s'.\n", job->tint_spec);
+			return 1;
+		}
+		if (!job->emit_c) {
+			fprintf(stderr, "ERROR: --tint needs --format=c.\n");
+			return 1;
+		}
+		if (job->rotate) {
+			fprintf(stderr, "ERROR: --tint needs unrotated 8-bit bitmaps.\n");
+			return 1;
+		}
+		for (const char *p = job->tint_spec + 7;; p++) {
+			char *end;
+			unsigned long color = strtoul(p, &end, 0);
+
+			if (end == p || color > 0xffff || (*end && *end != ',') ||
+			    job->tint_count == UINT8_MAX) {
+				fprintf(stderr, "ERROR: Invalid tint colors '%s'.\n", job->tint_spec);
+				return 1;
+			}
+			job->tints = realloc(job->tints, (job->tint_count + 1) * sizeof(uint16_t));
+			job->tints[job->tint_count++] = (uint16_t)color;
+			p = end;
+			if (*p == '\0')
+				break;
+		}
+		job->tint_sym = malloc(strlen(job->output_name_c) + strlen(job->append_sane) + 32);
+		sprintf(job->tint_sym, "tint_%s_%d%s", job->output_name_c, font_size, job->append_sane);
+	}
+
+	// Distance fields are sampled anywhere, so they are stored raw
+	if (job->sdf) {
+		if (!job->emit_c) {
+			fprintf(stderr, "ERROR: --sdf needs --format=c.\n");
+			return 1;
+		}
+		if (job->codec != FONT_CODEC_RAW || job->rotate || job->mono) {
+			fprintf(stderr, "ERROR: --sdf needs uncompressed, unrotated 8-bit bitmaps.\n");
+			return 1;
+		}
+		if (job->strings_file || job->tint_spec) {
+			fprintf(stderr, "ERROR: --sdf can't be used with --strings or --tint.\n");
+			return 1;
+		}
+		job->sdf_sym = malloc(strlen(job->output_name_c) + strlen(job->append_sane) + 32);
+		sprintf(job->sdf_sym, "sdf_%s_%d%s", job->output_name_c, font_size, job->append_sane);
+	}
+
+	// Outlines are in the units of one font, and have no bitmaps to
+	// rotate, tint or lay out
+	if (job->outlines) {
+		if (!job->emit_c) {
+			fprintf(stderr, "ERROR: --outlines needs --format=c.\n");
+			return 1;
+		}
+		if (job->font_count > 1) {
+			fprintf(stderr, "ERROR: --outlines needs a single --font.\n");
+			return 1;
+		}
+		if (job->rotate || job->mono || job->sdf || job->strings_file || job->tint_spec) {
+			fprintf(stderr, "ERROR: --outlines can't be used with --rotate, --mono, --sdf, " \
+				"--strings or --tint.\n");
+			return 1;
+		}
+		job->outlines_sym = malloc(strlen(job->output_name_c) + strlen(job->append_sane) + 32);
+		sprintf(job->outlines_sym, "outlines_%s_%d%s", job->output_name_c, font_size,
+			job->append_sane);
+	}
+
+	// Phases are horizontal offsets of glyphs that are drawn as bitmaps
+	if (job->subpixel) {
+		if (job->subpixel < 2 || job->subpixel > SUBPIXEL_MAX) {
+			fprintf(stderr, "ERROR: --subpixel takes 2 to %d phases.\n", SUBPIXEL_MAX);
+			return 1;
+		}
+		if (!job->emit_c) {
+			fprintf(stderr, "ERROR: --subpixel needs --format=c.\n");
+			return 1;
+		}
+		if (job->rotate || job->sdf || job->outlines) {
+			fprintf(stderr, "ERROR: --subpixel can't be used with --rotate, --sdf or --outlines.\n");
+			return 1;
+		}
+		job->subpixel_sym = malloc(strlen(job->output_name_c) + strlen(job->append_sane) + 32);
+		sprintf(job->subpixel_sym, "subpixel_%s_%d%s", job->output_name_c, font_size,
+			job->append_sane);
+	}
+
+	// Each pixel is three bytes of coverage, which only the LCD renderers
+	// draw
+	if (job->lcd) {
+		if (job->rotate || job->mono || job->sdf || job->outlines || job->subpixel ||
+		    job->strings_file || job->tint_spec) {
+			fprintf(stderr, "ERROR: --lcd can't be used with --rotate, --mono, --sdf, " \
+				"--outlines, --subpixel, --strings or --tint.\n");
+			return 1;
+		}
+	}
+
+	// Hash everything that affects the output
+	FT_Int ft_major, ft_minor, ft_patch;
+	FT_Library_Version(library, &ft_major, &ft_minor, &ft_patch);
+
+	uint64_t hash = HASH_INIT;
+	hash_int(&hash, FONTEM_OUTPUT_VERSION);
+	hash_int(&hash, FONT_PACK_VERSION);
+	hash_int(&hash, ft_major);
+	hash_int(&hash, ft_minor);
+	hash_int(&hash, ft_patch);
+	if (hash_file(&hash, job->fonts[0].filename)) {
+		fprintf(stderr, "ERROR: Can't read '%s': %s\n", job->fonts[0].filename, strerror(errno));
+		return 1;
+	}
+	hash_int(&hash, font_size);
+	hash_int(&hash, job->base_count);
+	hash_data(&hash, job->base_list, job->base_count * sizeof(wchar_t));
+	hash_string(&hash, format);
+	hash_string(&hash, output_name);
+	hash_string(&hash, append);
+	hash_int(&hash, job->section != NULL);
+	hash_string(&hash, job->section ? job->section : "");
+	hash_int(&hash, job->codec);
+	hash_int(&hash, job->optimize);
+	hash_int(&hash, job->flash_budget);
+	hash_int(&hash, job->rotate);
+	hash_int(&hash, job->mono);
+	hash_int(&hash, job->atlas);
+	hash_int(&hash, job->lookup);
+	hash_int(&hash, job->emit_obj ? job->machine : -1);
+	hash_int(&hash, job->glyph32);
+	hash_int(&hash, job->chars_given);
+	for (size_t i = 0; i < job->chars_from_count + job->trace_count; i++) {
+		const char *file = i < job->chars_from_count ?
+				   job->chars_from[i] : job->traces[i - job->chars_from_count];
+
+		hash_int(&hash, i < job->chars_from_count);
+		if (hash_file(&hash, file)) {
+			fprintf(stderr, "ERROR: Can't read '%s': %s\n", file, strerror(errno));
+			return 1;
+		}
+	}
+	// Glyphs taken from other fonts, or only some from the first
+	if (job->font_count > 1 || job->fonts[0].chars) {
+		for (size_t i = 0; i < job->font_count; i++) {
+			const struct source *src = &job->fonts[i];
+
+			if (i && hash_file(&hash, src->filename)) {
+				fprintf(stderr, "ERROR: Can't read '%s': %s\n",
+					src->filename, strerror(errno));
+				return 1;
+			}
+			hash_int(&hash, src->chars != NULL);
+			hash_string(&hash, src->chars ? src->chars : "");
+		}
+	}
+	// Each optional field follows a tag, so that one can't pass for another
+	if (job->strings_file) {
+		hash_string(&hash, "strings");
+		hash_int(&hash, job->string_count);
+		if (hash_file(&hash, job->strings_file)) {
+			fprintf(stderr, "ERROR: Can't read '%s': %s\n", job->strings_file, strerror(errno));
+			return 1;
+		}
+	}
+	if (job->tint_spec) {
+		hash_string(&hash, "tint");
+		hash_string(&hash, job->tint_spec);
+	}
+	if (job->sdf) {
+		hash_string(&hash, "sdf");
+		hash_int(&hash, SDF_SPREAD(font_size));
+	}
+	if (job->outlines)
+		hash_string(&hash, "outlines");
+	if (job->subpixel) {
+		hash_string(&hash, "subpixel");
+		hash_int(&hash, job->subpixel);
+	}
+	if (job->lcd)
+		hash_string(&hash, "lcd");
+	// Assembler source includes its data by path
+	hash_string(&hash, job->emit_asm ? output_dir : "");
+	job->hash = hash;
+
+	// Leave the output alone if it was generated from the same inputs, so
+	// that anything built from it is not rebuilt
+	if (!job->force && (job->emit_h ?
+			    output_is_current(job->c_name, hash) &&
+			    output_is_current(job->h_name, hash) &&
+			    (!job->emit_asm || access(job->data_name, R_OK) == 0) :
+			    output_is_current(job->bin_name, hash))) {
+		printf("%s is up to date.\n", job->emit_h ? job->c_name : job->bin_name);
+		job->current = 1;
+	}
+
+	return 0;
+}
+
+/** Return the face for 'filename' at 'size' from 'faces', loading it the
+ * first time it is asked for. Returns NULL if it can't be loaded. */
+static FT_Face get_face(FT_Library library, struct loaded_face **faces,
+			const char *filename, int size)
+{
+	struct loaded_face *lf;
+
+	for (lf = *faces; lf; lf = lf->next)
+		if (lf->size == size && !strcmp(lf->filename, filename))
+			return lf->face;
+
+	FT_Face face;
+	if (FT_New_Face(library, filename, 0, &face)) {
+		fprintf(stderr, "ERROR: Can't load '%s'.\n", filename);
+		return NULL;
+	}
+	if (FT_Set_Char_Size(face, size * 64, 0, FONT_DPI, 0)) {
+		fprintf(stderr, "ERROR: Can't set the font size to %d", size);
+		return NULL;
+	}
+
+	lf = calloc(1, sizeof(*lf));
+	lf->filename = filename;
+	lf->size = size;
+	lf->face = face;
+	lf->next = *faces;
+	*faces = lf;
+	return face;
+}
+
+/** Check that the font of 'job' has every character of its strings.
+ * Returns non-zero if it doesn't. */
+static int check_strings(const struct job *job)
+{
+	char ch_mb[MB_BUFLEN];
+
+	for (size_t i = 0; i < job->string_count; i++) {
+		const struct text_string *ts = &job->strings[i];
+
+		for (size_t j = 0; j < ts->length; j++) {
+			if (!bsearch(&ts->chars[j], job->list, job->count, sizeof(wchar_t), cmp_char)) {
+				fprintf(stderr, "ERROR: %s:%d: U+%04X '%s' is not in the font.\n",
+					job->strings_file, ts->line, (unsigned int)ts->chars[j],
+					char_to_mb(ts->chars[j], ch_mb));
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/** Work out the characters 'job' generates from its fonts: what they have
+ * of any ranges, and what the text it draws uses. Returns non-zero if the
+ * text can't be read. */
+static int select_chars(struct job *job)
+{
+	const char *out_name = job->emit_h ? job->c_name : job->bin_name;
+	FT_Face face = job->fonts[0].face;
+	int found;
+
+	// Characters in ranges that the font doesn't have are left out
+	if (!job->literal) {
+		size_t n = drop_missing_chars(job->fonts, job->font_count, job->base_list,
+					      job->base_count);
+
+		printf("%s: %zu of %zu characters in the ranges are in the font.\n",
+		       out_name, n, job->base_count);
+		job->base_count = n;
+	}
+
+	job->list = job->base_list;
+	job->count = job->base_count;
+	if (job->chars_from_count == 0 && job->trace_count == 0)
+		return check_strings(job);
+
+	// Characters used by text are all the font needs; an explicit --chars
+	// limits them
+	struct char_set used = { 0 };
+
+	for (size_t i = 0; i < job->chars_from_count; i++) {
+		if (scan_chars(job->chars_from[i], &used)) {
+			fprintf(stderr, "ERROR: Can't read '%s': %s\n",
+				job->chars_from[i], strerror(errno));
+			return 1;
+		}
+	}
+	for (size_t i = 0; i < job->trace_count; i++) {
+		if (scan_trace(job->traces[i], face->family_name, face->style_name,
+			       job->font_size, &used)) {
+			fprintf(stderr, "ERROR: Can't read '%s': %s\n",
+				job->traces[i], strerror(errno));
+			return 1;
+		}
+	}
+	char_set_sort(&used);
+
+	struct char_set missing = { 0 };
+	size_t n = 0;
+	for (size_t i = 0; i < used.count; i++) {
+		wchar_t ch = used.chars[i];
+
+		if (job->chars_given &&
+		    !bsearch(&ch, job->base_list, job->base_count, sizeof(wchar_t), cmp_char))
+			continue;
+		char_source(job->fonts, job->font_count, ch, &found);
+		if (!found)
+			char_set_add(&missing, ch);
+		else
+			used.chars[n++] = ch;
+	}
+	used.chars[n] = 0;
+	if (missing.count) {
+		fprintf(stderr, "WARNING: %zu characters are used but not in the font: ",
+			missing.count);
+		print_ranges(stderr, missing.chars, missing.count);
+		fprintf(stderr, "\n");
+	}
+	free(missing.chars);
+
+	job->list = used.chars;
+	job->count = n;
+
+	struct render_options options = {
+		.codec	= job->codec,
+		.rotate = job->rotate,
+		.mono	= job->mono,
+		.sdf	= job->sdf ? SDF_SPREAD(job->font_size) : 0,
+		.outlines = job->outlines,
+		.lcd	= job->lcd,
+	};
+	long saved = subset_saving(job, job->base_list, job->base_count, job->list, job->count,
+				   &options);
+
+	printf("%s: %zu characters used: ", out_name, job->count);
+	print_ranges(stdout, job->list, job->count);
+	printf("\n%s: %ld bytes of glyphs %s against the %zu characters of --chars.\n",
+	       out_name, labs(saved), saved < 0 ? "added" : "saved", job->base_count);
+	return check_strings(job);
+}
+
+/** Return whether the fonts of 'job' are those 'r' is rendered from. */
+static int same_fonts(const struct rendering *r, const struct job *job)
+{
+	if (r->font_count != job->font_count)
+		return 0;
+	for (size_t i = 0; i < r->font_count; i++) {
+		const struct source *a = &r->fonts[i], *b = &job->fonts[i];
+
+		if (strcmp(a->filename, b->filename) || (a->chars == NULL) != (b->chars == NULL) ||
+		    (a->chars && strcmp(a->chars, b->chars)))
+			return 0;
+	}
+	return 1;
+}
+
+/** Return the rendering in 'renderings' that 'job' can be written from,
+ * adding one if there is none yet. */
+static struct rendering *find_rendering(struct rendering **renderings, const struct job *job)
+{
+	struct rendering *r;
+
+	for (r = *renderings; r; r = r->next)
+		if (r->font_size == job->font_size && r->rotate == job->rotate &&
+		    r->mono == job->mono && r->sdf == job->sdf &&
+		    r->outlines == job->outlines && r->subpixel == job->subpixel &&
+		    r->lcd == job->lcd && r->codec == render_codec(job->codec, job->rotate) &&
+		    r->count == job->count && same_fonts(r, job) &&
+		    !memcmp(r->list, job->list, job->count * sizeof(wchar_t)))
+			return r;
+
+	r = calloc(1, sizeof(*r));
+	r->fonts = job->fonts;
+	r->font_count = job->font_count;
+	r->font_size = job->font_size;
+	r->rotate = job->rotate;
+	r->mono = job->mono;
+	r->sdf = job->sdf;
+	r->outlines = job->outlines;
+	r->subpixel = job->subpixel;
+	r->lcd = job->lcd;
+	r->codec = render_codec(job->codec, job->rotate);
+	r->list = job->list;
+	r->count = job->count;
+	r->next = *renderings;
+	*renderings = r;
+	return r;
+}
+
+/** A generated file, written under a temporary name so that the output
+ * only ever appears complete. */
+struct output {
+	const char	*name;          /** Final name */
+	char		*tmp_name;      /** Name while it is being written */
+	FILE		*f;
+};
+
+/** Open 'out' to write 'name'. Returns non-zero on failure. */
+static int open_output(struct output *out, const char *name, const char *mode)
+{
+	out->name = name;
+	out->tmp_name = malloc(strlen(name) + 5);
+	sprintf(out->tmp_name, "%s.tmp", name);
+	out->f = fopen(out->tmp_name, mode);
+	if (out->f == NULL) {
 		fprintf(stderr, "ERROR: Can't open '%s' for writing: %s\n",
-			h_name, strerror(errno));
+			out->tmp_name, strerror(errno));
+		free(out->tmp_name);
+		out->tmp_name = NULL;
 		return 1;
 	}
-	char *h_basename = strrchr(h_name, '/');
+	return 0;
+}
+
+/** Close the 'count' files at 'outs' and, unless 'error' is set or any of
+ * them can't be written out, move them into place; otherwise remove them.
+ * Files that were never opened are skipped. Returns non-zero on failure. */
+static int close_outputs(struct output *outs, size_t count, int error)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (outs[i].f == NULL)
+			continue;
+		if ((ferror(outs[i].f) | fclose(outs[i].f)) && !error) {
+			fprintf(stderr, "ERROR: Can't write '%s': %s\n",
+				outs[i].tmp_name, strerror(errno));
+			error = 1;
+		}
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (outs[i].tmp_name == NULL)
+			continue;
+		if (!error && rename(outs[i].tmp_name, outs[i].name)) {
+			fprintf(stderr, "ERROR: Can't rename '%s' to '%s': %s\n",
+				outs[i].tmp_name, outs[i].name, strerror(errno));
+			error = 1;
+		}
+		if (error)
+			unlink(outs[i].tmp_name);
+		free(outs[i].tmp_name);
+	}
+	return error;
+}
+
+/** Write the output of 'job' from the glyphs of its rendering. Returns
+ * non-zero on failure. */
+static int write_job(const struct job *job)
+{
+	const char *out_name = job->emit_h ? job->c_name : job->bin_name;
+	struct build_settings settings = {
+		.codec		= job->codec,
+		.optimize	= job->optimize,
+		.budget		= job->budget,
+		.atlas		= job->atlas,
+		.lookup		= job->lookup,
+		.glyph32	= job->glyph32,
+	};
+	struct built_font bf;
+	struct font_data *fd = &bf.fd;
+	int error;
+
+	if (build_font_data(job->rendering, 0, &settings, &bf)) {
+		if (bf.lookup == -1)
+			fprintf(stderr, "ERROR: The %s lookup of '%s' needs offsets beyond glyph_t; " \
+				"try --glyph32.\n", job->lookup_mode, out_name);
+		free_built_font(&bf);
+		return 1;
+	}
+	fd->hash = job->hash;
+
+	if (job->codec == FONT_CODEC_MIXED) {
+		size_t used[FONT_CODEC_MIXED] = { 0 }, bytes = 0;
+
+		for (size_t i = 0; i < fd->count; i++) {
+			used[fd->glyphs[i].codec]++;
+			bytes += fd->glyphs[i].length;
+		}
+		printf("%s: %zu raw, %zu rle, %zu lz, %zu huffman glyphs, %zu bytes of bitmaps.\n",
+		       out_name, used[FONT_CODEC_RAW], used[FONT_CODEC_RLE],
+		       used[FONT_CODEC_LZ], used[FONT_CODEC_HUFFMAN], bytes);
+	}
+	if (bf.dups)
+		printf("%s: %zu duplicate bitmaps, %zu bytes saved.\n",
+		       out_name, bf.dups, bf.saved);
+
+	if (!job->emit_h) {
+		struct output bin = { 0 };
+
+		error = open_output(&bin, job->bin_name, "wb");
+		if (!error)
+			error = close_outputs(&bin, 1, write_pack(bin.f, fd));
+		free_built_font(&bf);
+		return error;
+	}
+
+	// The header, the source or object, and the data of assembler source
+	struct output out[3] = { { 0 } };
+	size_t out_count = job->emit_asm ? 3 : 2;
+	error = open_output(&out[0], job->c_name, job->emit_obj ? "wb" : "w") ||
+		open_output(&out[1], job->h_name, "w") ||
+		(job->emit_asm && open_output(&out[2], job->data_name, "wb"));
+	if (!error)
+		error = write_source(job, &bf, out[0].f, out[1].f, out[2].f);
+	error = close_outputs(out, out_count, error);
+	free_built_font(&bf);
+	return error;
+}
+
+/** Write the C or assembler source, or the object, of 'job' to 'c', its
+ * header to 'h', and the data of assembler source to 'data'. Returns
+ * non-zero on failure. */
+static int write_source(const struct job *job, const struct built_font *bf,
+			FILE *c, FILE *h, FILE *data)
+{
+	const struct font_data *fd = &bf->fd;
+	const char *section = job->section;
+	const char *output_name_c = job->output_name_c, *append_sane = job->append_sane;
+	const char *c_name = job->c_name, *h_name = job->h_name, *data_name = job->data_name;
+	const char *font_sym = job->font_sym;
+	int emit_c = job->emit_c, emit_asm = job->emit_asm;
+	int font_size = job->font_size;
+	size_t char_count = fd->count;
+	uint64_t hash = fd->hash;
+	int error;
+
+	struct options options = {
+		.name		= output_name_c,
+		.kerning	= fd->with_kerning ? &fd->kerning : NULL,
+	};
+
+	const char *h_basename = strrchr(h_name, '/');
 	if (h_basename == NULL) h_basename = h_name;
 	else h_basename++;
 
-	// Fix output name for the C identifier
-	char *output_name_c = validate_identifier(output_name);
-
-	// Initial output in the .c file
-	fprintf(c, "%s",
-		"/* AUTOMATICALLY GENERATED FILE! EDITING NOT RECOMMENDED!\n"
-		" *\n"
-		" * This file is distributed under the terms of the MIT License.\n"
-		" * See the LICENSE file at the top of this tree, or if it is missing a copy can\n"
-		" * be found at http://opensource.org/licenses/MIT\n"
-		" */\n\n");
-	fprintf(c, "#include <stdio.h>\n");
-	fprintf(c, "#include <stdlib.h>\n");
-	fprintf(c, "#include \"fontem.h\"\n");
-	fprintf(c, "#include \"%s\"\n\n", h_basename);
-	fprintf(c, "/* Character list: %s */\n\n", char_list);
+	if (emit_c) {
+		// Initial output in the .c file
+		fprintf(c, "%s",
+			"/* AUTOMATICALLY GENERATED FILE! EDITING NOT RECOMMENDED!\n"
+			" *\n"
+			" * This file is distributed under the terms of the MIT License.\n"
+			" * See the LICENSE file at the top of this tree, or if it is missing a copy can\n"
+			" * be found at http://opensource.org/licenses/MIT\n"
+			" */\n\n");
+		fprintf(c, "/* " HASH_MARKER "%016" PRIx64 " */\n\n", hash);
+		fprintf(c, "#include <stdio.h>\n");
+		fprintf(c, "#include <stdlib.h>\n");
+		fprintf(c, "#include \"fontem.h\"\n");
+		fprintf(c, "#include \"%s\"\n\n", h_basename);
+		if (job->list != job->base_list) {
+			fprintf(c, "/* Character list: ");
+			print_ranges(c, job->list, char_count);
+			fprintf(c, " */\n\n");
+		} else {
+			fprintf(c, "/* Character list: %s */\n\n", job->char_list);
+		}
+	}
 
 	// Initial output in the .h file
 	fprintf(h, "%s",
@@ -214,285 +1102,947 @@ int main(int argc, const char *argv[])
 		" * See the LICENSE file at the top of this tree, or if it is missing a copy can\n"
 		" * be found at http://opensource.org/licenses/MIT\n"
 		" */\n\n");
+	fprintf(h, "/* " HASH_MARKER "%016" PRIx64 " */\n\n", hash);
 	fprintf(h, "#ifndef _FONTEM_%s_%d%s_H\n#define _FONTEM_%s_%d%s_H\n\n",
 		output_name_c, font_size, append_sane,
 		output_name_c, font_size, append_sane);
 	fprintf(h, "#include \"fontem.h\"\n\n");
 
-
-	// Postamble for the c file
-	char *post = malloc(512);
-	snprintf(post, 512, "/** Glyphs table for font \"%s\". */\n" \
-		 "static const struct glyph *glyphs_%s_%d%s[] %s= {\n",
-		 font_name, output_name_c, font_size, append_sane,
-		 get_section(output_name_c));
-	int post_len = strlen(post);
-	post = realloc(post, post_len + 1);
-	int post_count = 0;
-	wchar_t post_max = 0;
-
-	// Are we kerning?
-	int with_kerning = FT_HAS_KERNING(face);
-
-	// Iterate the character list and generate the bitmap for each
-	for (size_t i = 0; i < char_count; i++) {
-		wchar_t ch = wide_char_list[i];
-		if (ch > post_max)
-			post_max = ch;
-
-		// Load the glyph
-		if (mono)
-			error = FT_Load_Char(face, ch, FT_LOAD_RENDER | FT_LOAD_TARGET_MONO);
+	// The font is laid out for one width of glyph_t; C source only
+	// cares if the characters don't fit in 16 bits
+	if (fd->glyph32)
+		fprintf(h, "#ifndef FONTEM_GLYPH32\n" \
+			"#error \"font_%s_%d%s needs FONTEM_GLYPH32\"\n" \
+			"#endif\n\n",
+			output_name_c, font_size, append_sane);
+	else if (!emit_c)
+		fprintf(h, "#ifdef FONTEM_GLYPH32\n" \
+			"#error \"font_%s_%d%s was generated for 16-bit glyph_t\"\n" \
+			"#endif\n\n",
+			output_name_c, font_size, append_sane);
+
+	// The atlas holding all the bitmaps
+	const struct atlas *packed = &bf->atlas;
+	char section_str[SECTION_BUFLEN];
+	char *atlas_sym = malloc(strlen(output_name_c) + strlen(append_sane) + 32);
+	sprintf(atlas_sym, "atlas_%s_%d%s", output_name_c, font_size, append_sane);
+	options.atlas = packed;
+
+	// The index used to find a character
+	int lookup = bf->lookup;
+	const uint32_t *table = bf->table;
+	size_t table_len = bf->table_len;
+
+	if (!emit_c) {
+		// Without a section of its own, the font goes where a compiler
+		// would put it, allowing for the relocation of its pointers
+		char *section_name = malloc(strlen(section ? section : ".rodata") + strlen(font_sym) + 2);
+		sprintf(section_name, "%s.%s", section ? section : ".rodata", font_sym);
+		char *font_section = malloc(strlen(section ? section : ".data.rel.ro") + strlen(font_sym) + 2);
+		sprintf(font_section, "%s.%s", section ? section : ".data.rel.ro", font_sym);
+
+		struct font_layout layout = {
+			.fd		= fd,
+			.atlas		= packed,
+			.lookup		= lookup,
+			.lookup_table	= table,
+			.lookup_length	= table_len,
+			.symbol		= font_sym,
+			.section	= section_name,
+			.font_section	= font_section,
+			.font_writable	= section == NULL,
+		};
+
+		if (emit_asm)
+			error = write_asm(c, data, data_name, &layout);
 		else
-			error = FT_Load_Char(face, ch, FT_LOAD_RENDER);
-
+			error = write_obj(c, &layout, job->machine);
 		if (error) {
-			fprintf(stderr, "ERROR : Can't load glyph for %s.\n", mb(ch));
+			fprintf(stderr, "ERROR: Can't write '%s': %s\n", c_name, strerror(errno));
 			return 1;
 		}
+		finish_header(h, output_name_c, font_size, append_sane);
+		return 0;
+	}
+
+	store_atlas(c, fd, packed, atlas_sym, section);
+
+	// The codec table
+	char *codec_sym = malloc(strlen(output_name_c) + strlen(append_sane) + 32);
+	sprintf(codec_sym, "codec_%s_%d%s", output_name_c, font_size, append_sane);
+	store_codec_data(c, fd, codec_sym, section);
+
+	// The character codes, which are all a lookup has to search
+	char *codepoints_sym = malloc(strlen(output_name_c) + strlen(append_sane) + 32);
+	sprintf(codepoints_sym, "codepoints_%s_%d%s", output_name_c, font_size, append_sane);
+	fprintf(c, "/** Characters of font \"%s\", in order. */\n" \
+		"static const glyph_t %s[] %s= {\n",
+		fd->name, codepoints_sym, get_section(section_str, section, codepoints_sym));
+	for (size_t i = 0; i < char_count; i++)
+		fprintf(c, "%s0x%04x,%s", i % 8 ? "" : "\t", fd->glyphs[i].ch,
+			i % 8 == 7 || i == char_count - 1 ? "\n" : " ");
+	fprintf(c, "};\n\n");
 
-		store_glyph(&face, face->glyph, ch, font_size, output_name_c, c, &post,
-			    &post_len, &post_count, with_kerning, wide_char_list, rle, rotate, mono);
+	char *lookup_sym = malloc(strlen(output_name_c) + strlen(append_sane) + 32);
+	sprintf(lookup_sym, "lookup_%s_%d%s", output_name_c, font_size, append_sane);
+	if (table_len) {
+		fprintf(c, "/** Index of font \"%s\"; FONT_LOOKUP_%s. */\n" \
+			"static const glyph_t %s[] %s= {\n",
+			fd->name, lookup_macro(lookup), lookup_sym,
+			get_section(section_str, section, lookup_sym));
+		for (size_t i = 0; i < table_len; i++)
+			fprintf(c, "%s0x%04x,%s", i % 8 ? "" : "\t", table[i],
+				i % 8 == 7 || i == table_len - 1 ? "\n" : " ");
+		fprintf(c, "};\n\n");
 	}
 
-	// Finish the post
-	fprintf(c, "%s" \
-		"};\n\n", post);
-	free(post);
+	// The glyph metrics, in the same order, and the codec of each glyph
+	// of a mixed font
+	char *glyphs_sym = malloc(strlen(output_name_c) + strlen(append_sane) + 32);
+	sprintf(glyphs_sym, "glyphs_%s_%d%s", output_name_c, font_size, append_sane);
+	char *glyph_codecs_sym = malloc(strlen(output_name_c) + strlen(append_sane) + 32);
+	sprintf(glyph_codecs_sym, "glyph_codecs_%s_%d%s", output_name_c, font_size, append_sane);
+	char *kerning_sym = malloc(strlen(output_name_c) + strlen(append_sane) + 32);
+	sprintf(kerning_sym, "kerning_%s_%d%s", output_name_c, font_size, append_sane);
+	struct font_syms syms = {
+		.codepoints	= codepoints_sym,
+		.lookup		= lookup_sym,
+		.kerning	= kerning_sym,
+		.atlas		= atlas_sym,
+		.codec		= codec_sym,
+		.glyphs		= glyphs_sym,
+		.glyph_codecs	= glyph_codecs_sym,
+	};
+	if (store_glyphs(c, fd, &options, &syms, section)) {
+		fprintf(stderr, "ERROR: Can't write '%s': %s\n", c_name, strerror(errno));
+		return 1;
+	}
 
-	fprintf(c, "/** Definition for font \"%s\". */\n", font_name);
-	fprintf(c, "const struct font font_%s_%d%s %s= {\n"     \
-		"\t.name = \"%s\",\n" \
-		"\t.style = \"%s\",\n" \
-		"\t.size = %d,\n" \
-		"\t.dpi = %d,\n" \
-		"\t.count = %d,\n" \
-		"\t.max = %d,\n" \
-		"\t.ascender = %d,\n" \
-		"\t.descender = %d,\n" \
-		"\t.height = %d,\n" \
-		"\t.glyphs = glyphs_%s_%d%s,\n" \
-		"\t.compressed = %u,\n" \
-		"};\n\n",
-		output_name_c, font_size, append_sane,
-		get_section(output_name_c),
-		font_name, face->style_name, font_size, FONT_DPI,
-		post_count, post_max,
-		(int)face->size->metrics.ascender / 64,
-		(int)face->size->metrics.descender / 64,
-		(int)face->size->metrics.height / 64,
-		output_name_c, font_size, append_sane,
-		rle);
+	// The kerning class matrix
+	const struct kern_classes *kc = &fd->kerning;
+	if (fd->with_kerning) {
+		fprintf(c, "/** Kerning class matrix for font \"%s\"; indexed by\n" \
+			" * [left class * %d + right class]. */\n",
+			fd->name, kc->right_count);
+		fprintf(c, "static const int8_t %s[] %s= {\n",
+			kerning_sym, get_section(section_str, section, kerning_sym));
+		for (int l = 0; l < kc->left_count; l++) {
+			fprintf(c, "\t");
+			for (int r = 0; r < kc->right_count; r++)
+				fprintf(c, "%d,%s", kc->matrix[l * kc->right_count + r],
+					r == kc->right_count - 1 ? "" : " ");
+			fprintf(c, "  /* %d */\n", l);
+		}
+		fprintf(c, "};\n\n");
+	}
 
-	// Add the reference to the .h
-	fprintf(h, "extern const struct font font_%s_%d%s;\n\n",
-		output_name_c, font_size, append_sane);
+	fprintf(c, "/** Definition for font \"%s\". */\n", fd->name);
+	store_font(c, fd, "", font_sym, section, lookup, table_len, packed, &syms);
 
-	// All done!
-	fprintf(h, "#endif /* _FONTEM_%s_%d%s_H */\n",
-		output_name_c, font_size, append_sane);
-	free(output_name_c);
-	fclose(h);
-	fclose(c);
+	for (size_t i = 0; i < job->string_count; i++) {
+		store_run(c, job, fd, i, glyphs_sym);
+		fprintf(h, "extern const struct font_run %s;\n", job->run_syms[i]);
+	}
+	if (job->string_count)
+		fprintf(h, "\n");
+	if (job->tint_count) {
+		store_tint(c, job, fd);
+		fprintf(h, "extern const struct font_tint %s;\n\n", job->tint_sym);
+	}
+	if (job->sdf) {
+		fprintf(c, "/** Font \"%s\" as distance fields, to draw at any size. */\n" \
+			"const struct font_sdf %s %s= {\n" \
+			"\t.font = &%s,\n" \
+			"\t.spread = %d,\n" \
+			"};\n\n",
+			fd->name, job->sdf_sym, get_section(section_str, section, job->sdf_sym),
+			font_sym, SDF_SPREAD(font_size));
+		fprintf(h, "extern const struct font_sdf %s;\n\n", job->sdf_sym);
+	}
+	if (job->outlines) {
+		store_outlines(c, job, fd);
+		fprintf(h, "extern const struct font_outlines %s;\n\n", job->outlines_sym);
+	}
+	if (job->subpixel) {
+		if (store_subpixel(c, job, fd, &syms, lookup, table_len)) {
+			fprintf(stderr, "ERROR: Can't write '%s': %s\n", c_name, strerror(errno));
+			return 1;
+		}
+		fprintf(h, "extern const struct font_subpixel %s;\n\n", job->subpixel_sym);
+	}
+	free(kerning_sym);
+	free(atlas_sym);
+	free(codepoints_sym);
+	free(glyphs_sym);
+	free(lookup_sym);
+	free(codec_sym);
+	free(glyph_codecs_sym);
+
+	finish_header(h, output_name_c, font_size, append_sane);
 
 	return 0;
 }
 
-static inline char get_class(unsigned char c)
+/** The output jobs, shared by the threads writing them. */
+struct writers {
+	struct job	**jobs;
+	size_t		count;
+	size_t		next;           /** Index of the next job to write */
+	pthread_mutex_t lock;
+	int		error;          /** Non-zero if a job failed */
+};
+
+/** Thread entry point; each writer takes the next job until none are left. */
+static void *writer_thread(void *arg)
 {
-	if (c == 0)
+	struct writers *w = (struct writers *)arg;
+
+	for (;;) {
+		pthread_mutex_lock(&w->lock);
+		size_t i = w->next++;
+		pthread_mutex_unlock(&w->lock);
+		if (i >= w->count)
+			break;
+
+		if (write_job(w->jobs[i])) {
+			pthread_mutex_lock(&w->lock);
+			w->error = 1;
+			pthread_mutex_unlock(&w->lock);
+		}
+	}
+	return NULL;
+}
+
+/** Read the jobs of 'manifest', each starting from the options in 'base'. */
+static int manifest_jobs(const char *manifest, const struct job *base, struct job **list,
+			 size_t *count)
+{
+	struct manifest_line *lines;
+
+	if (read_manifest(manifest, &lines, count))
 		return 1;
-	else if (c == 0xff)
-		return 2;
-	else
-		return 3;
+
+	*list = calloc(*count ? *count : 1, sizeof(struct job));
+	for (size_t i = 0; i < *count; i++) {
+		struct job *job = &(*list)[i];
+		const char *nested = NULL;
+		int jobs = 0;
+
+		*job = *base;
+		if (parse_options(lines[i].argc, lines[i].argv, job, &jobs, &nested)) {
+			fprintf(stderr, "ERROR: %s:%d: Invalid options.\n", manifest, lines[i].line);
+			return 1;
+		}
+		if (nested) {
+			fprintf(stderr, "ERROR: %s:%d: A manifest can't include another.\n",
+				manifest, lines[i].line);
+			return 1;
+		}
+
+		// Files named in the manifest are relative to it
+		for (size_t j = 0; j < job->font_count; j++)
+			if (j >= base->font_count || job->fonts[j].filename != base->fonts[j].filename)
+				job->fonts[j].filename = manifest_path(manifest, job->fonts[j].filename);
+		for (size_t j = base->chars_from_count; j < job->chars_from_count; j++)
+			job->chars_from[j] = manifest_path(manifest, job->chars_from[j]);
+		for (size_t j = base->trace_count; j < job->trace_count; j++)
+			job->traces[j] = manifest_path(manifest, job->traces[j]);
+		if (job->strings_file && job->strings_file != base->strings_file)
+			job->strings_file = manifest_path(manifest, job->strings_file);
+	}
+	return 0;
+}
+
+/** Write the registry of every font in 'list' that has a header, and of
+ * the strings laid out, the tints, and the distance field, outline and subpixel
+ * fonts made for them. */
+static int write_fonts_registry(const char *dir, const struct job *list, size_t count)
+{
+	struct registry reg = {
+		.headers	= calloc(count + 1, sizeof(char *)),
+		.fonts		= calloc(count + 1, sizeof(char *)),
+	};
+
+	for (size_t i = 0; i < count; i++) {
+		if (!list[i].emit_h)
+			continue;
+		const char *h_basename = strrchr(list[i].h_name, '/');
+		reg.headers[reg.font_count] = h_basename ? h_basename + 1 : list[i].h_name;
+		reg.fonts[reg.font_count++] = list[i].font_sym;
+		for (size_t j = 0; j < list[i].string_count; j++)
+			add_file(&reg.runs, &reg.run_count, list[i].run_syms[j]);
+		if (list[i].tint_count)
+			add_file(&reg.tints, &reg.tint_count, list[i].tint_sym);
+		if (list[i].sdf)
+			add_file(&reg.sdfs, &reg.sdf_count, list[i].sdf_sym);
+		if (list[i].outlines)
+			add_file(&reg.outlines, &reg.outline_count, list[i].outlines_sym);
+		if (list[i].subpixel)
+			add_file(&reg.subpixels, &reg.subpixel_count, list[i].subpixel_sym);
+	}
+
+	int error = write_registry(dir, &reg);
+	free(reg.headers);
+	free(reg.fonts);
+	free(reg.runs);
+	free(reg.tints);
+	free(reg.sdfs);
+	free(reg.outlines);
+	free(reg.subpixels);
+	return error;
 }
 
-static unsigned char *rle_compress(const unsigned char *data, size_t *length)
+int main(int argc, const char *argv[])
 {
-	size_t in_length = *length, out_length = 0;
-	unsigned char *result = (unsigned char *)malloc(2 * in_length);
-	unsigned char class = 0, count = 0;
+	setlocale(LC_ALL, "");
 
-	for (size_t i = 0; i <= in_length; i++) {
-		unsigned char c = data[i];
-		unsigned char c_class = (i == in_length ? 0 : get_class(c));
+	int error;
+	int jobs = 1;
+	const char *manifest = NULL;
+	struct job base;
 
-		if (((count > 0) && (class != c_class)) || (count >= 0x40)) {
-			if (class == 3) {
-				result[out_length] = count - 1;
-				out_length++;
+	job_defaults(&base);
+	if (parse_options(argc, argv, &base, &jobs, &manifest))
+		return 1;
+	if (jobs <= 0)
+		jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs <= 0)
+		jobs = 1;
+
+	// The fonts to generate: the one given by the options, or one for each
+	// line of the manifest
+	struct job *list = &base;
+	size_t count = 1;
+	if (manifest && manifest_jobs(manifest, &base, &list, &count))
+		return 1;
 
-				memcpy(result + out_length, data + i - count, count);
-				out_length += count;
-			} else {
-				result[out_length] = (class == 1 ? 0x80 : 0xc0) + count - 1;
-				out_length++;
+	// Init the font library
+	FT_Library library;
+	error = FT_Init_FreeType(&library);
+	if (error) {
+		fprintf(stderr, "ERROR: Can't initialize FreeType.\n");
+		return 1;
+	}
+
+	for (size_t i = 0; i < count; i++)
+		if (prepare_job(&list[i], library))
+			return 1;
+
+	// Each face is loaded once, and each set of bitmaps rendered once
+	// for all the jobs that are made from it
+	struct loaded_face *faces = NULL;
+	struct rendering *renderings = NULL;
+	struct writers writers = { .jobs = calloc(count, sizeof(struct job *)) };
+	for (size_t i = 0; i < count; i++) {
+		struct job *job = &list[i];
+
+		if (job->current)
+			continue;
+		for (size_t j = 0; j < job->font_count; j++) {
+			struct source *src = &job->fonts[j];
+
+			src->face = get_face(library, &faces, src->filename, job->font_size);
+			if (src->face == NULL)
+				return 1;
+		}
+		if (select_chars(job))
+			return 1;
+		job->rendering = find_rendering(&renderings, job);
+		writers.jobs[writers.count++] = job;
+	}
+	for (struct rendering *r = renderings; r; r = r->next)
+		if (render_font(r, jobs))
+			return 1;
+
+	// Write out the jobs
+	if (jobs == 1 || writers.count <= 1) {
+		for (size_t i = 0; i < writers.count; i++)
+			if (write_job(writers.jobs[i]))
+				return 1;
+	} else {
+		if ((size_t)jobs > writers.count)
+			jobs = (int)writers.count;
+
+		pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+		pthread_mutex_init(&writers.lock, NULL);
+		for (int i = 0; i < jobs; i++) {
+			int rc = pthread_create(&threads[i], NULL, writer_thread, &writers);
+			if (rc) {
+				fprintf(stderr, "ERROR: Can't start writer thread: %s\n",
+					strerror(rc));
+				return 1;
 			}
-			count = 0;
 		}
-		class = c_class;
-		count++;
+		for (int i = 0; i < jobs; i++)
+			pthread_join(threads[i], NULL);
+		pthread_mutex_destroy(&writers.lock);
+		free(threads);
+		if (writers.error)
+			return 1;
 	}
 
-	*length = out_length;
-	return result;
+	// A manifest describes all the fonts, so it comes with a list of them
+	if (manifest && write_fonts_registry(base.output_dir, list, count))
+		return 1;
+
+	return 0;
 }
 
-static void store_bitmap(FILE *c, FT_Bitmap *bitmap, char *bname, wchar_t ch, int compress, int rotate, int mono)
+/** Write out the atlas 'atlas' of the font 'fd' as the array 'aname'. */
+static void store_atlas(FILE *c, const struct font_data *fd,
+			const struct atlas *atlas, const char *aname, const char *section)
 {
-	if (bitmap->rows && bitmap->width) {
-		fprintf(c, "/** Bitmap definition for character '%s'. */\n", mb(ch));
-		fprintf(c, "static const uint8_t %s[] %s= {\n", bname, get_section(bname));
-		if (compress) {
-			size_t length = (size_t)bitmap->rows * (size_t)bitmap->width;
-			unsigned char *compressed_data = rle_compress(bitmap->buffer, &length);
+	char ch_mb[MB_BUFLEN];
+	char section_str[SECTION_BUFLEN];
+
+	if (atlas->width)
+		fprintf(c, "/** Atlas of %ux%u bitmaps for font \"%s\". */\n",
+			atlas->width, atlas->height, fd->name);
+	else
+		fprintf(c, "/** Bitmaps for font \"%s\". */\n", fd->name);
+	fprintf(c, "static const uint8_t %s[] %s= {\n", aname, get_section(section_str, section, aname));
+
+	if (atlas->length == 0) {
+		// C has no empty arrays
+		fprintf(c, "\t0x00,  /* No bitmaps */\n");
+	} else if (atlas->width) {
+		// One line per row of the image
+		for (unsigned int y = 0; y < atlas->height; y++) {
 			fprintf(c, "\t");
-			for (size_t i = 0; i < length; i++) {
-				fprintf(c, "0x%02x, ", compressed_data[i]);
-				if (i == length - 1)
-					fprintf(c, "\n");
-				else if ((i % 16) == 15)
-					fprintf(c, "\n\t");
-			}
-			free(compressed_data);
-		} else {
-			if (rotate) {
-				if (mono) {
-					unsigned int byte_rows = bitmap->rows / 8;
-					if (bitmap->rows & 7) byte_rows++;
-
-					unsigned char *out = malloc((size_t)byte_rows * bitmap->width);
-					memset(out, 0, (size_t)byte_rows * bitmap->width);
-
-					unsigned int x, y;
-
-					printf("\n");
-					for (y = 0; y < bitmap->rows; y++) {
-						for (x = 0; x < bitmap->width; x++) {
-							unsigned int s_byte = (x / 8) + (y * bitmap->pitch);
-							unsigned int s_bit = x % 8;
-							unsigned char s_mask = 128 >> s_bit;
-
-							unsigned int d_byte = (y / 8) + (x * byte_rows);
-							unsigned int d_bit = y % 8;
-
-							if (bitmap->buffer[s_byte] & s_mask)
-								out[d_byte] |= 128 >> d_bit;
-						}
-						printf("\n");
-					}
-
-					for (x = 0; x < bitmap->width; x++) {
-						fprintf(c, "\t");
-						for (y = 0; y < byte_rows; y++)
-							fprintf(c, "0x%02x, ", out[x * byte_rows + y]);
-						fprintf(c, "\n");
-					}
-
-					free(out);
-				} else {
-					for (unsigned int x = 0; x < (unsigned int)bitmap->pitch; x++) {
-						fprintf(c, "\t");
-						for (unsigned int y = 0; y < (unsigned int)bitmap->rows; y++)
-							fprintf(c, "0x%02x, ", (unsigned char)bitmap->buffer[y * bitmap->pitch + x]);
-						fprintf(c, "\n");
-					}
-				}
-			} else {
-				for (unsigned int y = 0; y < (unsigned int)bitmap->rows; y++) {
+			for (unsigned int x = 0; x < atlas->width; x++)
+				fprintf(c, "0x%02x,%s", atlas->data[(size_t)y * atlas->width + x],
+					x == atlas->width - 1 ? "" : " ");
+			fprintf(c, "  /* %u */\n", y);
+		}
+	} else {
+		// Each bitmap as it would be printed on its own
+		for (size_t i = 0; i < fd->count; i++) {
+			const struct glyph_data *gd = &fd->glyphs[i];
+
+			if (gd->bitmap == NULL || gd->same)
+				continue;
+			fprintf(c, "\t/* U+%04X '%s' */\n", gd->ch, char_to_mb(gd->ch, ch_mb));
+			for (size_t j = 0; j < gd->length; j++) {
+				if ((j % gd->line) == 0)
 					fprintf(c, "\t");
-					for (unsigned int x = 0; x < (unsigned int)bitmap->pitch; x++)
-						fprintf(c, "0x%02x, ", (unsigned char)bitmap->buffer[y * bitmap->pitch + x]);
+				fprintf(c, "0x%02x, ", atlas->data[atlas->offsets[i] + j]);
+				if ((j % gd->line) == gd->line - 1 || j == gd->length - 1)
 					fprintf(c, "\n");
-				}
 			}
 		}
+	}
+	fprintf(c, "};\n\n");
+}
+
+/** Write the codec table of 'fd', named 'sym', if it has one. */
+static void store_codec_data(FILE *c, const struct font_data *fd, const char *sym, const char *section)
+{
+	char section_str[SECTION_BUFLEN];
+
+	if (fd->codec_data_length == 0)
+		return;
+	fprintf(c, "/** FONT_CODEC_%s table for font \"%s\". */\n" \
+		"static const uint8_t %s[] %s= {\n",
+		codec_macro(fd->codec), fd->name, sym, get_section(section_str, section, sym));
+	for (size_t i = 0; i < fd->codec_data_length; i++)
+		fprintf(c, "%s0x%02x,%s", i % 16 ? "" : "\t", fd->codec_data[i],
+			i % 16 == 15 || i == fd->codec_data_length - 1 ? "\n" : " ");
+	fprintf(c, "};\n\n");
+}
+
+/** Write the table of glyphs of 'fd', in the order of its characters, and
+ * the codec of each glyph if the font is mixed. Returns non-zero on failure. */
+static int store_glyphs(FILE *c, const struct font_data *fd, const struct options *opts,
+			const struct font_syms *syms, const char *section)
+{
+	char section_str[SECTION_BUFLEN];
+
+	fprintf(c, "/** Glyphs of font \"%s\", in the order of %s. */\n" \
+		"static const struct glyph %s[] %s= {\n",
+		fd->name, syms->codepoints, syms->glyphs,
+		get_section(section_str, section, syms->glyphs));
+	for (size_t i = 0; i < fd->count; i++)
+		if (store_glyph(&fd->glyphs[i], i, opts, c))
+			return 1;
+	fprintf(c, "};\n\n");
+
+	if (fd->codec == FONT_CODEC_MIXED) {
+		fprintf(c, "/** FONT_CODEC_ of each glyph of font \"%s\", in the order of %s. */\n" \
+			"static const uint8_t %s[] %s= {\n",
+			fd->name, syms->codepoints, syms->glyph_codecs,
+			get_section(section_str, section, syms->glyph_codecs));
+		for (size_t i = 0; i < fd->count; i++)
+			fprintf(c, "%s%d,%s", i % 16 ? "" : "\t", fd->glyphs[i].codec,
+				i % 16 == 15 || i == fd->count - 1 ? "\n" : " ");
 		fprintf(c, "};\n\n");
-	} else {
-		strcpy(bname, "NULL");
 	}
+	return ferror(c);
 }
 
-void store_glyph(FT_Face *face, FT_GlyphSlotRec *glyph,
-		 wchar_t ch, int size, char *name,
-		 FILE *c, char **post, int *post_len, int *post_count,
-		 int with_kerning, wchar_t *char_list, int compress, int rotate, int mono)
+/** Write the struct font 'sym' for 'fd', whose arrays are named in 'syms',
+ * with 'qualifier' before its type. */
+static void store_font(FILE *c, const struct font_data *fd, const char *qualifier, const char *sym,
+		       const char *section, int lookup, size_t table_len, const struct atlas *atlas,
+		       const struct font_syms *syms)
 {
-	FT_Bitmap *bitmap = &glyph->bitmap;
+	char section_str[SECTION_BUFLEN];
+
+	fprintf(c, "%sconst struct font %s %s= {\n"     \
+		"\t.name = \"%s\",\n" \
+		"\t.style = \"%s\",\n" \
+		"\t.size = %d,\n" \
+		"\t.dpi = %d,\n" \
+		"\t.count = %d,\n" \
+		"\t.max = %d,\n" \
+		"\t.ascender = %d,\n" \
+		"\t.descender = %d,\n" \
+		"\t.height = %d,\n" \
+		"\t.codepoints = %s,\n" \
+		"\t.glyphs = %s,\n" \
+		"\t.lookup_type = FONT_LOOKUP_%s,\n" \
+		"\t.codec = FONT_CODEC_%s,\n",
+		qualifier, sym, get_section(section_str, section, sym),
+		fd->name, fd->style, fd->size, fd->dpi,
+		(int)fd->count, fd->max,
+		fd->ascender, fd->descender, fd->height,
+		syms->codepoints, syms->glyphs, lookup_macro(lookup),
+		codec_macro(fd->codec));
+	if (fd->codec_data_length)
+		fprintf(c, "\t.codec_data = %s,\n", syms->codec);
+	if (fd->codec == FONT_CODEC_MIXED)
+		fprintf(c, "\t.glyph_codecs = %s,\n", syms->glyph_codecs);
+	if (table_len)
+		fprintf(c, "\t.lookup = %s,\n", syms->lookup);
+	if (fd->with_kerning)
+		fprintf(c, "\t.kerning = %s,\n" \
+			"\t.kerning_cols = %d,\n",
+			syms->kerning, fd->kerning.right_count);
+	fprintf(c, "\t.atlas = %s,\n", syms->atlas);
+	if (atlas->width)
+		fprintf(c, "\t.atlas_stride = %u,\n", atlas->width);
+	fprintf(c, "};\n\n");
+}
 
-	// Work out a name for this glyph
-	int len = strlen(name) + 24;
-	char *bname = malloc(len);
-	char *gname = malloc(len);
-	char *kname = malloc(len);
+/** Add the reference to the font to the .h, and close its include guard. */
+static void finish_header(FILE *h, const char *name_c, int size, const char *append_sane)
+{
+	fprintf(h, "extern const struct font font_%s_%d%s;\n\n",
+		name_c, size, append_sane);
 
-	snprintf(bname, len, "bitmap_%s_%d_%04x", name, size, ch);
-	snprintf(gname, len, "glyph_%s_%d_%04x", name, size, ch);
-	snprintf(kname, len, "kerning_%s_%d_%04x", name, size, ch);
+	// All done!
+	fprintf(h, "#endif /* _FONTEM_%s_%d%s_H */\n",
+		name_c, size, append_sane);
+}
 
-	// Generate the bitmap
-	store_bitmap(c, bitmap, bname, ch, compress, rotate, mono);
+/** Write 'str' as a C string literal. */
+static void print_c_string(FILE *c, const char *str)
+{
+	fprintf(c, "\"");
+	for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+		if (*p == '"' || *p == '\\' || *p == '?')
+			fprintf(c, "\\%c", *p);
+		else if (*p < 0x20 || *p >= 0x7f)
+			fprintf(c, "\\%03o", *p);
+		else
+			fputc(*p, c);
+	}
+	fprintf(c, "\"");
+}
 
-	// Generate the kerning table
-	if (with_kerning) {
-		fprintf(c, "/** Kerning table for character '%s'. */\n", mb(ch));
-		fprintf(c, "static const struct kerning %s[] %s= {\n", kname, get_section(kname));
-		wchar_t *a = char_list;
-		while (*a) {
-			FT_Vector kern;
-			FT_Get_Kerning(*face, *a, ch, FT_KERNING_DEFAULT, &kern);
-			if (kern.x)
-				fprintf(c, "\t{ /* .left = '%s' */ %u, /* .offset = */ %d },\n",
-					mb(*a), *a, (int)kern.x / 64);
-			a++;
+/** Write string number 'idx' of 'job' laid out in the font 'fd', whose
+ * glyphs are in the array 'glyphs_sym': the glyph and position of each
+ * character, with kerning applied, and the extent of the whole run. */
+static void store_run(FILE *c, const struct job *job, const struct font_data *fd, size_t idx,
+		      const char *glyphs_sym)
+{
+	const struct text_string *ts = &job->strings[idx];
+	const struct kern_classes *kc = &fd->kerning;
+	const char *run_sym = job->run_syms[idx];
+	char section_str[SECTION_BUFLEN], ch_mb[MB_BUFLEN];
+	int x = 0, left = INT16_MAX, top = INT16_MAX, right = INT16_MIN, bottom = INT16_MIN;
+	size_t prev = 0;
+
+	char *run_glyphs_sym = malloc(strlen(run_sym) + 8);
+	sprintf(run_glyphs_sym, "%s_glyphs", run_sym);
+	if (ts->length) {
+		fprintf(c, "/** Glyphs of the string \"%s\" in font \"%s\". */\n" \
+			"static const struct font_run_glyph %s[] %s= {\n",
+			ts->name, fd->name, run_glyphs_sym,
+			get_section(section_str, job->section, run_glyphs_sym));
+	}
+	for (size_t i = 0; i < ts->length; i++) {
+		const wchar_t *ch = bsearch(&ts->chars[i], job->list, job->count,
+					    sizeof(wchar_t), cmp_char);
+		size_t g = ch - job->list;
+		const struct glyph_data *gd = &fd->glyphs[g];
+
+		// As font_draw_char_*() would place it after the previous glyph
+		if (i && fd->with_kerning)
+			x += kc->matrix[kc->left[prev] * kc->right_count + kc->right[g]];
+		fprintf(c, "\t{ &%s[%zu], %d },  /* U+%04X '%s' */\n",
+			glyphs_sym, g, x, (unsigned int)gd->ch, char_to_mb(gd->ch, ch_mb));
+
+		if (gd->cols && gd->rows) {
+			int gl = x + gd->left, gt = fd->ascender - gd->top;
+
+			if (gl < left) left = gl;
+			if (gt < top) top = gt;
+			if (gl + (int)gd->cols > right) right = gl + (int)gd->cols;
+			if (gt + (int)gd->rows > bottom) bottom = gt + (int)gd->rows;
 		}
-		fprintf(c, "\t{ /* .left = */ 0, /* .offset = */ 0 },\n");
+		x += gd->advance;
+		prev = g;
+	}
+	if (ts->length)
 		fprintf(c, "};\n\n");
-	} else {
-		free(kname);
-		kname = strdup("NULL");
-	}
-
-	fprintf(c, "/** Glyph definition for character '%s'. */\n", mb(ch));
-	fprintf(c, "static const struct glyph %s %s= {\n", gname, get_section(gname));
-	fprintf(c, "\t.glyph = %u,\n", ch);
-	fprintf(c, "\t.left = %d,\n", glyph->bitmap_left);
-	fprintf(c, "\t.top = %d,\n", glyph->bitmap_top);
-	fprintf(c, "\t.advance = %d,\n", (int)glyph->advance.x / 64);
-	fprintf(c, "\t.cols = %d,\n", bitmap->width);
-	fprintf(c, "\t.rows = %d,\n", bitmap->rows);
-	fprintf(c, "\t.bitmap = %s,\n", bname);
-	fprintf(c, "\t.kerning = %s,\n", kname);
+	if (right == INT16_MIN)
+		left = top = right = bottom = 0;
+
+	fprintf(c, "/** The string \"%s\" laid out in font \"%s\". */\n", ts->name, fd->name);
+	fprintf(c, "const struct font_run %s %s= {\n" \
+		"\t.name = \"%s\",\n" \
+		"\t.text = ",
+		run_sym, get_section(section_str, job->section, run_sym), ts->name);
+	print_c_string(c, ts->text);
+	fprintf(c, ",\n" \
+		"\t.font = &%s,\n" \
+		"\t.glyphs = %s,\n" \
+		"\t.count = %zu,\n" \
+		"\t.advance = %d,\n" \
+		"\t.ink_left = %d,\n" \
+		"\t.ink_top = %d,\n" \
+		"\t.ink_right = %d,\n" \
+		"\t.ink_bottom = %d,\n" \
+		"};\n\n",
+		job->font_sym, ts->length ? run_glyphs_sym : "NULL", ts->length, x,
+		left, top, right, bottom);
+	free(run_glyphs_sym);
+}
+
+/** Write the glyphs of 'job' ready for drawing in its tint colors: the
+ * coverage of each pixel, scaled to 0-FONT_TINT_LEVELS, and the
+ * premultiplied value of each color at every coverage. */
+static void store_tint(FILE *c, const struct job *job, const struct font_data *fd)
+{
+	const struct rendering *r = job->rendering;
+	const char *tint_sym = job->tint_sym;
+	char section_str[SECTION_BUFLEN], ch_mb[MB_BUFLEN];
+	char *sym = malloc(strlen(tint_sym) + 32);
+	uint32_t offset = 0;
+
+	// The rendered bitmaps are raw, since the font isn't rotated
+	sprintf(sym, "%s_coverage", tint_sym);
+	fprintf(c, "/** Coverage of the glyphs of font \"%s\" for tinting, 0-%d per pixel. */\n" \
+		"static const uint8_t %s[] %s= {\n",
+		fd->name, FONT_TINT_LEVELS, sym, get_section(section_str, job->section, sym));
+	for (size_t i = 0; i < job->count; i++) {
+		const struct glyph_data *gd = &r->glyphs[i];
+
+		if (gd->bitmap == NULL)
+			continue;
+		fprintf(c, "\t/* U+%04X '%s' */\n", (unsigned int)gd->ch, char_to_mb(gd->ch, ch_mb));
+		for (unsigned int y = 0; y < gd->rows; y++) {
+			fprintf(c, "\t");
+			for (unsigned int x = 0; x < gd->cols; x++)
+				fprintf(c, "%d,%s", (gd->bitmap[y * gd->cols + x] * FONT_TINT_LEVELS + 127) / 255,
+					x == gd->cols - 1 ? "\n" : " ");
+		}
+		offset += gd->rows * gd->cols;
+	}
+	if (offset == 0)
+		fprintf(c, "\t0,\n");
+	fprintf(c, "};\n\n");
+
+	sprintf(sym, "%s_offsets", tint_sym);
+	fprintf(c, "/** Offset of each glyph of font \"%s\" in %s_coverage. */\n" \
+		"static const uint32_t %s[] %s= {\n",
+		fd->name, tint_sym, sym, get_section(section_str, job->section, sym));
+	offset = 0;
+	for (size_t i = 0; i < job->count; i++) {
+		const struct glyph_data *gd = &r->glyphs[i];
+
+		fprintf(c, "%s%u,%s", i % 8 ? "" : "\t", (unsigned int)offset,
+			i % 8 == 7 || i == job->count - 1 ? "\n" : " ");
+		if (gd->bitmap)
+			offset += gd->rows * gd->cols;
+	}
+	if (job->count == 0)
+		fprintf(c, "\t0,\n");
+	fprintf(c, "};\n\n");
+
+	sprintf(sym, "%s_colors", tint_sym);
+	fprintf(c, "/** Colors font \"%s\" is tinted for. */\n" \
+		"static const uint16_t %s[] %s= {\n",
+		fd->name, sym, get_section(section_str, job->section, sym));
+	for (size_t i = 0; i < job->tint_count; i++)
+		fprintf(c, "\t0x%04x,\n", job->tints[i]);
 	fprintf(c, "};\n\n");
 
-	// Append to the post
-	char *str = malloc(len + 100);
-	snprintf(str, len + 100, "\t&%s,  /* U+%04X '%s' */\n", gname, ch, mb(ch));
-	*post = realloc(*post, (*post_len) + strlen(str) + 1);
-	strcpy((*post) + (*post_len), str);
-	(*post_len) += strlen(str);
-	(*post_count)++;
+	sprintf(sym, "%s_premultiplied", tint_sym);
+	fprintf(c, "/** Each color of font \"%s\" at each coverage, spread. */\n" \
+		"static const uint32_t %s[] %s= {\n",
+		fd->name, sym, get_section(section_str, job->section, sym));
+	for (size_t i = 0; i < job->tint_count; i++) {
+		uint32_t spread = rgb16_spread(job->tints[i]);
+
+		for (int level = 0; level <= FONT_TINT_LEVELS; level++)
+			fprintf(c, "%s0x%08x,%s", level % 8 ? "" : "\t",
+				(unsigned int)(((spread * level) >> 5) & RGB16_SPREAD_MASK),
+				level % 8 == 7 || level == FONT_TINT_LEVELS ? "\n" : " ");
+	}
+	fprintf(c, "};\n\n");
 
-	free(str);
-	free(bname);
-	free(gname);
-	free(kname);
+	fprintf(c, "/** Font \"%s\" ready to draw in %zu colors. */\n", fd->name, job->tint_count);
+	fprintf(c, "const struct font_tint %s %s= {\n" \
+		"\t.font = &%s,\n" \
+		"\t.coverage = %s_coverage,\n" \
+		"\t.offsets = %s_offsets,\n" \
+		"\t.color_count = %zu,\n" \
+		"\t.colors = %s_colors,\n" \
+		"\t.premultiplied = %s_premultiplied,\n" \
+		"};\n\n",
+		tint_sym, get_section(section_str, job->section, tint_sym), job->font_sym,
+		tint_sym, tint_sym, job->tint_count, tint_sym, tint_sym);
+	free(sym);
 }
 
-char *get_section(char *name)
+/** Write the outlines of the glyphs of 'job', in font units, and the struct
+ * font_outlines that draws them with its font. */
+static void store_outlines(FILE *c, const struct job *job, const struct font_data *fd)
 {
-	static char str[512];
-	static int count = 0;
+	char section_str[SECTION_BUFLEN];
+	const char *outlines_sym = job->outlines_sym;
+	FT_Face face = job->fonts[0].face;
+	char ch_mb[MB_BUFLEN];
+	char *sym = malloc(strlen(outlines_sym) + 32);
+	size_t point = 0, contour = 0;
+
+	sprintf(sym, "%s_points", outlines_sym);
+	fprintf(c, "/** Outline points of font \"%s\", x and y in font units. */\n" \
+		"static const int16_t %s[] %s= {\n",
+		fd->name, sym, get_section(section_str, job->section, sym));
+	for (size_t i = 0; i < fd->count; i++) {
+		const struct outline_data *od = fd->glyphs[i].outline;
+
+		if (od->point_count == 0)
+			continue;
+		fprintf(c, "\t/* %s */\n", char_to_mb(fd->glyphs[i].ch, ch_mb));
+		for (unsigned int p = 0; p < od->point_count; p++)
+			fprintf(c, "%s%d, %d,%s", p % 8 ? "" : "\t",
+				od->points[2 * p], od->points[2 * p + 1],
+				p % 8 == 7 || p == od->point_count - 1 ? "\n" : " ");
+		point += od->point_count;
+	}
+	if (point == 0)
+		fprintf(c, "\t0,  /* No points */\n");
+	fprintf(c, "};\n\n");
 
-	if (section == NULL) return "";
-	snprintf(str, 512, "__attribute__ ((section (\"%s.%s_%04x\"))) ", section, name, count++);
-	return str;
+	// One bit per point, set for points on the curve
+	uint8_t *on = calloc(point / 8 + 1, 1);
+	point = 0;
+	for (size_t i = 0; i < fd->count; i++) {
+		const struct outline_data *od = fd->glyphs[i].outline;
+
+		for (unsigned int p = 0; p < od->point_count; p++, point++)
+			if (od->on[p])
+				on[point >> 3] |= 1 << (point & 7);
+	}
+	sprintf(sym, "%s_on", outlines_sym);
+	fprintf(c, "/** Points of font \"%s\" on the curve, a bit each. */\n" \
+		"static const uint8_t %s[] %s= {\n",
+		fd->name, sym, get_section(section_str, job->section, sym));
+	for (size_t i = 0; i < point / 8 + 1; i++)
+		fprintf(c, "%s0x%02x,%s", i % 16 ? "" : "\t", on[i],
+			i % 16 == 15 || i == point / 8 ? "\n" : " ");
+	fprintf(c, "};\n\n");
+	free(on);
+
+	sprintf(sym, "%s_ends", outlines_sym);
+	fprintf(c, "/** Last point of each contour of font \"%s\", from the first of its glyph. */\n" \
+		"static const uint16_t %s[] %s= {\n",
+		fd->name, sym, get_section(section_str, job->section, sym));
+	for (size_t i = 0; i < fd->count; i++) {
+		const struct outline_data *od = fd->glyphs[i].outline;
+
+		for (unsigned int k = 0; k < od->contour_count; k++)
+			fprintf(c, "%s%u,%s", k % 16 ? "" : "\t", od->ends[k],
+				k % 16 == 15 || k == od->contour_count - 1 ? "\n" : " ");
+		contour += od->contour_count;
+	}
+	if (contour == 0)
+		fprintf(c, "\t0,  /* No contours */\n");
+	fprintf(c, "};\n\n");
+
+	sprintf(sym, "%s_glyphs", outlines_sym);
+	fprintf(c, "/** Outline of each glyph of font \"%s\". */\n" \
+		"static const struct font_outline_glyph %s[] %s= {\n",
+		fd->name, sym, get_section(section_str, job->section, sym));
+	point = contour = 0;
+	for (size_t i = 0; i < fd->count; i++) {
+		const struct outline_data *od = fd->glyphs[i].outline;
+
+		fprintf(c, "\t{ .point = %zu, .contour = %zu, .contour_count = %u, .advance = %d }," \
+			"  /* %s */\n",
+			point, contour, od->contour_count, od->advance,
+			char_to_mb(fd->glyphs[i].ch, ch_mb));
+		point += od->point_count;
+		contour += od->contour_count;
+	}
+	fprintf(c, "};\n\n");
+
+	fprintf(c, "/** Font \"%s\" as outlines, to draw at any size. */\n", fd->name);
+	fprintf(c, "const struct font_outlines %s %s= {\n" \
+		"\t.font = &%s,\n" \
+		"\t.units_per_em = %d,\n" \
+		"\t.ascender = %d,\n" \
+		"\t.height = %d,\n" \
+		"\t.glyphs = %s_glyphs,\n" \
+		"\t.points = %s_points,\n" \
+		"\t.on = %s_on,\n" \
+		"\t.ends = %s_ends,\n" \
+		"};\n\n",
+		outlines_sym, get_section(section_str, job->section, outlines_sym), job->font_sym,
+		face->units_per_EM, face->ascender, face->height,
+		outlines_sym, outlines_sym, outlines_sym, outlines_sym);
+	free(sym);
 }
 
-int cmp_wchar(const void *p1, const void *p2)
+/** Release what encoding and packing a phase of a subpixel font allocated;
+ * the rest of 'phase' belongs to the font it was copied from. */
+/** Write the glyphs of 'job' at each phase after the first as a font of its
+ * own, sharing the characters, lookup and kerning of 'fd' whose arrays are
+ * named in 'syms', and the struct font_subpixel that picks between them.
+ * Returns non-zero on failure. */
+static int store_subpixel(FILE *c, const struct job *job, const struct font_data *fd,
+			  const struct font_syms *syms, int lookup, size_t table_len)
 {
-	return *(wchar_t *)p1 - *(wchar_t *)p2;
+	const char *subpixel_sym = job->subpixel_sym;
+	char section_str[SECTION_BUFLEN];
+	size_t len = strlen(subpixel_sym) + 32;
+	char *sym = malloc(len), *atlas_sym = malloc(len), *codec_sym = malloc(len);
+	char *glyphs_sym = malloc(len), *glyph_codecs_sym = malloc(len);
+	struct build_settings settings = {
+		.codec		= job->codec,
+		.optimize	= job->optimize,
+		.budget		= job->budget,
+		.atlas		= job->atlas,
+		.lookup		= lookup,
+		.glyph32	= fd->glyph32,
+	};
+	int error = 0;
+
+	for (int p = 1; p < job->subpixel && !error; p++) {
+		struct built_font bf;
+
+		// Each phase is encoded and packed on its own
+		error = build_font_data(job->rendering, p, &settings, &bf);
+		if (error) {
+			free_built_font(&bf);
+			break;
+		}
+
+		sprintf(atlas_sym, "%s_atlas%d", subpixel_sym, p);
+		sprintf(codec_sym, "%s_codec%d", subpixel_sym, p);
+		sprintf(glyphs_sym, "%s_glyphs%d", subpixel_sym, p);
+		sprintf(glyph_codecs_sym, "%s_glyph_codecs%d", subpixel_sym, p);
+		sprintf(sym, "%s_font%d", subpixel_sym, p);
+		struct font_syms phase_syms = *syms;
+		phase_syms.atlas = atlas_sym;
+		phase_syms.codec = codec_sym;
+		phase_syms.glyphs = glyphs_sym;
+		phase_syms.glyph_codecs = glyph_codecs_sym;
+		struct options options = {
+			.name		= job->output_name_c,
+			.kerning	= fd->with_kerning ? &fd->kerning : NULL,
+			.atlas		= &bf.atlas,
+		};
+
+		fprintf(c, "/* Font \"%s\" drawn %d/%d of a pixel to the right. */\n\n",
+			fd->name, p, job->subpixel);
+		store_atlas(c, &bf.fd, &bf.atlas, atlas_sym, job->section);
+		store_codec_data(c, &bf.fd, codec_sym, job->section);
+		error = store_glyphs(c, &bf.fd, &options, &phase_syms, job->section);
+		fprintf(c, "/** Font \"%s\" drawn %d/%d of a pixel to the right. */\n",
+			fd->name, p, job->subpixel);
+		store_font(c, &bf.fd, "static ", sym, job->section, lookup, table_len, &bf.atlas,
+			   &phase_syms);
+		free_built_font(&bf);
+	}
+	if (error) {
+		free(sym);
+		free(atlas_sym);
+		free(codec_sym);
+		free(glyphs_sym);
+		free(glyph_codecs_sym);
+		return 1;
+	}
+
+	sprintf(sym, "%s_fonts", subpixel_sym);
+	fprintf(c, "/** Font \"%s\" at each phase. */\n" \
+		"static const struct font *const %s[] %s= {\n" \
+		"\t&%s,\n",
+		fd->name, sym, get_section(section_str, job->section, sym), job->font_sym);
+	for (int p = 1; p < job->subpixel; p++)
+		fprintf(c, "\t&%s_font%d,\n", subpixel_sym, p);
+	fprintf(c, "};\n\n");
+
+	sprintf(sym, "%s_advances", subpixel_sym);
+	fprintf(c, "/** Advance of each glyph of font \"%s\", in 1/64 pixels. */\n" \
+		"static const int32_t %s[] %s= {\n",
+		fd->name, sym, get_section(section_str, job->section, sym));
+	for (size_t i = 0; i < fd->count; i++)
+		fprintf(c, "%s%d,%s", i % 8 ? "" : "\t", fd->glyphs[i].advance64,
+			i % 8 == 7 || i == fd->count - 1 ? "\n" : " ");
+	if (fd->count == 0)
+		fprintf(c, "\t0,\n");
+	fprintf(c, "};\n\n");
+
+	fprintf(c, "/** Font \"%s\" at %d horizontal phases. */\n" \
+		"const struct font_subpixel %s %s= {\n" \
+		"\t.font = &%s,\n" \
+		"\t.phases = %d,\n" \
+		"\t.phase_fonts = %s_fonts,\n" \
+		"\t.advances = %s_advances,\n" \
+		"};\n\n",
+		fd->name, job->subpixel, subpixel_sym,
+		get_section(section_str, job->section, subpixel_sym), job->font_sym,
+		job->subpixel, subpixel_sym, subpixel_sym);
+
+	free(sym);
+	free(atlas_sym);
+	free(codec_sym);
+	free(glyphs_sym);
+	free(glyph_codecs_sym);
+	return error || ferror(c);
+}
+
+/** Write the entry for the glyph 'gd', number 'idx' in the character list,
+ * in the table of glyphs. */
+int store_glyph(const struct glyph_data *gd, size_t idx,
+		const struct options *opts, FILE *c)
+{
+	char ch_mb[MB_BUFLEN];
+
+	fprintf(c, "\t{ .left = %d, .top = %d, .advance = %d, .cols = %u, .rows = %u, ",
+		gd->left, gd->top, gd->advance, gd->cols, gd->rows);
+	if (opts->kerning)
+		fprintf(c, ".kern_left = %u, .kern_right = %u, ",
+			opts->kerning->left[idx], opts->kerning->right[idx]);
+	fprintf(c, ".offset = %zu },  /* U+%04X '%s' */\n",
+		opts->atlas->offsets[idx], gd->ch, char_to_mb(gd->ch, ch_mb));
+
+	return ferror(c);
+}
+
+/** Return the attribute placing the symbol 'name' in 'section', in 'str',
+ * which must be at least SECTION_BUFLEN bytes, or an empty string if no
+ * section was requested. Symbol names are unique, so the result does not
+ * depend on the order in which glyphs are generated. */
+const char *get_section(char *str, const char *section, const char *name)
+{
+	if (section == NULL) return "";
+	snprintf(str, SECTION_BUFLEN, "__attribute__ ((section (\"%s.%s\"))) ", section, name);
+	return str;
 }
 
 // vim: set softtabstop=8 shiftwidth=8 tabstop=8:
@@ -0,0 +1,154 @@
+/**
+ * \file src/fontem_atlas.c
+ *
+ * Packs the bitmaps of a font into a single atlas.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generator.h"
+
+/** Used to sort glyphs by decreasing height, then width, before placing
+ * them on shelves. */
+static const struct glyph_data *sort_glyphs;
+
+static int cmp_shelf(const void *p1, const void *p2)
+{
+	const struct glyph_data *a = &sort_glyphs[*(const size_t *)p1];
+	const struct glyph_data *b = &sort_glyphs[*(const size_t *)p2];
+
+	if (a->rows != b->rows)
+		return a->rows > b->rows ? -1 : 1;
+	if (a->cols != b->cols)
+		return a->cols > b->cols ? -1 : 1;
+	return *(const size_t *)p1 < *(const size_t *)p2 ? -1 : 1;
+}
+
+/** Return the glyph of 'fd' whose bitmap 'gd' can reuse, or NULL. In a 2D
+ * atlas the reused bitmap must also have the same shape. */
+static const struct glyph_data *shared_with(const struct font_data *fd,
+					    const struct glyph_data *gd, int mode)
+{
+	const struct glyph_data *same = gd->same;
+
+	if (same == NULL)
+		return NULL;
+	if (mode == ATLAS_2D && same->cols != gd->cols)
+		return NULL;
+	return same;
+}
+
+/** Concatenate the encoded bitmaps, in character order. */
+static void build_1d(const struct font_data *fd, struct atlas *atlas)
+{
+	for (size_t i = 0; i < fd->count; i++) {
+		const struct glyph_data *gd = &fd->glyphs[i];
+		const struct glyph_data *same = shared_with(fd, gd, ATLAS_1D);
+
+		if (same) {
+			atlas->offsets[i] = atlas->offsets[same - fd->glyphs];
+		} else {
+			atlas->offsets[i] = atlas->length;
+			atlas->length += gd->length;
+		}
+	}
+
+	atlas->data = malloc(atlas->length + 1);
+	for (size_t i = 0; i < fd->count; i++)
+		if (!shared_with(fd, &fd->glyphs[i], ATLAS_1D) && fd->glyphs[i].length)
+			memcpy(atlas->data + atlas->offsets[i], fd->glyphs[i].bitmap,
+			       fd->glyphs[i].length);
+}
+
+/** Place the bitmaps on shelves in an image roughly as wide as it is high.
+ * Glyphs are placed tallest first, so each shelf wastes little height. */
+static void build_2d(const struct font_data *fd, struct atlas *atlas)
+{
+	size_t *order = malloc((fd->count + 1) * sizeof(size_t));
+	size_t placed = 0, area = 0;
+	unsigned int widest = 0;
+
+	for (size_t i = 0; i < fd->count; i++) {
+		const struct glyph_data *gd = &fd->glyphs[i];
+
+		if (gd->bitmap == NULL || shared_with(fd, gd, ATLAS_2D))
+			continue;
+		order[placed++] = i;
+		area += (size_t)gd->cols * gd->rows;
+		if (gd->cols > widest)
+			widest = gd->cols;
+	}
+
+	sort_glyphs = fd->glyphs;
+	qsort(order, placed, sizeof(size_t), cmp_shelf);
+
+	atlas->width = 1;
+	while ((size_t)atlas->width * atlas->width < area)
+		atlas->width++;
+	if (atlas->width < widest)
+		atlas->width = widest;
+
+	unsigned int x = 0, y = 0, shelf = 0;
+	for (size_t n = 0; n < placed; n++) {
+		const struct glyph_data *gd = &fd->glyphs[order[n]];
+
+		if (x + gd->cols > atlas->width) {
+			y += shelf;
+			x = 0;
+			shelf = 0;
+		}
+		atlas->offsets[order[n]] = (size_t)y * atlas->width + x;
+		x += gd->cols;
+		if (gd->rows > shelf)
+			shelf = gd->rows;
+	}
+	atlas->height = y + shelf;
+	atlas->length = (size_t)atlas->width * atlas->height;
+	atlas->data = calloc(atlas->length + 1, 1);
+
+	for (size_t n = 0; n < placed; n++) {
+		const struct glyph_data *gd = &fd->glyphs[order[n]];
+
+		for (unsigned int row = 0; row < gd->rows; row++)
+			memcpy(atlas->data + atlas->offsets[order[n]] + (size_t)row * atlas->width,
+			       gd->bitmap + (size_t)row * gd->cols, gd->cols);
+	}
+
+	for (size_t i = 0; i < fd->count; i++) {
+		const struct glyph_data *same = shared_with(fd, &fd->glyphs[i], ATLAS_2D);
+		if (same)
+			atlas->offsets[i] = atlas->offsets[same - fd->glyphs];
+	}
+
+	free(order);
+}
+
+/** Pack the bitmaps of 'fd' into 'atlas'. A 1D atlas holds the encoded
+ * bitmaps back to back, so works with any encoding; a 2D atlas is an image
+ * of uncompressed 8-bit bitmaps. Glyphs sharing a bitmap share its place.
+ * Returns non-zero if the result can't be described by struct font. */
+int build_atlas(const struct font_data *fd, int mode, struct atlas *atlas)
+{
+	memset(atlas, 0, sizeof(*atlas));
+	atlas->offsets = calloc(fd->count + 1, sizeof(size_t));
+
+	if (mode == ATLAS_2D)
+		build_2d(fd, atlas);
+	else
+		build_1d(fd, atlas);
+
+	if (atlas->length > UINT32_MAX || atlas->width > UINT16_MAX) {
+		fprintf(stderr, "ERROR: Font too large for an atlas.\n");
+		return 1;
+	}
+	return 0;
+}
+
+// vim: set softtabstop=8 shiftwidth=8 tabstop=8:
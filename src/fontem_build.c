@@ -0,0 +1,857 @@
+/**
+ * \file src/fontem_build.c
+ *
+ * Renders the glyphs of a font with FreeType, and builds fonts in memory for
+ * programs that use a TrueType font without generating code for it.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_OUTLINE_H
+#include FT_LCD_FILTER_H
+
+#include "generator.h"
+#include "resource/fontem.h"
+#include "resource/fontemgen.h"
+
+/** A worker renders a contiguous slice of the character list. */
+struct worker {
+	const struct render_options	*opts;
+	size_t			first;          /** Index of the first character in the slice */
+	size_t			last;           /** Index after the last character in the slice */
+	struct glyph_data	*glyphs;        /** Rendered glyphs, for the whole list */
+
+	pthread_t		thread;
+	int			error;          /** Non-zero if the worker failed */
+};
+
+/** Distance fields are measured on outlines rendered this many times larger */
+#define SDF_OVERSAMPLE 4
+
+/** Return the FreeType flags to load glyphs with. */
+static FT_Int32 load_flags(const struct render_options *opts)
+{
+	if (opts->sdf)
+		return FT_LOAD_NO_BITMAP;
+	// The outline is moved before it is rendered
+	if (opts->phase)
+		return opts->mono ? FT_LOAD_TARGET_MONO : FT_LOAD_DEFAULT;
+	if (opts->lcd)
+		return FT_LOAD_RENDER | FT_LOAD_TARGET_LCD;
+	return opts->mono ? FT_LOAD_RENDER | FT_LOAD_TARGET_MONO : FT_LOAD_RENDER;
+}
+
+/** Return a copy of the monochrome 'bitmap' with a byte of 0x00 or 0xff per
+ * pixel, for the caller to free. */
+static uint8_t *expand_mono(FT_Bitmap *bitmap, FT_Bitmap *bytes)
+{
+	uint8_t *buffer = malloc((size_t)bitmap->rows * bitmap->width);
+
+	for (unsigned int y = 0; y < bitmap->rows; y++)
+		for (unsigned int x = 0; x < bitmap->width; x++)
+			buffer[y * bitmap->width + x] =
+				bitmap->buffer[y * bitmap->pitch + x / 8] & (128 >> (x % 8)) ? 0xff : 0;
+
+	*bytes = *bitmap;
+	bytes->buffer = buffer;
+	bytes->pitch = bitmap->width;
+	bytes->pixel_mode = FT_PIXEL_MODE_GRAY;
+	return buffer;
+}
+
+/** Encode the rendered bitmap as it will be stored in the font. */
+static void encode_bitmap(FT_Bitmap *bitmap, const struct render_options *opts, struct glyph_data *gd)
+{
+	FT_Bitmap bytes;
+	uint8_t *expanded = NULL;
+
+	gd->bitmap = NULL;
+	gd->length = 0;
+	gd->line = 0;
+	gd->outline = NULL;
+
+	if (!bitmap->rows || !bitmap->width)
+		return;
+
+	// Only rotated monochrome bitmaps stay packed; the rest are stored a
+	// byte per pixel, which every codec and renderer takes
+	if (bitmap->pixel_mode == FT_PIXEL_MODE_MONO && !opts->rotate) {
+		expanded = expand_mono(bitmap, &bytes);
+		bitmap = &bytes;
+	}
+
+	if (opts->codec == FONT_CODEC_RLE) {
+		gd->length = (size_t)bitmap->rows * (size_t)bitmap->width;
+		gd->bitmap = rle_compress(bitmap->buffer, &gd->length);
+		gd->line = 16;
+	} else if (opts->rotate && opts->mono) {
+		unsigned int byte_rows = bitmap->rows / 8;
+		if (bitmap->rows & 7) byte_rows++;
+
+		gd->length = (size_t)byte_rows * bitmap->width;
+		gd->bitmap = calloc(gd->length, 1);
+		gd->line = byte_rows;
+
+		for (unsigned int y = 0; y < bitmap->rows; y++) {
+			for (unsigned int x = 0; x < bitmap->width; x++) {
+				unsigned int s_byte = (x / 8) + (y * bitmap->pitch);
+				unsigned int s_bit = x % 8;
+				unsigned char s_mask = 128 >> s_bit;
+
+				unsigned int d_byte = (y / 8) + (x * byte_rows);
+				unsigned int d_bit = y % 8;
+
+				if (bitmap->buffer[s_byte] & s_mask)
+					gd->bitmap[d_byte] |= 128 >> d_bit;
+			}
+		}
+	} else if (opts->rotate) {
+		gd->length = (size_t)bitmap->pitch * bitmap->rows;
+		gd->bitmap = malloc(gd->length);
+		gd->line = bitmap->rows;
+
+		for (unsigned int x = 0; x < (unsigned int)bitmap->pitch; x++)
+			for (unsigned int y = 0; y < (unsigned int)bitmap->rows; y++)
+				gd->bitmap[x * bitmap->rows + y] = bitmap->buffer[y * bitmap->pitch + x];
+	} else {
+		gd->length = (size_t)bitmap->pitch * bitmap->rows;
+		gd->bitmap = malloc(gd->length);
+		gd->line = bitmap->pitch;
+		memcpy(gd->bitmap, bitmap->buffer, gd->length);
+	}
+	free(expanded);
+}
+
+/** Return a / b rounded down, for any sign of 'a'. */
+static int floor_div(int a, int b)
+{
+	return a < 0 ? -((-a + b - 1) / b) : a / b;
+}
+
+/** Return the square root of 'v', rounded down. */
+static unsigned int isqrt(unsigned long v)
+{
+	unsigned long r = 0, bit = 1UL << 30;
+
+	while (bit > v)
+		bit >>= 2;
+	while (bit) {
+		if (v >= r + bit) {
+			v -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (unsigned int)r;
+}
+
+/** Whether the pixel at 'x', 'y' of 'bitmap' is inside the glyph. */
+static int sdf_inside(const FT_Bitmap *bitmap, int x, int y)
+{
+	if (x < 0 || y < 0 || x >= (int)bitmap->width || y >= (int)bitmap->rows)
+		return 0;
+	return bitmap->buffer[y * bitmap->pitch + x] >= 128;
+}
+
+/** Replace 'bitmap', rendered SDF_OVERSAMPLE times larger than the font
+ * with its top left at 'left', 'top', with the signed distance field of the
+ * glyph at the size of the font, 'spread' pixels bigger on every side. Each
+ * pixel of the field is measured from its centre to the nearest centre of a
+ * pixel of the large bitmap on the other side of the outline. */
+static void make_sdf(FT_Bitmap *bitmap, int *left, int *top, int spread)
+{
+	int os = SDF_OVERSAMPLE;
+	int w = bitmap->width, h = bitmap->rows;
+
+	// The pixels either side of the outline, with the bitmap padded by
+	// one so that ink on its edges has an outside
+	int *edges = malloc((size_t)(w + 2) * (h + 2) * 2 * sizeof(int));
+	size_t edge_count = 0;
+	for (int y = -1; y <= h; y++) {
+		for (int x = -1; x <= w; x++) {
+			int in = sdf_inside(bitmap, x, y);
+
+			if (sdf_inside(bitmap, x - 1, y) != in || sdf_inside(bitmap, x + 1, y) != in ||
+			    sdf_inside(bitmap, x, y - 1) != in || sdf_inside(bitmap, x, y + 1) != in) {
+				edges[edge_count * 2] = x;
+				edges[edge_count * 2 + 1] = y;
+				edge_count++;
+			}
+		}
+	}
+
+	int fleft = floor_div(*left, os) - spread;
+	int ftop = -floor_div(-*top, os) + spread;
+	unsigned int cols = -floor_div(-(*left + w), os) + spread - fleft;
+	unsigned int rows = ftop - floor_div(*top - h, os) + spread;
+	uint8_t *field = malloc((size_t)cols * rows);
+	long limit = (long)(spread + 1) * os;
+
+	for (unsigned int r = 0; r < rows; r++) {
+		for (unsigned int c = 0; c < cols; c++) {
+			// The centre of the field pixel, in the large bitmap, at
+			// twice the resolution so that it stays whole
+			int x2 = 2 * ((fleft + (int)c) * os - *left) + os;
+			int y2 = 2 * (*top - (ftop - (int)r) * os) + os;
+			int in = sdf_inside(bitmap, floor_div(x2, 2), floor_div(y2, 2));
+			unsigned long best = (unsigned long)(4 * limit * limit);
+
+			for (size_t i = 0; i < edge_count; i++) {
+				int ex = edges[i * 2], ey = edges[i * 2 + 1];
+
+				if (sdf_inside(bitmap, ex, ey) == in)
+					continue;
+				long dx = 2 * ex + 1 - x2, dy = 2 * ey + 1 - y2;
+				unsigned long d = (unsigned long)(dx * dx + dy * dy);
+				if (d < best)
+					best = d;
+			}
+
+			// The outline is half a pixel short of the nearest
+			// centre, all in units of half a pixel of the bitmap
+			long dist = (long)isqrt(best) - 1;
+			long v = dist * 128 / (2 * os * spread);
+			v = FONT_SDF_EDGE + (in ? v : -v - 1);
+			field[r * cols + c] = v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+		}
+	}
+	free(edges);
+
+	bitmap->buffer = field;
+	bitmap->width = cols;
+	bitmap->rows = rows;
+	bitmap->pitch = cols;
+	*left = fleft;
+	*top = ftop;
+}
+
+/** Close up the rows of an LCD bitmap, which FreeType pads, so that it is
+ * stored like any other: 'width' bytes, three to a pixel, on each row. */
+static void pack_lcd_rows(FT_Bitmap *bitmap)
+{
+	for (unsigned int y = 1; y < bitmap->rows; y++)
+		memmove(bitmap->buffer + y * bitmap->width,
+			bitmap->buffer + y * bitmap->pitch, bitmap->width);
+	bitmap->pitch = bitmap->width;
+}
+
+/** Capture the metrics and encoded bitmap of the glyph in the slot. */
+static int render_glyph(FT_GlyphSlotRec *glyph, wchar_t ch,
+			const struct render_options *opts, struct glyph_data *gd)
+{
+	gd->ch = ch;
+	gd->left = glyph->bitmap_left;
+	gd->top = glyph->bitmap_top;
+	gd->advance = (int)glyph->advance.x / 64;
+	gd->advance64 = glyph->linearHoriAdvance ? (int)((glyph->linearHoriAdvance + 512) >> 10) :
+			(int)glyph->advance.x;
+	gd->cols = glyph->bitmap.width;
+	gd->rows = glyph->bitmap.rows;
+	encode_bitmap(&glyph->bitmap, opts, gd);
+
+	return 0;
+}
+
+/** Render the outline in the slot SDF_OVERSAMPLE times larger, and capture
+ * the metrics and encoded distance field of the glyph. */
+static int render_sdf(FT_GlyphSlotRec *glyph, wchar_t ch,
+		      const struct render_options *opts, struct glyph_data *gd)
+{
+	FT_Matrix scale = {
+		.xx = SDF_OVERSAMPLE << 16,
+		.yy = SDF_OVERSAMPLE << 16,
+	};
+
+	if (glyph->format != FT_GLYPH_FORMAT_OUTLINE)
+		return 1;
+	FT_Outline_Transform(&glyph->outline, &scale);
+	if (FT_Render_Glyph(glyph, FT_RENDER_MODE_NORMAL))
+		return 1;
+
+	FT_Bitmap field = glyph->bitmap;
+	int left = glyph->bitmap_left, top = glyph->bitmap_top;
+
+	gd->ch = ch;
+	gd->advance = (int)glyph->advance.x / 64;
+	if (!field.rows || !field.width) {
+		gd->left = gd->top = 0;
+		gd->cols = gd->rows = 0;
+		encode_bitmap(&field, opts, gd);
+		return 0;
+	}
+
+	make_sdf(&field, &left, &top, opts->sdf);
+	gd->left = left;
+	gd->top = top;
+	gd->cols = field.width;
+	gd->rows = field.rows;
+	encode_bitmap(&field, opts, gd);
+	free(field.buffer);
+
+	return 0;
+}
+
+/** Keep the outline of the glyph for 'ch' from 'face' in 'gd', in font
+ * units, with the metrics it would have as a bitmap but no bitmap. Only
+ * quadratic outlines are kept. */
+static int render_outline(FT_Face face, wchar_t ch, struct glyph_data *gd)
+{
+	if (FT_Load_Char(face, ch, FT_LOAD_NO_BITMAP))
+		return 1;
+	memset(gd, 0, sizeof(*gd));
+	gd->ch = ch;
+	gd->advance = (int)face->glyph->advance.x / 64;
+
+	if (FT_Load_Char(face, ch, FT_LOAD_NO_SCALE) ||
+	    face->glyph->format != FT_GLYPH_FORMAT_OUTLINE)
+		return 1;
+
+	const FT_Outline *o = &face->glyph->outline;
+	struct outline_data *od = calloc(1, sizeof(*od));
+	od->advance = (int)face->glyph->metrics.horiAdvance;
+	od->point_count = o->n_points;
+	od->points = calloc(2 * o->n_points + 1, sizeof(int16_t));
+	od->on = calloc(o->n_points + 1, 1);
+	for (int i = 0; i < o->n_points; i++) {
+		if (FT_CURVE_TAG(o->tags[i]) == FT_CURVE_TAG_CUBIC) {
+			free(od->points);
+			free(od->on);
+			free(od);
+			return 1;
+		}
+		od->points[2 * i] = (int16_t)o->points[i].x;
+		od->points[2 * i + 1] = (int16_t)o->points[i].y;
+		od->on[i] = FT_CURVE_TAG(o->tags[i]) == FT_CURVE_TAG_ON;
+	}
+	od->contour_count = o->n_contours;
+	od->ends = calloc(o->n_contours + 1, sizeof(uint16_t));
+	for (int i = 0; i < o->n_contours; i++)
+		od->ends[i] = (uint16_t)o->contours[i];
+	gd->outline = od;
+
+	return 0;
+}
+
+/** Load the glyph for 'ch' from 'face' and render it into 'gd'. Returns
+ * non-zero if FreeType can't load it. */
+int render_char(FT_Face face, wchar_t ch, const struct render_options *opts,
+		struct glyph_data *gd)
+{
+	if (opts->outlines)
+		return render_outline(face, ch, gd);
+	// Spread each subpixel over its neighbours to soften color fringes;
+	// FreeType built without the filter renders LCD bitmaps its own way
+	if (opts->lcd)
+		FT_Library_SetLcdFilter(face->glyph->library, FT_LCD_FILTER_DEFAULT);
+	if (FT_Load_Char(face, ch, load_flags(opts)))
+		return 1;
+	if (opts->sdf)
+		return render_sdf(face->glyph, ch, opts, gd);
+	if (opts->lcd)
+		pack_lcd_rows(&face->glyph->bitmap);
+	if (opts->phase) {
+		if (face->glyph->format == FT_GLYPH_FORMAT_OUTLINE)
+			FT_Outline_Translate(&face->glyph->outline, opts->phase, 0);
+		if (FT_Render_Glyph(face->glyph, opts->mono ? FT_RENDER_MODE_MONO :
+				    FT_RENDER_MODE_NORMAL))
+			return 1;
+	}
+	return render_glyph(face->glyph, ch, opts, gd);
+}
+
+/** Render the worker's slice of the character list using 'face'. */
+static int run_worker(struct worker *w, FT_Face face)
+{
+	const struct render_options *opts = w->opts;
+	char ch_mb[MB_BUFLEN];
+
+	for (size_t i = w->first; i < w->last; i++) {
+		wchar_t ch = opts->char_list[i];
+
+		if (render_char(face, ch, opts, &w->glyphs[i])) {
+			fprintf(stderr, "ERROR : Can't load glyph for U+%04X '%s'.\n",
+				(unsigned int)ch, char_to_mb(ch, ch_mb));
+			w->error = 1;
+			break;
+		}
+	}
+
+	return w->error;
+}
+
+/** Thread entry point; each worker has its own FreeType library and face. */
+static void *worker_thread(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	const struct render_options *opts = w->opts;
+	FT_Library library;
+	FT_Face face;
+
+	if (FT_Init_FreeType(&library)) {
+		fprintf(stderr, "ERROR: Can't initialize FreeType.\n");
+		w->error = 1;
+		return NULL;
+	}
+
+	if (FT_New_Face(library, opts->font_filename, 0, &face) ||
+	    FT_Set_Char_Size(face, opts->font_size * 64, 0, FONT_DPI, 0)) {
+		fprintf(stderr, "ERROR: Can't load '%s'.\n", opts->font_filename);
+		w->error = 1;
+	} else {
+		run_worker(w, face);
+	}
+
+	FT_Done_FreeType(library);
+	return NULL;
+}
+
+/** Render the glyphs of the 'count' characters in 'opts' into 'glyphs',
+ * splitting the characters between 'jobs' workers. A single worker uses
+ * 'face'; more each load the font themselves. */
+int render_glyphs(FT_Face face, const struct render_options *opts, size_t count,
+		  struct glyph_data *glyphs, int jobs)
+{
+	int error;
+
+	// Split the character list between the workers
+	if ((size_t)jobs > count)
+		jobs = count ? (int)count : 1;
+
+	struct worker *workers = calloc(jobs, sizeof(struct worker));
+	for (int i = 0; i < jobs; i++) {
+		workers[i].opts = opts;
+		workers[i].first = count * i / jobs;
+		workers[i].last = count * (i + 1) / jobs;
+		workers[i].glyphs = glyphs;
+	}
+
+	if (jobs == 1) {
+		error = run_worker(&workers[0], face);
+	} else {
+		int started;
+
+		error = 0;
+		for (started = 0; started < jobs; started++) {
+			int rc = pthread_create(&workers[started].thread, NULL, worker_thread,
+						&workers[started]);
+			if (rc) {
+				fprintf(stderr, "ERROR: Can't start worker thread: %s\n",
+					strerror(rc));
+				error = 1;
+				break;
+			}
+		}
+
+		// Threads already started still write to 'glyphs' and 'workers'
+		for (int i = 0; i < started; i++) {
+			pthread_join(workers[i].thread, NULL);
+			error |= workers[i].error;
+		}
+	}
+	free(workers);
+	return error;
+}
+
+/** Return the font of 'fonts' that the glyph for 'ch' is taken from: the
+ * first that has it among its characters and has a glyph for it, else the
+ * first that has it among its characters, else the first font. 'found' is
+ * set to whether the font returned has a glyph for 'ch'. */
+const struct source *char_source(const struct source *fonts, size_t font_count,
+				 wchar_t ch, int *found)
+{
+	const struct source *fallback = NULL;
+
+	for (size_t i = 0; i < font_count; i++) {
+		const struct source *src = &fonts[i];
+
+		if (src->chars &&
+		    !bsearch(&ch, src->list, src->count, sizeof(wchar_t), cmp_char))
+			continue;
+		if (FT_Get_Char_Index(src->face, ch)) {
+			*found = 1;
+			return src;
+		}
+		if (fallback == NULL)
+			fallback = src;
+	}
+	*found = 0;
+	return fallback ? fallback : &fonts[0];
+}
+
+/** Drop the characters of the 'count' in 'list' that none of 'fonts' has a
+ * glyph for, keeping the list NUL-terminated. Returns how many are left. */
+size_t drop_missing_chars(const struct source *fonts, size_t font_count,
+			  wchar_t *list, size_t count)
+{
+	size_t n = 0;
+	int found;
+
+	for (size_t i = 0; i < count; i++) {
+		char_source(fonts, font_count, list[i], &found);
+		if (found)
+			list[n++] = list[i];
+	}
+	list[n] = 0;
+	return n;
+}
+
+/** The FONT_CODEC_ that glyphs stored with 'codec' are rendered with. RLE
+ * is the only codec applied while rendering, and an RLE font is made from
+ * raw bitmaps unless they are rotated. */
+int render_codec(int codec, int rotate)
+{
+	return codec == FONT_CODEC_RLE && rotate ? FONT_CODEC_RLE : FONT_CODEC_RAW;
+}
+
+/** Render the glyphs and find the kerning classes of 'r', splitting the
+ * characters between 'jobs' workers. Each font renders the characters taken
+ * from it, and only kerns them against each other. */
+int render_font(struct rendering *r, int jobs)
+{
+	size_t char_count = r->count;
+	FT_Size_Metrics *metrics = &r->fonts[0].face->size->metrics;
+
+	r->glyphs = calloc(char_count + 1, sizeof(struct glyph_data));
+	if (r->subpixel)
+		r->phases = calloc((r->subpixel - 1) * char_count + 1, sizeof(struct glyph_data));
+	r->ascender = (int)metrics->ascender / 64;
+	r->descender = (int)metrics->descender / 64;
+	r->height = (int)metrics->height / 64;
+
+	r->kerning.left = calloc(char_count + 1, 1);
+	r->kerning.right = calloc(char_count + 1, 1);
+	r->kerning.left_count = r->kerning.right_count = 1;
+	r->kerning.matrix = calloc(1, 1);
+
+	const struct source **sources = calloc(char_count + 1, sizeof(struct source *));
+	for (size_t i = 0; i < char_count; i++) {
+		int found;
+
+		sources[i] = char_source(r->fonts, r->font_count, r->list[i], &found);
+	}
+
+	size_t *index = calloc(char_count + 1, sizeof(size_t));
+	wchar_t *list = calloc(char_count + 1, sizeof(wchar_t));
+	struct glyph_data *glyphs = calloc(char_count + 1, sizeof(struct glyph_data));
+	int error = 0;
+	for (size_t f = 0; f < r->font_count && !error; f++) {
+		const struct source *src = &r->fonts[f];
+		FT_Face face = src->face;
+		size_t count = 0;
+
+		for (size_t i = 0; i < char_count; i++) {
+			if (sources[i] == src) {
+				index[count] = i;
+				list[count++] = r->list[i];
+			}
+		}
+		list[count] = 0;
+		if (count == 0)
+			continue;
+
+		// Glyphs of every font share the baseline, and the font is
+		// tall enough for all of them
+		if (f) {
+			metrics = &face->size->metrics;
+			if ((int)metrics->ascender / 64 > r->ascender)
+				r->ascender = (int)metrics->ascender / 64;
+			if ((int)metrics->descender / 64 < r->descender)
+				r->descender = (int)metrics->descender / 64;
+			if ((int)metrics->height / 64 > r->height)
+				r->height = (int)metrics->height / 64;
+		}
+
+		// Are we kerning?
+		struct kern_classes kc = { 0 };
+		if (FT_HAS_KERNING(face) && !build_kern_classes(face, list, count, &kc)) {
+			if (merge_kern_classes(&r->kerning, &kc, index, count))
+				fprintf(stderr, "WARNING: Too many kerning classes; kerning of '%s' dropped.\n",
+					src->filename);
+			else
+				r->with_kerning = 1;
+		}
+		free(kc.left);
+		free(kc.right);
+		free(kc.matrix);
+
+		struct render_options options = {
+			.font_filename	= src->filename,
+			.font_size	= r->font_size,
+			.char_list	= list,
+			.codec		= r->codec,
+			.rotate		= r->rotate,
+			.mono		= r->mono,
+			.sdf		= r->sdf ? SDF_SPREAD(r->font_size) : 0,
+			.outlines	= r->outlines,
+			.lcd		= r->lcd,
+		};
+
+		error = render_glyphs(face, &options, count, glyphs, jobs);
+		for (size_t i = 0; i < count; i++)
+			r->glyphs[index[i]] = glyphs[i];
+
+		// Each phase is the outline moved right by a fraction of a pixel
+		for (int p = 1; p < r->subpixel && !error; p++) {
+			struct glyph_data *phase = r->phases + (p - 1) * char_count;
+
+			options.phase = p * 64 / r->subpixel;
+			error = render_glyphs(face, &options, count, glyphs, jobs);
+			for (size_t i = 0; i < count; i++)
+				phase[index[i]] = glyphs[i];
+		}
+	}
+
+	free(glyphs);
+	free(list);
+	free(index);
+	free(sources);
+	return error;
+}
+
+/** Free the glyphs of the 'count' at 'glyphs'. */
+static void free_glyphs(struct glyph_data *glyphs, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		struct outline_data *od = glyphs[i].outline;
+
+		free(glyphs[i].bitmap);
+		if (od) {
+			free(od->points);
+			free(od->on);
+			free(od->ends);
+			free(od);
+		}
+	}
+	free(glyphs);
+}
+
+/** Free what render_font() made for 'r'. */
+void free_rendering(struct rendering *r)
+{
+	if (r->glyphs)
+		free_glyphs(r->glyphs, r->count);
+	if (r->phases)
+		free_glyphs(r->phases, (r->subpixel - 1) * r->count);
+	free(r->kerning.left);
+	free(r->kerning.right);
+	free(r->kerning.matrix);
+}
+
+/** Copy the 'rendered' glyphs into 'fd', which has room for them, to be
+ * stored with 'codec'; each font encodes its own copy of the bitmaps. The
+ * outlines are shared. */
+static void copy_glyphs(const struct rendering *r, int codec,
+			const struct glyph_data *rendered, struct font_data *fd)
+{
+	for (size_t i = 0; i < fd->count; i++) {
+		struct glyph_data *gd = &fd->glyphs[i];
+
+		*gd = rendered[i];
+		if (gd->bitmap == NULL)
+			continue;
+		if (codec == FONT_CODEC_RLE && r->codec == FONT_CODEC_RAW) {
+			gd->length = (size_t)gd->rows * gd->cols;
+			gd->bitmap = rle_compress(rendered[i].bitmap, &gd->length);
+			gd->line = 16;
+		} else {
+			gd->bitmap = malloc(gd->length);
+			memcpy(gd->bitmap, rendered[i].bitmap, gd->length);
+		}
+	}
+}
+
+/** Build the font stored as 'bs' says from the glyphs of 'r' at 'phase',
+ * 0 for those not moved: encode them, share identical bitmaps, pack them
+ * into an atlas and index them. The font shares the kerning classes of
+ * 'r'. Returns non-zero on failure, with 'bf->lookup' set to -1 if the
+ * lookup asked for doesn't fit glyph_t; release 'bf' with free_built_font()
+ * either way. */
+int build_font_data(const struct rendering *r, int phase, const struct build_settings *bs,
+		    struct built_font *bf)
+{
+	FT_Face face = r->fonts[0].face;
+	struct font_data *fd = &bf->fd;
+	size_t count = r->count;
+
+	memset(bf, 0, sizeof(*bf));
+	bf->lookup = LOOKUP_AUTO;
+	*fd = (struct font_data){
+		.name		= face->family_name,
+		.style		= face->style_name,
+		.size		= r->font_size,
+		.dpi		= FONT_DPI,
+		.ascender	= r->ascender,
+		.descender	= r->descender,
+		.height		= r->height,
+		.codec		= bs->codec,
+		.count		= count,
+		.max		= count ? r->list[count - 1] : 0,
+		.glyphs		= calloc(count + 1, sizeof(struct glyph_data)),
+		.with_kerning	= r->with_kerning,
+		.kerning	= r->kerning,
+	};
+	fd->glyph32 = bs->glyph32 || fd->max > GLYPH16_MAX || fd->count > GLYPH16_MAX;
+	copy_glyphs(r, bs->codec, phase ? r->phases + (phase - 1) * count : r->glyphs, fd);
+
+	// Encode with codecs that work on the whole font, and store each
+	// distinct bitmap once
+	if (encode_glyphs(fd, bs->codec, bs->optimize, bs->budget))
+		return 1;
+	bf->saved = dedup_bitmaps(fd, &bf->dups);
+	if (build_atlas(fd, bs->atlas, &bf->atlas))
+		return 1;
+
+	// The index used to find a character
+	bf->lookup = bs->lookup == LOOKUP_AUTO ? choose_lookup(fd) : fit_lookup(fd, bs->lookup);
+	if (bf->lookup == -1)
+		return 1;
+	bf->table_len = build_lookup(fd, bf->lookup, &bf->table);
+	return 0;
+}
+
+/** Free what build_font_data() made for 'bf'; the kerning classes belong
+ * to the rendering. */
+void free_built_font(struct built_font *bf)
+{
+	for (size_t i = 0; i < bf->fd.count && bf->fd.glyphs; i++)
+		free(bf->fd.glyphs[i].bitmap);
+	free(bf->fd.glyphs);
+	free(bf->fd.codec_data);
+	free(bf->atlas.data);
+	free(bf->atlas.offsets);
+	free(bf->table);
+}
+
+/** Build the font 'ttf' at 'size' points with the characters 'chars', given
+ * as to "fontem --chars" in the multibyte encoding of the current locale, or
+ * the default set if 'chars' is NULL. The font is
+ * rendered, encoded and laid out as fontem would generate it; 'opts' may be
+ * NULL for raw bitmaps and the lookup fontem would choose. Returns NULL with
+ * errno set on failure; release the font with fontem_build_free(). */
+const struct font *fontem_build(const char *ttf, int size, const char *chars,
+				const struct fontem_build_options *opts)
+{
+	static const struct fontem_build_options defaults = {
+		.codec	= FONT_CODEC_RAW,
+		.lookup = FONTEM_LOOKUP_AUTO,
+		.jobs	= 1,
+	};
+	FT_Library library;
+	FT_Face face;
+	int error;
+
+	if (opts == NULL)
+		opts = &defaults;
+	if (chars == NULL)
+		chars = DEFAULT_CHAR_LIST;
+
+	int codec = opts->codec;
+	if (ttf == NULL || size <= 0 || codec_macro(codec) == NULL ||
+	    (opts->lookup != FONTEM_LOOKUP_AUTO && lookup_macro(opts->lookup) == NULL) ||
+	    (codec > FONT_CODEC_RLE && opts->rotate) ||
+	    (opts->atlas_2d && (codec != FONT_CODEC_RAW || opts->rotate))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	wchar_t *list;
+	size_t count;
+	int literal = parse_char_list(chars, &list, &count);
+	if (literal < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (FT_Init_FreeType(&library)) {
+		free(list);
+		errno = ENOMEM;
+		return NULL;
+	}
+	error = FT_New_Face(library, ttf, 0, &face);
+	if (error || FT_Set_Char_Size(face, size * 64, 0, FONT_DPI, 0)) {
+		FT_Done_FreeType(library);
+		free(list);
+		errno = error == FT_Err_Cannot_Open_Resource ? ENOENT : EINVAL;
+		return NULL;
+	}
+
+	// Characters in ranges that the font doesn't have are left out
+	struct source src = {
+		.filename	= ttf,
+		.face		= face,
+	};
+	if (!literal)
+		count = drop_missing_chars(&src, 1, list, count);
+
+	struct rendering r = {
+		.fonts		= &src,
+		.font_count	= 1,
+		.font_size	= size,
+		.rotate		= opts->rotate,
+		.mono		= opts->mono,
+		.codec		= render_codec(codec, opts->rotate),
+		.list		= list,
+		.count		= count,
+	};
+	struct build_settings bs = {
+		.codec		= codec,
+		.optimize	= OPTIMIZE_SIZE,
+		.budget		= NO_BUDGET,
+		.atlas		= opts->atlas_2d ? ATLAS_2D : ATLAS_1D,
+		.lookup		= opts->lookup == FONTEM_LOOKUP_AUTO ? LOOKUP_AUTO : opts->lookup,
+		.glyph32	= sizeof(glyph_t) > 2,
+	};
+	struct built_font bf = { 0 };
+	struct font *font = NULL;
+
+	int jobs = opts->jobs > 0 ? opts->jobs : (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	// The characters must fit the glyph_t this library was built with
+	errno = EINVAL;
+	if ((count == 0 || list[count - 1] <= (glyph_t)~0) && count <= (glyph_t)~0 &&
+	    !render_font(&r, jobs > 0 ? jobs : 1) &&
+	    !build_font_data(&r, 0, &bs, &bf)) {
+		struct font_layout layout = {
+			.fd		= &bf.fd,
+			.atlas		= &bf.atlas,
+			.lookup		= bf.lookup,
+			.lookup_table	= bf.table,
+			.lookup_length	= bf.table_len,
+		};
+
+		font = build_font(&layout);
+	}
+
+	free_built_font(&bf);
+	free_rendering(&r);
+	free(list);
+	FT_Done_FreeType(library);
+
+	return font;
+}
+
+/** Release a font returned by fontem_build(). Its arrays are all in the
+ * block that starts with its atlas. */
+void fontem_build_free(const struct font *font)
+{
+	if (font == NULL)
+		return;
+	free((void *)font->atlas);
+	free((void *)font);
+}
+
+// vim: set softtabstop=8 shiftwidth=8 tabstop=8:
@@ -0,0 +1,106 @@
+/**
+ * \file src/fontem_cache.c
+ *
+ * Hashes the generator inputs so that output which is already up to date
+ * can be left alone.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generator.h"
+#include "resource/fontem.h"
+
+/** How far into a generated file to look for the hash marker */
+#define HASH_SEARCH_LEN 4096
+
+/** Add 'length' bytes at 'data' to 'hash' (FNV-1a). */
+void hash_data(uint64_t *hash, const void *data, size_t length)
+{
+	const uint8_t *p = data;
+
+	for (size_t i = 0; i < length; i++) {
+		*hash ^= p[i];
+		*hash *= UINT64_C(0x100000001b3);
+	}
+}
+
+/** Add an integer to 'hash', independent of the host byte order. */
+void hash_int(uint64_t *hash, long value)
+{
+	uint8_t buf[8];
+
+	for (int i = 0; i < 8; i++)
+		buf[i] = (uint64_t)value >> (i * 8);
+	hash_data(hash, buf, sizeof(buf));
+}
+
+/** Add a string to 'hash'. The length goes in first, so that adjacent
+ * strings cannot run into each other. */
+void hash_string(uint64_t *hash, const char *str)
+{
+	size_t len = strlen(str);
+
+	hash_int(hash, len);
+	hash_data(hash, str, len);
+}
+
+/** Add the contents of 'filename' to 'hash'. Returns non-zero with errno
+ * set if the file can't be read. */
+int hash_file(uint64_t *hash, const char *filename)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL)
+		return 1;
+
+	uint8_t buf[BUFSIZ];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+		hash_data(hash, buf, len);
+
+	int error = ferror(f);
+	fclose(f);
+	return error;
+}
+
+/** Check whether 'filename' was generated from inputs with 'hash'. Font packs
+ * carry the hash in their header; source files carry it in a comment near
+ * the top. A missing or unreadable file is never current. */
+int output_is_current(const char *filename, uint64_t hash)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL)
+		return 0;
+
+	char buf[HASH_SEARCH_LEN + 1];
+	size_t len = fread(buf, 1, HASH_SEARCH_LEN, f);
+	fclose(f);
+	buf[len] = '\0';
+
+	if (len >= sizeof(struct font_pack_header) && !memcmp(buf, FONT_PACK_MAGIC, 4)) {
+		const uint8_t *h = (const uint8_t *)buf + offsetof(struct font_pack_header, hash);
+		uint64_t found = 0;
+
+		for (int i = 7; i >= 0; i--)
+			found = (found << 8) | h[i];
+		return found == hash;
+	}
+
+	char marker[sizeof(HASH_MARKER) + 16];
+	snprintf(marker, sizeof(marker), HASH_MARKER "%016" PRIx64, hash);
+	// Objects are binary, so the marker may follow a NUL
+	for (size_t i = 0; i + strlen(marker) <= len; i++)
+		if (!memcmp(buf + i, marker, strlen(marker)))
+			return 1;
+	return 0;
+}
+
+// vim: set softtabstop=8 shiftwidth=8 tabstop=8:
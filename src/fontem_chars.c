@@ -0,0 +1,476 @@
+/**
+ * \file src/fontem_chars.c
+ *
+ * Works out which characters a font needs from the text that will be drawn
+ * with it: string tables, PO files and C sources, or glyph usage traces
+ * recorded by a library built with FONTEM_TRACE. Also reads character lists
+ * and the strings to lay out, and prints characters.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wctype.h>
+
+#include "generator.h"
+
+/** Kinds of file scanned for characters */
+#define SCAN_TEXT	0       /** All of the text */
+#define SCAN_C		1       /** String and character literals of C source */
+#define SCAN_PO		2       /** Strings of a gettext catalogue */
+
+/** Compare two characters, for qsort() and bsearch(). */
+int cmp_char(const void *p1, const void *p2)
+{
+	wchar_t a = *(const wchar_t *)p1, b = *(const wchar_t *)p2;
+
+	return a < b ? -1 : a > b;
+}
+
+/** Add 'ch' to 'set' if it is a character that can be drawn. */
+void char_set_add(struct char_set *set, wchar_t ch)
+{
+	if (ch < 0x20 || (ch >= 0x7f && ch < 0xa0) || (ch >= 0xd800 && ch < 0xe000) ||
+	    ch > 0x10ffff)
+		return;
+
+	if (set->count == set->alloc) {
+		set->alloc = set->alloc ? set->alloc * 2 : 256;
+		set->chars = realloc(set->chars, (set->alloc + 1) * sizeof(wchar_t));
+	}
+	set->chars[set->count++] = ch;
+}
+
+/** Sort 'set' and drop duplicates; the list is then NUL-terminated. */
+void char_set_sort(struct char_set *set)
+{
+	size_t unique = 0;
+
+	if (set->chars == NULL)
+		set->chars = calloc(1, sizeof(wchar_t));
+	qsort(set->chars, set->count, sizeof(wchar_t), cmp_char);
+	for (size_t i = 0; i < set->count; i++)
+		if (unique == 0 || set->chars[unique - 1] != set->chars[i])
+			set->chars[unique++] = set->chars[i];
+	set->chars[unique] = 0;
+	set->count = unique;
+}
+
+/** Decode the UTF-8 sequence at '*p', moving '*p' past it. Bytes that are
+ * not valid UTF-8 are skipped one at a time and give -1. */
+static long utf8_next(const unsigned char **p, const unsigned char *end)
+{
+	const unsigned char *s = *p;
+	int len = s[0] < 0x80 ? 1 : s[0] < 0xc2 ? 0 : s[0] < 0xe0 ? 2 : s[0] < 0xf0 ? 3 :
+		  s[0] < 0xf5 ? 4 : 0;
+	long ch = len == 1 ? s[0] : s[0] & (0x7f >> len);
+
+	*p = s + 1;
+	if (len == 0 || end - s < len)
+		return -1;
+	for (int i = 1; i < len; i++) {
+		if ((s[i] & 0xc0) != 0x80)
+			return -1;
+		ch = ch << 6 | (s[i] & 0x3f);
+	}
+	*p = s + len;
+	return ch;
+}
+
+/** Read 'digits' hex digits, or as many as there are if 'digits' is 0. */
+static long hex_escape(const unsigned char **p, const unsigned char *end, int digits)
+{
+	long v = 0;
+	int n = 0;
+
+	while (*p < end && isxdigit(**p) && (digits == 0 || n < digits)) {
+		if (v <= 0x10ffff)
+			v = v * 16 + (isdigit(**p) ? **p - '0' : (tolower(**p) - 'a' + 10));
+		(*p)++;
+		n++;
+	}
+	return n && v <= 0x10ffff ? v : -1;
+}
+
+/** Add the characters of a C string or character literal that ends with
+ * 'quote'; '*p' is just past the opening quote and is left past the
+ * closing one. */
+static void scan_literal(const unsigned char **p, const unsigned char *end, int quote,
+			 struct char_set *set)
+{
+	while (*p < end && **p != quote && **p != '\n') {
+		long ch;
+
+		if (**p != '\\') {
+			ch = utf8_next(p, end);
+		} else if (++(*p) == end) {
+			break;
+		} else if (**p == 'x') {
+			(*p)++;
+			ch = hex_escape(p, end, 0);
+		} else if (**p == 'u' || **p == 'U') {
+			int digits = **p == 'u' ? 4 : 8;
+			(*p)++;
+			ch = hex_escape(p, end, digits);
+		} else if (**p >= '0' && **p <= '7') {
+			ch = 0;
+			for (int i = 0; i < 3 && *p < end && **p >= '0' && **p <= '7'; i++)
+				ch = ch * 8 + *(*p)++ - '0';
+		} else {
+			// \n and the like are not drawn; \\, \" and \' are
+			ch = strchr("\\\"'?", **p) ? **p : -1;
+			(*p)++;
+		}
+		if (ch >= 0)
+			char_set_add(set, ch);
+	}
+	if (*p < end)
+		(*p)++;
+}
+
+/** Work out how to scan 'filename' from its extension. */
+static int scan_kind(const char *filename)
+{
+	static const char *c_ext[] = { "c", "h", "cc", "cpp", "cxx", "hh", "hpp", "hxx", "inc" };
+	const char *dot = strrchr(filename, '.');
+
+	if (dot == NULL || strchr(dot, '/'))
+		return SCAN_TEXT;
+	if (!strcmp(dot + 1, "po") || !strcmp(dot + 1, "pot"))
+		return SCAN_PO;
+	for (size_t i = 0; i < sizeof(c_ext) / sizeof(c_ext[0]); i++)
+		if (!strcmp(dot + 1, c_ext[i]))
+			return SCAN_C;
+	return SCAN_TEXT;
+}
+
+/** Read the whole of 'filename'; returns NULL with errno set on failure. */
+static unsigned char *read_file(const char *filename, size_t *length)
+{
+	FILE *f = fopen(filename, "rb");
+	unsigned char *data = NULL;
+	size_t n = 0, alloc = 0;
+
+	if (f == NULL)
+		return NULL;
+	for (;;) {
+		if (n == alloc) {
+			alloc = alloc ? alloc * 2 : 65536;
+			data = realloc(data, alloc + 1);
+		}
+		size_t got = fread(data + n, 1, alloc - n, f);
+		n += got;
+		if (got == 0)
+			break;
+	}
+	if (ferror(f)) {
+		fclose(f);
+		free(data);
+		return NULL;
+	}
+	fclose(f);
+	data[n] = '\0';
+	*length = n;
+	return data;
+}
+
+/** Add the characters used by the UTF-8 file 'filename' to 'set'. C and C++
+ * sources give the contents of their string and character literals, PO
+ * files the contents of their strings, and any other file all of its text.
+ * Returns non-zero with errno set if the file can't be read. */
+int scan_chars(const char *filename, struct char_set *set)
+{
+	size_t length;
+	unsigned char *data = read_file(filename, &length);
+	int kind = scan_kind(filename);
+
+	if (data == NULL)
+		return 1;
+
+	const unsigned char *p = data, *end = data + length;
+	int line_start = 1;
+	while (p < end) {
+		if (kind == SCAN_TEXT) {
+			long ch = utf8_next(&p, end);
+			if (ch >= 0)
+				char_set_add(set, ch);
+		} else if (*p == '"' || (kind == SCAN_C && *p == '\'')) {
+			int quote = *p++;
+			scan_literal(&p, end, quote, set);
+		} else if (kind == SCAN_C && p[0] == '/' && p[1] == '/') {
+			while (p < end && *p != '\n')
+				p++;
+		} else if (kind == SCAN_C && p[0] == '/' && p[1] == '*') {
+			for (p += 2; p < end && !(p[0] == '*' && p[1] == '/'); p++)
+				;
+			p = p < end ? p + 2 : end;
+		} else if (kind == SCAN_PO && line_start && *p == '#') {
+			while (p < end && *p != '\n')
+				p++;
+		} else {
+			line_start = *p++ == '\n';
+			continue;
+		}
+		line_start = 0;
+	}
+
+	free(data);
+	return 0;
+}
+
+/** Read the strings to lay out from 'filename', a UTF-8 file with a line of
+ * "name = text" per string. Blank lines and lines starting with '#' are
+ * skipped; the text runs to the end of the line. Returns non-zero if the
+ * file can't be read or a line is malformed. */
+int read_strings(const char *filename, struct text_string **strings, size_t *count)
+{
+	size_t length, alloc = 0;
+	unsigned char *data = read_file(filename, &length);
+
+	if (data == NULL) {
+		fprintf(stderr, "ERROR: Can't read '%s': %s\n", filename, strerror(errno));
+		return 1;
+	}
+
+	*strings = NULL;
+	*count = 0;
+	const unsigned char *p = data, *end = data + length;
+	for (int line = 1; p < end; line++) {
+		const unsigned char *eol = memchr(p, '\n', end - p);
+		if (eol == NULL)
+			eol = end;
+		const unsigned char *next = eol < end ? eol + 1 : end;
+		if (eol > p && eol[-1] == '\r')
+			eol--;
+
+		while (p < eol && isspace(*p))
+			p++;
+		if (p == eol || *p == '#') {
+			p = next;
+			continue;
+		}
+
+		// The name must be usable in C symbols
+		const unsigned char *name = p;
+		while (p < eol && (isalnum(*p) || *p == '_'))
+			p++;
+		size_t name_len = p - name;
+		while (p < eol && isblank(*p))
+			p++;
+		if (name_len == 0 || isdigit(*name) || p == eol || *p != '=') {
+			fprintf(stderr, "ERROR: %s:%d: Expected \"name = text\".\n", filename, line);
+			free(data);
+			return 1;
+		}
+		for (p++; p < eol && isblank(*p); p++)
+			;
+
+		for (size_t i = 0; i < *count; i++) {
+			if (strlen((*strings)[i].name) == name_len &&
+			    !memcmp((*strings)[i].name, name, name_len)) {
+				fprintf(stderr, "ERROR: %s:%d: The string '%.*s' is already defined.\n",
+					filename, line, (int)name_len, name);
+				free(data);
+				return 1;
+			}
+		}
+
+		if (*count == alloc) {
+			alloc = alloc ? alloc * 2 : 32;
+			*strings = realloc(*strings, alloc * sizeof(struct text_string));
+		}
+		struct text_string *ts = &(*strings)[(*count)++];
+		ts->line = line;
+		ts->name = strndup((const char *)name, name_len);
+		ts->text = strndup((const char *)p, eol - p);
+		ts->chars = calloc(eol - p + 1, sizeof(wchar_t));
+		ts->length = 0;
+		while (p < eol) {
+			long ch = utf8_next(&p, eol);
+
+			if (ch < 0) {
+				fprintf(stderr, "ERROR: %s:%d: The text is not valid UTF-8.\n",
+					filename, line);
+				free(data);
+				return 1;
+			}
+			ts->chars[ts->length++] = ch;
+		}
+		p = next;
+	}
+
+	free(data);
+	return 0;
+}
+
+/** Add the characters recorded in the glyph trace 'filename' to 'set'. A
+ * trace has a line per lookup: "U+XXXX", then the size, family and style of
+ * the font, separated by tabs. Only lookups in the font 'name' 'style' at
+ * 'size' are used; lines that give no font apply to every font. Returns
+ * non-zero with errno set if the file can't be read. */
+int scan_trace(const char *filename, const char *name, const char *style, int size,
+	       struct char_set *set)
+{
+	FILE *f = fopen(filename, "r");
+	char line[512];
+
+	if (f == NULL)
+		return 1;
+	while (fgets(line, sizeof(line), f)) {
+		char *field[4], *end;
+		int fields = 0;
+
+		line[strcspn(line, "\r\n")] = '\0';
+		for (char *s = line; s && fields < 4; fields++) {
+			field[fields] = s;
+			s = strchr(s, '\t');
+			if (s)
+				*s++ = '\0';
+		}
+
+		if (strncmp(field[0], "U+", 2))
+			continue;
+		unsigned long ch = strtoul(field[0] + 2, &end, 16);
+		if (end == field[0] + 2 || *end || ch > 0x10ffff)
+			continue;
+		if (fields > 1 && (fields != 4 || atoi(field[1]) != size ||
+				   strcmp(field[2], name) || strcmp(field[3], style)))
+			continue;
+		char_set_add(set, ch);
+	}
+
+	int error = ferror(f);
+	fclose(f);
+	return error;
+}
+
+/** Whether 'wchar' is a bidirectional formatting character, which
+ * compilers refuse to see unpaired in a comment. */
+static int is_bidi_control(wchar_t wchar)
+{
+	return wchar == 0x061c || wchar == 0x200e || wchar == 0x200f ||
+	       (wchar >= 0x202a && wchar <= 0x202e) ||
+	       (wchar >= 0x2066 && wchar <= 0x2069);
+}
+
+/** Convert a wide character to a multibyte string in the buffer 'ch_mb',
+ * which must be at least MB_BUFLEN bytes. Characters that are not safe to
+ * print in a comment give an empty string. */
+char *char_to_mb(wchar_t wchar, char *ch_mb)
+{
+	mbstate_t state;
+
+	if (!iswprint(wchar) || is_bidi_control(wchar)) {
+		ch_mb[0] = '\0';
+		return ch_mb;
+	}
+
+	memset(&state, 0, sizeof(state));
+	size_t mb_len = wcrtomb(ch_mb, wchar, &state);
+
+	if (mb_len == (size_t)-1)
+		mb_len = 0;
+	ch_mb[mb_len] = '\0';
+	return ch_mb;
+}
+
+/** Read "U+XXXX" at 'p' into 'ch'; returns the end of it, or NULL. */
+static const char *parse_codepoint(const char *p, wchar_t *ch)
+{
+	char *end;
+
+	if (p[0] != 'U' || p[1] != '+' || !isxdigit((unsigned char)p[2]))
+		return NULL;
+	unsigned long v = strtoul(p + 2, &end, 16);
+	if (v > 0x10ffff)
+		return NULL;
+	*ch = (wchar_t)v;
+	return end;
+}
+
+/** Expand a character list of the form "U+XXXX[-U+YYYY][,...]" into a
+ * sorted list without duplicates. Returns 1 if 'str' is not in that form,
+ * -1 if it is but is malformed, otherwise 0. */
+static int parse_ranges(const char *str, wchar_t **list, size_t *count)
+{
+	const char *p = str;
+	size_t total = 0;
+
+	if (strncmp(str, "U+", 2))
+		return 1;
+
+	// Check the list and size it
+	while (*p) {
+		wchar_t first, last;
+
+		p = parse_codepoint(p, &first);
+		last = first;
+		if (p && *p == '-')
+			p = parse_codepoint(p + 1, &last);
+		if (p == NULL || last < first || (*p && *p != ',') ||
+		    (*p == ',' && p[1] == '\0')) {
+			fprintf(stderr, "ERROR: Invalid character range list '%s'.\n", str);
+			return -1;
+		}
+		total += last - first + 1;
+		if (*p)
+			p++;
+	}
+
+	wchar_t *l = calloc(total + 1, sizeof(wchar_t));
+	size_t n = 0;
+	for (p = str; *p; p += *p == ',') {
+		wchar_t first, last;
+
+		p = parse_codepoint(p, &first);
+		last = first;
+		if (*p == '-')
+			p = parse_codepoint(p + 1, &last);
+		for (wchar_t ch = first; ch <= last; ch++)
+			l[n++] = ch;
+	}
+
+	// Ranges may overlap
+	qsort(l, n, sizeof(wchar_t), cmp_char);
+	size_t unique = 0;
+	for (size_t i = 0; i < n; i++)
+		if (unique == 0 || l[unique - 1] != l[i])
+			l[unique++] = l[i];
+	l[unique] = 0;
+
+	*list = l;
+	*count = unique;
+	return 0;
+}
+
+/** Expand the character list 'str', as given to --chars, into a sorted
+ * list: either the characters themselves, or ranges of the form
+ * "U+XXXX[-U+YYYY][,...]". Returns 1 for characters, 0 for ranges, and -1
+ * if the list can't be read. */
+int parse_char_list(const char *str, wchar_t **list, size_t *count)
+{
+	int literal = parse_ranges(str, list, count);
+
+	if (literal <= 0)
+		return literal;
+
+	size_t char_count = mbstowcs(NULL, str, 0);
+	if (char_count == (size_t)-1) {
+		perror("converting char list");
+		return -1;
+	}
+	*list = (wchar_t *)calloc(char_count + 1, sizeof(wchar_t));
+	char_count = mbstowcs(*list, str, char_count + 1);
+	qsort(*list, char_count, sizeof(wchar_t), cmp_char);
+	*count = char_count;
+	return 1;
+}
+
+// vim: set softtabstop=8 shiftwidth=8 tabstop=8:
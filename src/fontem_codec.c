@@ -0,0 +1,821 @@
+/**
+ * \file src/fontem_codec.c
+ *
+ * Encoders for the glyph bitmap codecs, and the choice of a codec for each
+ * glyph of a mixed font.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generator.h"
+#include "resource/fontem.h"
+
+/** Longest run of rows; see FONT_CODEC_ROWS */
+#define ROWS_MAX_RUN	255
+
+/** Largest rows dictionary that is searched for each new row; beyond this,
+ * rows only share what they overlap with the end of the dictionary */
+#define ROWS_SEARCH	65536
+
+/** Longest Huffman code; see FONT_CODEC_HUFFMAN */
+#define HUFFMAN_MAX_BITS 15
+
+/** Rounds of refinement of a palette */
+#define PALETTE_ROUNDS 16
+
+/** Names of the codecs, as given to --codec, and as they follow FONT_CODEC_
+ * in the output */
+static const struct {
+	const char *name;
+	const char *macro;
+} codecs[] = {
+	[FONT_CODEC_RAW]	= { "raw",	"RAW"	  },
+	[FONT_CODEC_RLE]	= { "rle",	"RLE"	  },
+	[FONT_CODEC_PAL4]	= { "pal4",	"PAL4"	  },
+	[FONT_CODEC_PAL16]	= { "pal16",	"PAL16"	  },
+	[FONT_CODEC_LZ]		= { "lz",	"LZ"	  },
+	[FONT_CODEC_HUFFMAN]	= { "huffman",	"HUFFMAN" },
+	[FONT_CODEC_MIXED]	= { "mixed",	"MIXED"	  },
+	[FONT_CODEC_ROWS]	= { "rows",	"ROWS"	  },
+	[FONT_CODEC_BPP1]	= { "bpp1",	"BPP1"	  },
+	[FONT_CODEC_BPP2]	= { "bpp2",	"BPP2"	  },
+	[FONT_CODEC_BPP4]	= { "bpp4",	"BPP4"	  },
+	[FONT_CODEC_SPANS]	= { "spans",	"SPANS"	  },
+};
+
+/** Codecs a mixed font chooses between, from the quickest to decode */
+static const int mixed_codecs[] = {
+	FONT_CODEC_RAW, FONT_CODEC_RLE, FONT_CODEC_LZ, FONT_CODEC_HUFFMAN,
+};
+#define MIXED_CODECS (sizeof(mixed_codecs) / sizeof(mixed_codecs[0]))
+
+/** Rough relative cost of decoding a pixel with each of 'mixed_codecs' */
+static const unsigned int decode_cost[MIXED_CODECS] = { 1, 2, 3, 6 };
+
+/** Return the codec called 'name', or -1. */
+int codec_id(const char *name)
+{
+	for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++)
+		if (!strcmp(name, codecs[i].name))
+			return i;
+	return -1;
+}
+
+/** Return the name of the FONT_CODEC_ constant for 'codec', without the
+ * prefix, or NULL if there is no such codec. */
+const char *codec_macro(int codec)
+{
+	if (codec < 0 || (size_t)codec >= sizeof(codecs) / sizeof(codecs[0]))
+		return NULL;
+	return codecs[codec].macro;
+}
+
+/** A growable output buffer */
+struct out {
+	uint8_t *data;
+	size_t	length;
+	size_t	alloc;
+};
+
+static void out8(struct out *o, unsigned int v)
+{
+	if (o->length == o->alloc) {
+		o->alloc = o->alloc ? o->alloc * 2 : 64;
+		o->data = realloc(o->data, o->alloc);
+	}
+	o->data[o->length++] = v;
+}
+
+/** Replace the bitmap of 'gd' with what is in 'o'. */
+static void replace_bitmap(struct glyph_data *gd, struct out *o)
+{
+	free(gd->bitmap);
+	gd->bitmap = o->data;
+	gd->length = o->length;
+	gd->line = 16;
+}
+
+static inline char get_class(unsigned char c)
+{
+	if (c == 0)
+		return 1;
+	else if (c == 0xff)
+		return 2;
+	else
+		return 3;
+}
+
+/** Return the FONT_CODEC_RLE encoding of the 'length' bytes at 'data', and
+ * set 'length' to its length. */
+unsigned char *rle_compress(const unsigned char *data, size_t *length)
+{
+	size_t in_length = *length, out_length = 0;
+	unsigned char *result = (unsigned char *)malloc(2 * in_length);
+	unsigned char class = 0, count = 0;
+
+	for (size_t i = 0; i <= in_length; i++) {
+		unsigned char c_class = (i == in_length ? 0 : get_class(data[i]));
+
+		if (((count > 0) && (class != c_class)) || (count >= 0x40)) {
+			if (class == 3) {
+				result[out_length] = count - 1;
+				out_length++;
+
+				memcpy(result + out_length, data + i - count, count);
+				out_length += count;
+			} else {
+				result[out_length] = (class == 1 ? 0x80 : 0xc0) + count - 1;
+				out_length++;
+			}
+			count = 0;
+		}
+		class = c_class;
+		count++;
+	}
+
+	*length = out_length;
+	return result;
+}
+
+/** Count how often each coverage value occurs in the font. */
+static void histogram(const struct font_data *fd, size_t *hist)
+{
+	memset(hist, 0, 256 * sizeof(size_t));
+	for (size_t i = 0; i < fd->count; i++)
+		for (size_t j = 0; j < fd->glyphs[i].length; j++)
+			hist[fd->glyphs[i].bitmap[j]]++;
+}
+
+static unsigned int nearest(const uint8_t *palette, unsigned int levels, unsigned int v)
+{
+	unsigned int best = 0;
+
+	for (unsigned int l = 1; l < levels; l++)
+		if (abs((int)palette[l] - (int)v) < abs((int)palette[best] - (int)v))
+			best = l;
+	return best;
+}
+
+/** Choose 'levels' coverage values for the font by refining an even spread
+ * towards the values the font actually uses (Lloyd's algorithm). Fully
+ * clear and fully covered stay exact, as most pixels are one or the other. */
+static void choose_palette(const struct font_data *fd, unsigned int levels, uint8_t *palette)
+{
+	size_t hist[256];
+
+	histogram(fd, hist);
+	for (unsigned int l = 0; l < levels; l++)
+		palette[l] = l * 255 / (levels - 1);
+
+	for (int round = 0; round < PALETTE_ROUNDS; round++) {
+		size_t sum[16] = { 0 }, n[16] = { 0 };
+
+		for (unsigned int v = 0; v < 256; v++) {
+			unsigned int l = nearest(palette, levels, v);
+			sum[l] += hist[v] * v;
+			n[l] += hist[v];
+		}
+		for (unsigned int l = 1; l < levels - 1; l++)
+			if (n[l])
+				palette[l] = (sum[l] + n[l] / 2) / n[l];
+	}
+}
+
+/** Quantize to the palette and encode runs of one level. */
+static void encode_pal(struct glyph_data *gd, const uint8_t *palette, unsigned int levels)
+{
+	unsigned int shift = levels == 4 ? 6 : 4;
+	unsigned int max_run = 1 << shift;
+	struct out o = { 0 };
+
+	for (size_t i = 0; i < gd->length;) {
+		unsigned int level = nearest(palette, levels, gd->bitmap[i]);
+		unsigned int run = 1;
+
+		while (i + run < gd->length && run < max_run &&
+		       nearest(palette, levels, gd->bitmap[i + run]) == level)
+			run++;
+		out8(&o, level << shift | (run - 1));
+		i += run;
+	}
+	replace_bitmap(gd, &o);
+}
+
+/** Quantize to the 2^depth levels of FONT_CODEC_BPP1 and the like, and
+ * pack 'depth' bits per pixel, starting each row on a byte. */
+static void encode_packed(struct glyph_data *gd, unsigned int depth)
+{
+	unsigned int max = (1 << depth) - 1;
+	struct out o = { 0 };
+
+	for (unsigned int y = 0; y < gd->rows; y++) {
+		const uint8_t *row = gd->bitmap + (size_t)y * gd->cols;
+		unsigned int bits = 0, nbits = 0;
+
+		for (unsigned int x = 0; x < gd->cols; x++) {
+			bits = bits << depth | (row[x] * max + 127) / 255;
+			nbits += depth;
+			if (nbits == 8) {
+				out8(&o, bits);
+				bits = nbits = 0;
+			}
+		}
+		if (nbits)
+			out8(&o, bits << (8 - nbits));
+	}
+	replace_bitmap(gd, &o);
+}
+
+/** Most spans of a row before another count; see FONT_CODEC_SPANS */
+#define SPANS_MAX	255
+
+/** Split each row into spans of clear, edge and opaque pixels, each part
+ * at most 255 long. Clear pixels at the end of a row need no span. */
+static void encode_spans(struct glyph_data *gd)
+{
+	struct out o = { 0 }, spans = { 0 };
+
+	for (unsigned int y = 0; y < gd->rows; y++) {
+		const uint8_t *row = gd->bitmap + (size_t)y * gd->cols;
+		unsigned int end = gd->cols;
+		size_t count = 0;
+
+		while (end && row[end - 1] == 0)
+			end--;
+
+		// The spans are gathered first, as the row starts with their number
+		spans.length = 0;
+		for (unsigned int x = 0; x < end; count++) {
+			unsigned int skip = 0, edges = 0, fill = 0;
+
+			while (x + skip < end && row[x + skip] == 0 && skip < 255)
+				skip++;
+			x += skip;
+			while (x + edges < end && row[x + edges] != 0 && row[x + edges] != 0xff &&
+			       edges < 255)
+				edges++;
+			out8(&spans, skip);
+			out8(&spans, edges);
+			for (unsigned int e = 0; e < edges; e++)
+				out8(&spans, row[x++]);
+			while (x < end && row[x] == 0xff && fill < 255) {
+				fill++;
+				x++;
+			}
+			out8(&spans, fill);
+		}
+
+		const uint8_t *span = spans.data;
+		for (;;) {
+			size_t n = count < SPANS_MAX ? count : SPANS_MAX;
+
+			out8(&o, n);
+			for (size_t s = 0; s < n; s++) {
+				size_t length = 3 + span[1];
+
+				for (size_t b = 0; b < length; b++)
+					out8(&o, span[b]);
+				span += length;
+			}
+			count -= n;
+			if (n < SPANS_MAX)
+				break;
+		}
+	}
+	free(spans.data);
+	replace_bitmap(gd, &o);
+}
+
+/** Greedy LZ77: take the longest match within the window at each step,
+ * otherwise add to a run of literals. */
+static void encode_lz(struct glyph_data *gd)
+{
+	const uint8_t *in = gd->bitmap;
+	size_t n = gd->length, literals = 0;
+	struct out o = { 0 };
+
+	for (size_t i = 0; i <= n;) {
+		size_t best = 0, distance = 0;
+
+		for (size_t d = 1; i < n && d <= 255 && d <= i; d++) {
+			size_t len = 0;
+			while (i + len < n && len < 130 && in[i + len] == in[i + len - d])
+				len++;
+			if (len > best) {
+				best = len;
+				distance = d;
+			}
+		}
+
+		// Flush the pending literals before a match, when full, or at the end
+		if (literals && (best >= 3 || literals == 128 || i == n)) {
+			out8(&o, literals - 1);
+			for (size_t j = i - literals; j < i; j++)
+				out8(&o, in[j]);
+			literals = 0;
+		}
+		if (i == n)
+			break;
+
+		if (best >= 3) {
+			out8(&o, 0x80 | (best - 3));
+			out8(&o, distance);
+			i += best;
+		} else {
+			literals++;
+			i++;
+		}
+	}
+	replace_bitmap(gd, &o);
+}
+
+/** Work out Huffman code lengths for the values in 'hist', no longer than
+ * HUFFMAN_MAX_BITS; rare values are made more common until they fit. */
+static void huffman_lengths(const size_t *hist, uint8_t *lengths)
+{
+	size_t weight[512];
+	int parent[512];
+
+	for (int scale = 0;; scale++) {
+		int nodes = 0, used = 0;
+
+		for (int v = 0; v < 256; v++) {
+			weight[v] = hist[v] ? (hist[v] >> scale) + 1 : 0;
+			parent[v] = -1;
+			if (hist[v])
+				used++;
+		}
+		nodes = 256;
+
+		// Repeatedly join the two lightest parentless nodes
+		for (int joins = 0; joins < used - 1; joins++) {
+			int a = -1, b = -1;
+
+			for (int k = 0; k < nodes; k++) {
+				if (weight[k] == 0 || parent[k] != -1)
+					continue;
+				if (a == -1 || weight[k] < weight[a]) {
+					b = a;
+					a = k;
+				} else if (b == -1 || weight[k] < weight[b]) {
+					b = k;
+				}
+			}
+			weight[nodes] = weight[a] + weight[b];
+			parent[nodes] = -1;
+			parent[a] = parent[b] = nodes;
+			nodes++;
+		}
+
+		int longest = 0;
+		for (int v = 0; v < 256; v++) {
+			lengths[v] = 0;
+			if (hist[v] == 0)
+				continue;
+			for (int k = v; parent[k] != -1; k = parent[k])
+				lengths[v]++;
+			if (lengths[v] == 0)
+				lengths[v] = 1;
+			if (lengths[v] > longest)
+				longest = lengths[v];
+		}
+		if (longest <= HUFFMAN_MAX_BITS)
+			break;
+	}
+
+	// 256 codes of 8 bits would overflow the count; trade one for two longer
+	int eights = 0;
+	for (int v = 0; v < 256; v++)
+		eights += lengths[v] == 8;
+	if (eights == 256) {
+		lengths[0] = 7;
+		lengths[254] = lengths[255] = 9;
+	}
+}
+
+/** Build the canonical code for 'lengths': the table stored with the font,
+ * and the code for each value. */
+static void huffman_codes(const uint8_t *lengths, struct out *table, uint16_t *codes)
+{
+	unsigned int counts[HUFFMAN_MAX_BITS + 1] = { 0 };
+
+	for (int v = 0; v < 256; v++)
+		counts[lengths[v]]++;
+	counts[0] = 0;
+	for (int len = 0; len <= HUFFMAN_MAX_BITS; len++)
+		out8(table, counts[len]);
+
+	unsigned int code = 0;
+	for (int len = 1; len <= HUFFMAN_MAX_BITS; len++) {
+		for (int v = 0; v < 256; v++) {
+			if (lengths[v] == len) {
+				codes[v] = code++;
+				out8(table, v);
+			}
+		}
+		code <<= 1;
+	}
+}
+
+static void encode_huffman(struct glyph_data *gd, const uint8_t *lengths, const uint16_t *codes)
+{
+	struct out o = { 0 };
+	unsigned int bits = 0, nbits = 0;
+
+	for (size_t i = 0; i < gd->length; i++) {
+		uint8_t v = gd->bitmap[i];
+
+		for (int b = lengths[v] - 1; b >= 0; b--) {
+			bits = bits << 1 | ((codes[v] >> b) & 1);
+			if (++nbits == 8) {
+				out8(&o, bits);
+				bits = nbits = 0;
+			}
+		}
+	}
+	if (nbits)
+		out8(&o, bits << (8 - nbits));
+	replace_bitmap(gd, &o);
+}
+
+/** A distinct row of a FONT_CODEC_ROWS dictionary */
+struct dict_row {
+	const uint8_t	*data;          /** The row, in a glyph's raw bitmap */
+	unsigned int	length;         /** Length of the row */
+	size_t		offset;         /** Offset of the row in the table */
+};
+
+/** Find the row 'data' in the dictionary, adding it if it is new. 'slots'
+ * is an open-addressed hash table of 'size' (a power of two) indices into
+ * 'rows', plus one. Returns the index of the row. */
+static size_t dict_find(struct dict_row *rows, size_t *count, size_t *slots, size_t size,
+			const uint8_t *data, unsigned int length)
+{
+	uint64_t hash = HASH_INIT;
+
+	hash_data(&hash, data, length);
+	for (size_t slot = hash & (size - 1);; slot = (slot + 1) & (size - 1)) {
+		if (slots[slot] == 0) {
+			rows[*count].data = data;
+			rows[*count].length = length;
+			slots[slot] = ++*count;
+			return *count - 1;
+		}
+
+		const struct dict_row *row = &rows[slots[slot] - 1];
+		if (row->length == length && !memcmp(row->data, data, length))
+			return slots[slot] - 1;
+	}
+}
+
+/** Order rows longest first, then as they were found. */
+static int cmp_dict_row(const void *p1, const void *p2)
+{
+	const struct dict_row *r1 = *(const struct dict_row **)p1;
+	const struct dict_row *r2 = *(const struct dict_row **)p2;
+
+	if (r1->length != r2->length)
+		return r1->length > r2->length ? -1 : 1;
+	return r1 < r2 ? -1 : 1;
+}
+
+/** Place 'row' in the dictionary 'dict': where it already appears, or else
+ * at the end, overlapping whatever of its start the dictionary ends with. */
+static void dict_place(struct out *dict, struct dict_row *row)
+{
+	if (dict->length <= ROWS_SEARCH) {
+		for (size_t at = 0; at + row->length <= dict->length; at++) {
+			if (!memcmp(dict->data + at, row->data, row->length)) {
+				row->offset = at;
+				return;
+			}
+		}
+	}
+
+	size_t overlap = row->length < dict->length ? row->length : dict->length;
+	while (overlap &&
+	       memcmp(dict->data + dict->length - overlap, row->data, overlap))
+		overlap--;
+	row->offset = dict->length - overlap;
+	for (unsigned int x = overlap; x < row->length; x++)
+		out8(dict, row->data[x]);
+}
+
+/** Replace each glyph's rows with references into a dictionary of the
+ * distinct rows of the font, which becomes the codec table. Shorter rows
+ * are placed after longer ones, so that they can be found inside them. */
+static void encode_rows(struct font_data *fd, struct out *table)
+{
+	size_t total = 0, count = 0, size = 1;
+
+	for (size_t i = 0; i < fd->count; i++)
+		if (fd->glyphs[i].bitmap)
+			total += fd->glyphs[i].rows;
+	while (size < 2 * total)
+		size <<= 1;
+
+	struct dict_row *rows = calloc(total + 1, sizeof(*rows));
+	size_t *slots = calloc(size, sizeof(size_t));
+	size_t *index = calloc(total + 1, sizeof(size_t));
+
+	// The dictionary is built from the glyphs' raw bitmaps, so is done
+	// before any glyph is encoded
+	for (size_t i = 0, n = 0; i < fd->count; i++) {
+		const struct glyph_data *gd = &fd->glyphs[i];
+
+		if (gd->bitmap == NULL)
+			continue;
+		for (unsigned int y = 0; y < gd->rows; y++)
+			index[n++] = dict_find(rows, &count, slots, size,
+					       gd->bitmap + (size_t)y * gd->cols, gd->cols);
+	}
+	free(slots);
+
+	struct dict_row **order = calloc(count + 1, sizeof(*order));
+	struct out dict = { 0 };
+
+	for (size_t r = 0; r < count; r++)
+		order[r] = &rows[r];
+	qsort(order, count, sizeof(*order), cmp_dict_row);
+	for (size_t r = 0; r < count; r++)
+		dict_place(&dict, order[r]);
+	free(order);
+
+	// Entries are as wide as the largest offset needs; offsets count the
+	// byte of the width that starts the table
+	unsigned int width = 2;
+	while (width < 4 && (dict.length + 1) >> (8 * width - 1))
+		width++;
+
+	out8(table, width);
+	for (size_t x = 0; x < dict.length; x++)
+		out8(table, dict.data[x]);
+	free(dict.data);
+
+	for (size_t i = 0, n = 0; i < fd->count; i++) {
+		struct glyph_data *gd = &fd->glyphs[i];
+		struct out o = { 0 };
+
+		if (gd->bitmap == NULL)
+			continue;
+		for (unsigned int y = 0; y < gd->rows;) {
+			unsigned int run = 1;
+
+			while (y + run < gd->rows && run < ROWS_MAX_RUN &&
+			       index[n + run] == index[n])
+				run++;
+
+			uint32_t entry = (uint32_t)(rows[index[n]].offset + 1) << 1 | (run > 1);
+			for (unsigned int b = 0; b < width; b++)
+				out8(&o, entry >> (8 * b));
+			if (run > 1)
+				out8(&o, run - 2);
+			y += run;
+			n += run;
+		}
+		replace_bitmap(gd, &o);
+	}
+	free(rows);
+	free(index);
+}
+
+/** Encode a copy of the raw bitmap of 'gd' into 'out' with 'codec'. */
+static void encode_copy(const struct glyph_data *gd, int codec,
+			const uint8_t *lengths, const uint16_t *codes,
+			struct glyph_data *out)
+{
+	*out = *gd;
+	out->codec = codec;
+	if (codec == FONT_CODEC_RLE) {
+		out->bitmap = rle_compress(gd->bitmap, &out->length);
+		out->line = 16;
+		return;
+	}
+
+	out->bitmap = malloc(gd->length);
+	memcpy(out->bitmap, gd->bitmap, gd->length);
+	if (codec == FONT_CODEC_LZ)
+		encode_lz(out);
+	else if (codec == FONT_CODEC_HUFFMAN)
+		encode_huffman(out, lengths, codes);
+}
+
+/** A step to a smaller, slower encoding of one glyph of a mixed font */
+struct mixed_step {
+	size_t	glyph;          /** Index of the glyph */
+	size_t	order;          /** Order of the steps, to break ties */
+	int	choice;         /** Index in 'mixed_codecs' to step to */
+	size_t	saved;          /** Bytes saved */
+	size_t	cost;           /** Decoding cost added */
+};
+
+/** Order steps by bytes saved per cost added, best first. */
+static int cmp_mixed_step(const void *p1, const void *p2)
+{
+	const struct mixed_step *s1 = p1, *s2 = p2;
+	unsigned long long r1 = (unsigned long long)s1->saved * s2->cost;
+	unsigned long long r2 = (unsigned long long)s2->saved * s1->cost;
+
+	if (r1 != r2)
+		return r1 > r2 ? -1 : 1;
+	return s1->order < s2->order ? -1 : 1;
+}
+
+/** Choose a codec for each glyph from 'mixed_codecs'. For OPTIMIZE_SIZE
+ * each glyph takes its smallest encoding. For OPTIMIZE_SPEED every glyph
+ * starts raw, and the steps to smaller encodings that save the most bytes
+ * for the decoding they add are taken until the font fits 'budget'. The
+ * steps of a glyph follow the lower convex hull of its size against its
+ * cost, so taking the best steps first takes each glyph's in order.
+ * Returns non-zero if the font cannot fit the budget. */
+static int choose_mixed(struct font_data *fd, int optimize, size_t budget)
+{
+	struct glyph_data (*cand)[MIXED_CODECS] = calloc(fd->count + 1, sizeof(*cand));
+	int *choice = calloc(fd->count + 1, sizeof(int));
+	struct out table = { 0 };
+	uint8_t lengths[256];
+	uint16_t codes[256];
+	size_t hist[256];
+
+	histogram(fd, hist);
+	huffman_lengths(hist, lengths);
+	huffman_codes(lengths, &table, codes);
+
+	// One byte per glyph says which codec it uses
+	size_t total = fd->count, huffman = 0;
+
+	for (size_t i = 0; i < fd->count; i++) {
+		const struct glyph_data *gd = &fd->glyphs[i];
+
+		if (gd->bitmap == NULL)
+			continue;
+		for (size_t k = 0; k < MIXED_CODECS; k++)
+			encode_copy(gd, mixed_codecs[k], lengths, codes, &cand[i][k]);
+		if (optimize == OPTIMIZE_SIZE)
+			for (size_t k = 1; k < MIXED_CODECS; k++)
+				if (cand[i][k].length < cand[i][choice[i]].length)
+					choice[i] = k;
+		total += cand[i][choice[i]].length;
+		huffman += mixed_codecs[choice[i]] == FONT_CODEC_HUFFMAN;
+	}
+	if (huffman)
+		total += table.length;
+
+	if (optimize == OPTIMIZE_SPEED && total > budget) {
+		struct mixed_step *steps = calloc(fd->count * MIXED_CODECS + 1, sizeof(*steps));
+		size_t n = 0;
+
+		for (size_t i = 0; i < fd->count; i++) {
+			if (fd->glyphs[i].bitmap == NULL)
+				continue;
+
+			size_t pixels = (size_t)fd->glyphs[i].cols * fd->glyphs[i].rows;
+			for (size_t cur = 0;;) {
+				size_t best = 0;
+
+				for (size_t k = cur + 1; k < MIXED_CODECS; k++) {
+					if (cand[i][k].length >= cand[i][cur].length)
+						continue;
+					struct mixed_step step = {
+						.saved = cand[i][cur].length - cand[i][k].length,
+						.cost = pixels * (decode_cost[k] - decode_cost[cur]),
+					};
+					if (best == 0 || cmp_mixed_step(&step, &steps[n]) < 0) {
+						steps[n] = step;
+						best = k;
+					}
+				}
+				if (best == 0)
+					break;
+				steps[n].glyph = i;
+				steps[n].order = n;
+				steps[n].choice = best;
+				n++;
+				cur = best;
+			}
+		}
+
+		qsort(steps, n, sizeof(*steps), cmp_mixed_step);
+		for (size_t j = 0; j < n && total > budget; j++) {
+			if (mixed_codecs[steps[j].choice] == FONT_CODEC_HUFFMAN && huffman++ == 0)
+				total += table.length;
+			total -= steps[j].saved;
+			choice[steps[j].glyph] = steps[j].choice;
+		}
+		free(steps);
+	}
+
+	for (size_t i = 0; i < fd->count; i++) {
+		if (fd->glyphs[i].bitmap == NULL) {
+			fd->glyphs[i].codec = FONT_CODEC_RAW;
+			continue;
+		}
+		free(fd->glyphs[i].bitmap);
+		for (size_t k = 0; k < MIXED_CODECS; k++)
+			if ((int)k != choice[i])
+				free(cand[i][k].bitmap);
+		fd->glyphs[i] = cand[i][choice[i]];
+	}
+	free(cand);
+	free(choice);
+
+	if (huffman) {
+		fd->codec_data = table.data;
+		fd->codec_data_length = table.length;
+	} else {
+		free(table.data);
+	}
+
+	if (total > budget) {
+		fprintf(stderr, "ERROR: The font needs %zu bytes, over the budget of %zu.\n",
+			total, budget);
+		return 1;
+	}
+	return 0;
+}
+
+/** Encode the raw bitmaps of 'fd' with 'codec', and set up the codec table
+ * that goes with them. Raw and RLE bitmaps are encoded as they are rendered,
+ * so are left alone. A mixed font chooses the codec of each glyph for
+ * 'optimize'. Returns non-zero if the bitmaps do not fit in 'budget' bytes. */
+int encode_glyphs(struct font_data *fd, int codec, int optimize, size_t budget)
+{
+	struct out table = { 0 };
+	uint8_t lengths[256];
+	uint16_t codes[256];
+	size_t hist[256];
+
+	fd->codec = codec;
+	for (size_t i = 0; i < fd->count; i++)
+		fd->glyphs[i].codec = codec;
+
+	switch (codec) {
+	case FONT_CODEC_PAL4:
+	case FONT_CODEC_PAL16:
+		table.length = codec == FONT_CODEC_PAL4 ? 4 : 16;
+		table.data = malloc(table.length);
+		choose_palette(fd, table.length, table.data);
+		for (size_t i = 0; i < fd->count; i++)
+			if (fd->glyphs[i].bitmap)
+				encode_pal(&fd->glyphs[i], table.data, table.length);
+		break;
+
+	case FONT_CODEC_LZ:
+		for (size_t i = 0; i < fd->count; i++)
+			if (fd->glyphs[i].bitmap)
+				encode_lz(&fd->glyphs[i]);
+		break;
+
+	case FONT_CODEC_HUFFMAN:
+		histogram(fd, hist);
+		huffman_lengths(hist, lengths);
+		huffman_codes(lengths, &table, codes);
+		for (size_t i = 0; i < fd->count; i++)
+			if (fd->glyphs[i].bitmap)
+				encode_huffman(&fd->glyphs[i], lengths, codes);
+		break;
+
+	case FONT_CODEC_MIXED:
+		return choose_mixed(fd, optimize, budget);
+
+	case FONT_CODEC_ROWS:
+		encode_rows(fd, &table);
+		break;
+
+	case FONT_CODEC_BPP1:
+	case FONT_CODEC_BPP2:
+	case FONT_CODEC_BPP4:
+		for (size_t i = 0; i < fd->count; i++)
+			if (fd->glyphs[i].bitmap)
+				encode_packed(&fd->glyphs[i], 1 << (codec - FONT_CODEC_BPP1));
+		break;
+
+	case FONT_CODEC_SPANS:
+		for (size_t i = 0; i < fd->count; i++)
+			if (fd->glyphs[i].bitmap)
+				encode_spans(&fd->glyphs[i]);
+		break;
+	}
+
+	fd->codec_data = table.data;
+	fd->codec_data_length = table.length;
+
+	size_t total = fd->codec_data_length;
+	for (size_t i = 0; i < fd->count; i++)
+		total += fd->glyphs[i].length;
+	if (total > budget) {
+		fprintf(stderr, "ERROR: The font needs %zu bytes, over the budget of %zu.\n",
+			total, budget);
+		return 1;
+	}
+	return 0;
+}
+
+// vim: set softtabstop=8 shiftwidth=8 tabstop=8:
@@ -0,0 +1,64 @@
+/**
+ * \file src/fontem_dedup.c
+ *
+ * Finds glyphs whose encoded bitmaps are identical, so that each distinct
+ * bitmap is stored only once.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generator.h"
+
+static int same_bitmap(const struct glyph_data *a, const struct glyph_data *b)
+{
+	return a->length == b->length && !memcmp(a->bitmap, b->bitmap, a->length);
+}
+
+/** Point the 'same' field of every glyph of 'fd' whose bitmap matches one
+ * seen earlier in the font at that glyph. Bitmaps are addressed by their
+ * content hash in an open-addressed table. Returns the number of bytes that
+ * no longer need to be stored, and the number of shared bitmaps in 'dups'. */
+size_t dedup_bitmaps(struct font_data *fd, size_t *dups)
+{
+	size_t size = 1, saved = 0;
+
+	while (size < fd->count * 2)
+		size <<= 1;
+
+	const struct glyph_data **table = calloc(size, sizeof(*table));
+	*dups = 0;
+
+	for (size_t i = 0; i < fd->count; i++) {
+		struct glyph_data *gd = &fd->glyphs[i];
+
+		gd->same = NULL;
+		if (gd->bitmap == NULL)
+			continue;
+
+		uint64_t hash = HASH_INIT;
+		hash_data(&hash, gd->bitmap, gd->length);
+
+		size_t slot = hash & (size - 1);
+		while (table[slot] && !same_bitmap(table[slot], gd))
+			slot = (slot + 1) & (size - 1);
+
+		if (table[slot]) {
+			gd->same = table[slot];
+			saved += gd->length;
+			(*dups)++;
+		} else {
+			table[slot] = gd;
+		}
+	}
+
+	free(table);
+	return saved;
+}
+
+// vim: set softtabstop=8 shiftwidth=8 tabstop=8:
@@ -0,0 +1,329 @@
+/**
+ * \file src/fontem_kern.c
+ *
+ * Groups the kerning pairs of a font into left and right classes, so that
+ * the offsets fit in a small matrix indexed by the classes of two glyphs.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_TRUETYPE_TABLES_H
+#include FT_TRUETYPE_TAGS_H
+
+#include "generator.h"
+
+/** Most characters for which every pair is asked for its kerning */
+#define KERN_QUERY_MAX 1024
+
+/** A kerning pair, as indices into the character list. */
+struct kern_pair {
+	size_t	left;
+	size_t	right;
+	int	offset;
+};
+
+static int cmp_kern_pair(const void *p1, const void *p2)
+{
+	const struct kern_pair *a = p1, *b = p2;
+
+	if (a->left != b->left)
+		return a->left < b->left ? -1 : 1;
+	if (a->right != b->right)
+		return a->right < b->right ? -1 : 1;
+	return 0;
+}
+
+/** Map from a FreeType glyph index to an index in the character list. */
+struct gid_map {
+	FT_UInt gid;
+	size_t	idx;
+};
+
+static int cmp_gid_map(const void *p1, const void *p2)
+{
+	const struct gid_map *a = p1, *b = p2;
+
+	if (a->gid != b->gid)
+		return a->gid < b->gid ? -1 : 1;
+	return a->idx < b->idx ? -1 : (a->idx > b->idx);
+}
+
+/** Find the first entry in 'map' for 'gid'; returns 'count' if none. */
+static size_t gid_map_find(const struct gid_map *map, size_t count, FT_UInt gid)
+{
+	size_t first = 0, last = count;
+
+	while (first < last) {
+		size_t mid = first + (last - first) / 2;
+		if (gid <= map[mid].gid)
+			last = mid;
+		else
+			first = mid + 1;
+	}
+	return (last < count && map[last].gid == gid) ? last : count;
+}
+
+static inline unsigned int be16(const FT_Byte *p)
+{
+	return ((unsigned int)p[0] << 8) | p[1];
+}
+
+/** Append the pair (left, right) if the kerning between them is non-zero. */
+static void add_kern_pair(FT_Face face, FT_UInt left_gid, FT_UInt right_gid,
+			  size_t left, size_t right,
+			  struct kern_pair **pairs, size_t *count, size_t *alloc)
+{
+	FT_Vector kern;
+
+	if (FT_Get_Kerning(face, left_gid, right_gid, FT_KERNING_DEFAULT, &kern) || kern.x == 0)
+		return;
+
+	if (*count == *alloc) {
+		*alloc = *alloc ? *alloc * 2 : 256;
+		*pairs = realloc(*pairs, *alloc * sizeof(struct kern_pair));
+	}
+	(*pairs)[*count].left = left;
+	(*pairs)[*count].right = right;
+	(*pairs)[*count].offset = (int)kern.x / 64;
+	(*count)++;
+}
+
+/** Find the kerning pairs between characters in the list by walking the
+ * format 0 subtables of the 'kern' table; this is linear in the number of
+ * pairs the font defines. Fonts without such a table fall back to
+ * querying every combination of characters, as long as there are few
+ * enough of them. The result is sorted. */
+static struct kern_pair *find_kern_pairs(FT_Face face, const wchar_t *char_list,
+					 size_t char_count, size_t *pair_count)
+{
+	struct gid_map *map = calloc(char_count + 1, sizeof(struct gid_map));
+	struct kern_pair *pairs = NULL;
+	size_t count = 0, alloc = 0;
+	FT_ULong length = 0;
+	FT_Byte *kern = NULL;
+	int parsed = 0;
+
+	for (size_t i = 0; i < char_count; i++) {
+		map[i].gid = FT_Get_Char_Index(face, char_list[i]);
+		map[i].idx = i;
+	}
+	qsort(map, char_count, sizeof(struct gid_map), cmp_gid_map);
+
+	if (FT_IS_SFNT(face) && !FT_Load_Sfnt_Table(face, TTAG_kern, 0, NULL, &length) &&
+	    length >= 4) {
+		kern = malloc(length);
+		if (FT_Load_Sfnt_Table(face, TTAG_kern, 0, kern, &length) == 0 && be16(kern) == 0)
+			parsed = 1;
+	}
+
+	if (parsed) {
+		const FT_Byte *p = kern + 4, *end = kern + length;
+		unsigned int tables = be16(kern + 2);
+
+		for (unsigned int t = 0; t < tables && p + 14 <= end; t++) {
+			unsigned int coverage = be16(p + 4);
+			unsigned int pairs_in_table = be16(p + 6);
+			const FT_Byte *q = p + 14;
+
+			// Subtable lengths overflow for big tables; trust the pair count
+			if (q + pairs_in_table * 6 > end)
+				pairs_in_table = (end - q) / 6;
+			p = q + pairs_in_table * 6;
+
+			// Only format 0, horizontal, non-minimum, non-cross-stream
+			if ((coverage >> 8) != 0 || (coverage & 0x07) != 0x01)
+				continue;
+
+			for (unsigned int i = 0; i < pairs_in_table; i++, q += 6) {
+				FT_UInt left_gid = be16(q), right_gid = be16(q + 2);
+				size_t l = gid_map_find(map, char_count, left_gid);
+				size_t r0 = gid_map_find(map, char_count, right_gid);
+
+				for (; l < char_count && map[l].gid == left_gid; l++)
+					for (size_t r = r0; r < char_count && map[r].gid == right_gid; r++)
+						add_kern_pair(face, left_gid, right_gid, map[l].idx, map[r].idx,
+							      &pairs, &count, &alloc);
+			}
+		}
+	} else if (char_count > KERN_QUERY_MAX) {
+		fprintf(stderr, "WARNING: Too many characters to query every kerning pair; "
+			"kerning dropped.\n");
+	} else {
+		for (size_t l = 0; l < char_count; l++)
+			for (size_t r = 0; r < char_count; r++)
+				add_kern_pair(face, map[l].gid, map[r].gid, map[l].idx, map[r].idx,
+					      &pairs, &count, &alloc);
+	}
+
+	// Pairs may be listed by more than one subtable
+	qsort(pairs, count, sizeof(struct kern_pair), cmp_kern_pair);
+	size_t unique = 0;
+	for (size_t i = 0; i < count; i++)
+		if (unique == 0 || cmp_kern_pair(&pairs[unique - 1], &pairs[i]))
+			pairs[unique++] = pairs[i];
+
+	free(kern);
+	free(map);
+	*pair_count = unique;
+	return pairs;
+}
+
+/** A run of kerning pairs that share one side; used to group characters
+ * whose kerning behaviour is identical into one class. */
+struct kern_run {
+	size_t			idx;    /** Character index */
+	const struct kern_pair	*pairs; /** First pair in the run */
+	size_t			count;  /** Number of pairs in the run */
+};
+
+static int cmp_kern_run(const void *p1, const void *p2)
+{
+	const struct kern_run *a = p1, *b = p2;
+
+	for (size_t i = 0; i < a->count && i < b->count; i++) {
+		// The pairs of a run have their 'right' field set to the other side
+		if (a->pairs[i].right != b->pairs[i].right)
+			return a->pairs[i].right < b->pairs[i].right ? -1 : 1;
+		if (a->pairs[i].offset != b->pairs[i].offset)
+			return a->pairs[i].offset < b->pairs[i].offset ? -1 : 1;
+	}
+	if (a->count != b->count)
+		return a->count < b->count ? -1 : 1;
+	return 0;
+}
+
+/** Split 'pairs', sorted by 'left', into runs and give every distinct run
+ * a class id, starting at 1. Returns the number of classes including
+ * class 0, or -1 if that count wouldn't fit in a uint8_t. */
+static int assign_kern_classes(const struct kern_pair *pairs, size_t count, uint8_t *classes)
+{
+	struct kern_run *runs = malloc((count + 1) * sizeof(struct kern_run));
+	size_t run_count = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		if (i == 0 || pairs[i].left != pairs[i - 1].left) {
+			runs[run_count].idx = pairs[i].left;
+			runs[run_count].pairs = &pairs[i];
+			runs[run_count].count = 0;
+			run_count++;
+		}
+		runs[run_count - 1].count++;
+	}
+
+	qsort(runs, run_count, sizeof(struct kern_run), cmp_kern_run);
+
+	int class = 0;
+	for (size_t i = 0; i < run_count; i++) {
+		if (i == 0 || cmp_kern_run(&runs[i - 1], &runs[i]))
+			class++;
+		if (class >= UINT8_MAX)
+			break;
+		classes[runs[i].idx] = class;
+	}
+
+	free(runs);
+	return class >= UINT8_MAX ? -1 : class + 1;
+}
+
+/** Build left and right kerning classes and the class-pair matrix for the
+ * character list. Returns non-zero if the font can't be expressed in
+ * classes, in which case kerning should be dropped. */
+int build_kern_classes(FT_Face face, const wchar_t *char_list, size_t char_count,
+		       struct kern_classes *kc)
+{
+	size_t count;
+	struct kern_pair *pairs = find_kern_pairs(face, char_list, char_count, &count);
+
+	kc->left = calloc(char_count + 1, 1);
+	kc->right = calloc(char_count + 1, 1);
+
+	// Characters whose rows of (right, offset) are identical share a left class
+	kc->left_count = assign_kern_classes(pairs, count, kc->left);
+
+	// Then characters whose columns of (left class, offset) are identical
+	// share a right class; build the transposed pair list to find them
+	kc->right_count = -1;
+	if (kc->left_count > 0) {
+		struct kern_pair *columns = malloc((count + 1) * sizeof(struct kern_pair));
+		for (size_t i = 0; i < count; i++) {
+			columns[i].left = pairs[i].right;
+			columns[i].right = kc->left[pairs[i].left];
+			columns[i].offset = pairs[i].offset;
+		}
+		qsort(columns, count, sizeof(struct kern_pair), cmp_kern_pair);
+		size_t unique = 0;
+		for (size_t i = 0; i < count; i++)
+			if (unique == 0 || cmp_kern_pair(&columns[unique - 1], &columns[i]))
+				columns[unique++] = columns[i];
+		kc->right_count = assign_kern_classes(columns, unique, kc->right);
+		free(columns);
+	}
+
+	if (kc->left_count < 0 || kc->right_count < 0) {
+		fprintf(stderr, "WARNING: Too many kerning classes; kerning dropped.\n");
+		free(pairs);
+		return 1;
+	}
+
+	kc->matrix = calloc((size_t)kc->left_count * kc->right_count, 1);
+	for (size_t i = 0; i < count; i++) {
+		int offset = pairs[i].offset;
+		if (offset < INT8_MIN || offset > INT8_MAX) {
+			fprintf(stderr, "WARNING: Kerning offset %d clamped.\n", offset);
+			offset = offset < 0 ? INT8_MIN : INT8_MAX;
+		}
+		kc->matrix[kc->left[pairs[i].left] * kc->right_count + kc->right[pairs[i].right]] = offset;
+	}
+
+	free(pairs);
+	return 0;
+}
+
+/** Add 'part', the kerning classes of 'count' of the characters of a font,
+ * to 'kc', the classes of all of them; 'index' holds where each of those
+ * characters is in the font. The classes of 'part' only kern against each
+ * other. Returns non-zero, leaving 'kc' as it was, if the classes would no
+ * longer be counted in a uint8_t. */
+int merge_kern_classes(struct kern_classes *kc, const struct kern_classes *part,
+		       const size_t *index, size_t count)
+{
+	int left_count = kc->left_count + part->left_count - 1;
+	int right_count = kc->right_count + part->right_count - 1;
+
+	if (left_count > UINT8_MAX || right_count > UINT8_MAX)
+		return 1;
+
+	// The classes of 'part' follow those already in 'kc', and its block of
+	// the matrix goes below and to the right of theirs
+	int8_t *matrix = calloc((size_t)left_count * right_count, 1);
+	for (int l = 0; l < kc->left_count; l++)
+		memcpy(&matrix[l * right_count], &kc->matrix[l * kc->right_count],
+		       kc->right_count);
+	for (int l = 1; l < part->left_count; l++)
+		memcpy(&matrix[(kc->left_count + l - 1) * right_count + kc->right_count],
+		       &part->matrix[l * part->right_count + 1], part->right_count - 1);
+
+	for (size_t i = 0; i < count; i++) {
+		if (part->left[i])
+			kc->left[index[i]] = part->left[i] + kc->left_count - 1;
+		if (part->right[i])
+			kc->right[index[i]] = part->right[i] + kc->right_count - 1;
+	}
+
+	free(kc->matrix);
+	kc->matrix = matrix;
+	kc->left_count = left_count;
+	kc->right_count = right_count;
+	return 0;
+}
+
+// vim: set softtabstop=8 shiftwidth=8 tabstop=8:
@@ -0,0 +1,213 @@
+/**
+ * \file src/fontem_lookup.c
+ *
+ * Chooses and builds the index that font_get_glyph() uses to find the glyph
+ * for a character.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generator.h"
+#include "resource/fontem.h"
+
+/** Most ranges a range table may hold; a lookup scans them all, so they
+ * should fit in a cache line or two. */
+#define MAX_RANGES 8
+
+/** Names of the lookup types, as given to --lookup */
+static const char *lookup_names[] = {
+	[FONT_LOOKUP_SEARCH]	= "search",
+	[FONT_LOOKUP_DIRECT]	= "direct",
+	[FONT_LOOKUP_RANGES]	= "ranges",
+	[FONT_LOOKUP_PAGES]	= "pages",
+	[FONT_LOOKUP_EYTZINGER] = "eytzinger",
+};
+
+/** The same, as they follow FONT_LOOKUP_ in the output */
+static const char *lookup_macros[] = {
+	[FONT_LOOKUP_SEARCH]	= "SEARCH",
+	[FONT_LOOKUP_DIRECT]	= "DIRECT",
+	[FONT_LOOKUP_RANGES]	= "RANGES",
+	[FONT_LOOKUP_PAGES]	= "PAGES",
+	[FONT_LOOKUP_EYTZINGER] = "EYTZINGER",
+};
+
+/** Return the lookup type called 'name', LOOKUP_AUTO for "auto", or -1. */
+int lookup_type(const char *name)
+{
+	if (!strcmp(name, "auto"))
+		return LOOKUP_AUTO;
+	for (size_t i = 0; i < sizeof(lookup_names) / sizeof(lookup_names[0]); i++)
+		if (!strcmp(name, lookup_names[i]))
+			return i;
+	return -1;
+}
+
+/** Return the name of the FONT_LOOKUP_ constant for 'type', without the
+ * prefix, or NULL if there is no such type. */
+const char *lookup_macro(int type)
+{
+	if (type < 0 || (size_t)type >= sizeof(lookup_macros) / sizeof(lookup_macros[0]))
+		return NULL;
+	return lookup_macros[type];
+}
+
+static size_t count_ranges(const struct font_data *fd)
+{
+	size_t ranges = 0;
+
+	for (size_t i = 0; i < fd->count; i++)
+		if (i == 0 || fd->glyphs[i].ch != fd->glyphs[i - 1].ch + 1)
+			ranges++;
+	return ranges;
+}
+
+static size_t count_pages(const struct font_data *fd)
+{
+	size_t pages = 0;
+
+	for (size_t i = 0; i < fd->count; i++)
+		if (i == 0 || (fd->glyphs[i].ch >> 8) != (fd->glyphs[i - 1].ch >> 8))
+			pages++;
+	return pages;
+}
+
+/** Entries in the page table of 'fd'. */
+static size_t pages_length(const struct font_data *fd)
+{
+	return (fd->max >> 8) + 1 + count_pages(fd) * 256;
+}
+
+/** Largest offset a lookup table of 'fd' may hold */
+static size_t glyph_limit(const struct font_data *fd)
+{
+	return fd->glyph32 ? UINT32_MAX : GLYPH16_MAX;
+}
+
+/** Pick the lookup for the character set of 'fd'. A direct table is used
+ * where the set is dense enough that it costs little more than the
+ * character codes themselves, then a short range table, then a page table
+ * if not too many pages are sparse; anything else is searched in
+ * Eytzinger order, which keeps the first probes in one cache line. */
+int choose_lookup(const struct font_data *fd)
+{
+	if (fd->count == 0)
+		return FONT_LOOKUP_SEARCH;
+
+	size_t span = fd->glyphs[fd->count - 1].ch - fd->glyphs[0].ch + 1;
+	if (span <= 4 * fd->count)
+		return FONT_LOOKUP_DIRECT;
+
+	if (count_ranges(fd) <= MAX_RANGES)
+		return FONT_LOOKUP_RANGES;
+
+	size_t pages = pages_length(fd);
+	if (pages <= 4 * fd->count && pages <= glyph_limit(fd))
+		return FONT_LOOKUP_PAGES;
+
+	return FONT_LOOKUP_EYTZINGER;
+}
+
+/** Return the lookup to build for 'fd' when 'type' is asked for: a font
+ * with no characters is searched, as it has nothing to index. Returns -1 if
+ * the table would hold offsets beyond glyph_t. */
+int fit_lookup(const struct font_data *fd, int type)
+{
+	if (fd->count == 0)
+		return FONT_LOOKUP_SEARCH;
+	if (type == FONT_LOOKUP_PAGES && pages_length(fd) > glyph_limit(fd))
+		return -1;
+	return type;
+}
+
+/** Fill keys[k] and indices[k] from the sorted glyphs, in the order of an
+ * implicit binary tree whose node k has children 2k + 1 and 2k + 2. */
+static size_t eytzinger(const struct font_data *fd, uint32_t *keys, uint32_t *indices,
+			size_t i, size_t k)
+{
+	if (k < fd->count) {
+		i = eytzinger(fd, keys, indices, i, 2 * k + 1);
+		keys[k] = fd->glyphs[i].ch;
+		indices[k] = i++;
+		i = eytzinger(fd, keys, indices, i, 2 * k + 2);
+	}
+	return i;
+}
+
+/** Build the lookup table of 'type' for 'fd', in the format described with
+ * the FONT_LOOKUP_ constants. Returns its length, or 0 if the type needs no
+ * table. */
+size_t build_lookup(const struct font_data *fd, int type, uint32_t **table)
+{
+	const struct glyph_data *g = fd->glyphs;
+	size_t count = fd->count, length = 0;
+	uint32_t *t = NULL;
+
+	if (count == 0)
+		type = FONT_LOOKUP_SEARCH;
+
+	switch (type) {
+	case FONT_LOOKUP_DIRECT: {
+		size_t span = g[count - 1].ch - g[0].ch + 1;
+
+		length = 1 + span;
+		t = calloc(length, sizeof(uint32_t));
+		t[0] = g[0].ch;
+		for (size_t i = 0; i < count; i++)
+			t[1 + g[i].ch - g[0].ch] = i + 1;
+		break;
+	}
+
+	case FONT_LOOKUP_RANGES: {
+		size_t ranges = count_ranges(fd), r = 0;
+
+		length = 1 + 3 * ranges;
+		t = calloc(length, sizeof(uint32_t));
+		t[0] = ranges;
+		for (size_t i = 0; i < count; i++) {
+			if (i == 0 || g[i].ch != g[i - 1].ch + 1) {
+				t[1 + 3 * r] = g[i].ch;
+				t[3 + 3 * r] = i;
+				r++;
+			}
+			t[2 + 3 * (r - 1)] = g[i].ch;
+		}
+		break;
+	}
+
+	case FONT_LOOKUP_PAGES: {
+		size_t top = (fd->max >> 8) + 1;
+
+		length = top + count_pages(fd) * 256;
+		t = calloc(length, sizeof(uint32_t));
+		size_t next = top;
+		for (size_t i = 0; i < count; i++) {
+			size_t page = g[i].ch >> 8;
+
+			if (t[page] == 0) {
+				t[page] = next;
+				next += 256;
+			}
+			t[t[page] + (g[i].ch & 0xff)] = i + 1;
+		}
+		break;
+	}
+
+	case FONT_LOOKUP_EYTZINGER:
+		length = 2 * count;
+		t = calloc(length, sizeof(uint32_t));
+		eytzinger(fd, t, t + count, 0, 0);
+		break;
+	}
+
+	*table = t;
+	return length;
+}
+
+// vim: set softtabstop=8 shiftwidth=8 tabstop=8:
@@ -0,0 +1,227 @@
+/**
+ * \file src/fontem_manifest.c
+ *
+ * Reads the manifest listing every font a build generates, and writes the
+ * registry of those fonts.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <ctype.h>
+#include <errno.h>
+#include <popt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generator.h"
+
+/** Size of a buffer big enough for any line of a manifest */
+#define MANIFEST_LINE_MAX 4096
+
+/** Read 'filename', a manifest with the options of one font on each line.
+ * Blank lines and lines starting with '#' are skipped. Each entry of
+ * 'lines' has the program name in argv[0], as poptGetContext() expects.
+ * Returns non-zero if the manifest can't be read. */
+int read_manifest(const char *filename, struct manifest_line **lines, size_t *count)
+{
+	FILE *f = fopen(filename, "r");
+	char buf[MANIFEST_LINE_MAX];
+	size_t alloc = 0;
+	int line = 0;
+
+	if (f == NULL) {
+		fprintf(stderr, "ERROR: Can't read '%s': %s\n", filename, strerror(errno));
+		return 1;
+	}
+
+	*lines = NULL;
+	*count = 0;
+	while (fgets(buf, sizeof(buf), f)) {
+		const char **argv;
+		int argc;
+		char *p = buf;
+
+		line++;
+
+		// A line that fills the buffer and goes on would be split in two
+		if (!strchr(buf, '\n') && !feof(f) && getc(f) != EOF) {
+			fprintf(stderr, "ERROR: %s:%d: Line longer than %d characters.\n",
+				filename, line, MANIFEST_LINE_MAX - 2);
+			fclose(f);
+			return 1;
+		}
+		while (isspace((unsigned char)*p))
+			p++;
+		if (*p == '\0' || *p == '#')
+			continue;
+		if (poptParseArgvString(p, &argc, &argv)) {
+			fprintf(stderr, "ERROR: %s:%d: Can't split the line into options.\n",
+				filename, line);
+			fclose(f);
+			return 1;
+		}
+
+		if (*count == alloc) {
+			alloc = alloc ? alloc * 2 : 32;
+			*lines = realloc(*lines, alloc * sizeof(struct manifest_line));
+		}
+		struct manifest_line *ml = &(*lines)[(*count)++];
+		ml->line = line;
+		ml->argc = argc + 1;
+		ml->argv = calloc(argc + 2, sizeof(char *));
+		ml->argv[0] = "fontem";
+		memcpy(ml->argv + 1, argv, argc * sizeof(char *));
+	}
+
+	int error = ferror(f);
+	fclose(f);
+	if (error)
+		fprintf(stderr, "ERROR: Can't read '%s': %s\n", filename, strerror(errno));
+	return error;
+}
+
+/** Return 'path', a file named in 'manifest', relative to the directory
+ * fontem runs in. Absolute paths are returned as they are. */
+const char *manifest_path(const char *manifest, const char *path)
+{
+	const char *slash = strrchr(manifest, '/');
+
+	if (path[0] == '/' || slash == NULL)
+		return path;
+
+	int dir_len = (int)(slash - manifest);
+	char *result = malloc(dir_len + strlen(path) + 2);
+	sprintf(result, "%.*s/%s", dir_len, manifest, path);
+	return result;
+}
+
+static int cmp_string(const void *p1, const void *p2)
+{
+	return strcmp(*(const char *const *)p1, *(const char *const *)p2);
+}
+
+/** Replace 'filename' with 'content', unless it already holds it, so that
+ * anything built from it is not rebuilt. */
+static int write_if_changed(const char *filename, const char *content)
+{
+	size_t length = strlen(content);
+	FILE *f = fopen(filename, "r");
+
+	if (f) {
+		char *old = malloc(length + 1);
+		size_t got = fread(old, 1, length + 1, f);
+		int same = got == length && !memcmp(old, content, length);
+
+		free(old);
+		fclose(f);
+		if (same)
+			return 0;
+	}
+
+	f = fopen(filename, "w");
+	if (f == NULL || fputs(content, f) == EOF || fclose(f)) {
+		fprintf(stderr, "ERROR: Can't write '%s': %s\n", filename, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+/** Append the formatted text to the growing string '*s'. */
+static void append(char **s, size_t *length, const char *fmt, const char *arg)
+{
+	int n = snprintf(NULL, 0, fmt, arg);
+
+	*s = realloc(*s, *length + n + 1);
+	sprintf(*s + *length, fmt, arg);
+	*length += n;
+}
+
+/** Append the definition of 'name', a NULL-terminated array of pointers to
+ * the 'count' objects of 'type' in 'symbols', and of its length 'count_name'. */
+static void append_array(char **s, size_t *length, const char *type, const char *name,
+			 const char *count_name, const char **symbols, size_t count)
+{
+	char line[256];
+
+	snprintf(line, sizeof(line), "const int %s = %zu;\n\n", count_name, count);
+	append(s, length, "%s", line);
+	snprintf(line, sizeof(line), "const %s *%s[] = {\n", type, name);
+	append(s, length, "%s", line);
+	for (size_t i = 0; i < count; i++)
+		append(s, length, "\t&%s,\n", symbols[i]);
+	append(s, length, "%s", "\tNULL\n};\n");
+}
+
+/** Write font_all.h and font_all.c in 'dir': the headers of the fonts in
+ * 'reg', and arrays of its fonts, runs of text, tinted fonts, distance
+ * field fonts, outline fonts and subpixel fonts. The lists are sorted here.
+ * Returns non-zero on failure. */
+int write_registry(const char *dir, struct registry *reg)
+{
+	char *s = NULL;
+	size_t length = 0;
+	int error;
+
+	qsort(reg->headers, reg->font_count, sizeof(char *), cmp_string);
+	qsort(reg->fonts, reg->font_count, sizeof(char *), cmp_string);
+	qsort(reg->runs, reg->run_count, sizeof(char *), cmp_string);
+	qsort(reg->tints, reg->tint_count, sizeof(char *), cmp_string);
+	qsort(reg->sdfs, reg->sdf_count, sizeof(char *), cmp_string);
+	qsort(reg->outlines, reg->outline_count, sizeof(char *), cmp_string);
+	qsort(reg->subpixels, reg->subpixel_count, sizeof(char *), cmp_string);
+
+	char *filename = malloc(strlen(dir) + 16);
+	sprintf(filename, "%s/font_all.h", dir);
+	append(&s, &length, "%s", "/* A list of all font headers. */\n\n");
+	append(&s, &length, "%s", "#include \"fontem.h\"\n\n");
+	for (size_t i = 0; i < reg->font_count; i++)
+		append(&s, &length, "#include \"%s\"\n", reg->headers[i]);
+	append(&s, &length, "%s", "\nextern const struct font *fonts[];\n");
+	append(&s, &length, "%s", "extern const int font_count;\n");
+	append(&s, &length, "%s", "extern const struct font_run *font_runs[];\n");
+	append(&s, &length, "%s", "extern const int font_run_count;\n");
+	append(&s, &length, "%s", "extern const struct font_tint *font_tints[];\n");
+	append(&s, &length, "%s", "extern const int font_tint_count;\n");
+	append(&s, &length, "%s", "extern const struct font_sdf *font_sdfs[];\n");
+	append(&s, &length, "%s", "extern const int font_sdf_count;\n");
+	append(&s, &length, "%s", "extern const struct font_outlines *font_outline_fonts[];\n");
+	append(&s, &length, "%s", "extern const int font_outline_count;\n");
+	append(&s, &length, "%s", "extern const struct font_subpixel *font_subpixels[];\n");
+	append(&s, &length, "%s", "extern const int font_subpixel_count;\n");
+	error = write_if_changed(filename, s);
+
+	sprintf(filename, "%s/font_all.c", dir);
+	length = 0;
+	append(&s, &length, "%s", "/* A list of all fonts. */\n\n");
+	append(&s, &length, "%s", "#include <stdio.h>\n");
+	append(&s, &length, "%s", "#include \"fontem.h\"\n");
+	append(&s, &length, "%s", "#include \"font_all.h\"\n\n");
+	append_array(&s, &length, "struct font", "fonts", "font_count",
+		     reg->fonts, reg->font_count);
+	append(&s, &length, "%s", "\n");
+	append_array(&s, &length, "struct font_run", "font_runs", "font_run_count",
+		     reg->runs, reg->run_count);
+	append(&s, &length, "%s", "\n");
+	append_array(&s, &length, "struct font_tint", "font_tints", "font_tint_count",
+		     reg->tints, reg->tint_count);
+	append(&s, &length, "%s", "\n");
+	append_array(&s, &length, "struct font_sdf", "font_sdfs", "font_sdf_count",
+		     reg->sdfs, reg->sdf_count);
+	append(&s, &length, "%s", "\n");
+	append_array(&s, &length, "struct font_outlines", "font_outline_fonts", "font_outline_count",
+		     reg->outlines, reg->outline_count);
+	append(&s, &length, "%s", "\n");
+	append_array(&s, &length, "struct font_subpixel", "font_subpixels", "font_subpixel_count",
+		     reg->subpixels, reg->subpixel_count);
+	error |= write_if_changed(filename, s);
+
+	free(s);
+	free(filename);
+	return error;
+}
+
+// vim: set softtabstop=8 shiftwidth=8 tabstop=8:
@@ -0,0 +1,584 @@
+/**
+ * \file src/fontem_obj.c
+ *
+ * Writes a font as assembler source or as a relocatable ELF object, which
+ * the build assembles or links without compiling any C, and lays the same
+ * font out in memory for fontem_build().
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generator.h"
+#include "resource/fontem.h"
+
+/** Size of a pointer field of struct font; the target decides how big */
+#define FIELD_PTR	0
+
+/** ELF constants */
+#define ET_REL		1
+#define SHT_PROGBITS	1
+#define SHT_SYMTAB	2
+#define SHT_STRTAB	3
+#define SHT_RELA	4
+#define SHT_REL		9
+#define SHF_WRITE	0x01
+#define SHF_ALLOC	0x02
+#define SHF_MERGE	0x10
+#define SHF_STRINGS	0x20
+#define SHF_INFO_LINK	0x40
+#define STB_LOCAL	0
+#define STB_GLOBAL	1
+#define STT_OBJECT	1
+#define STT_SECTION	3
+
+/** Targets of --format=obj; all little-endian */
+static const struct machine {
+	const char	*name;          /** Name, as given to --machine */
+	uint16_t	em;             /** ELF machine */
+	int		elf64;          /** Whether the target uses ELF64 */
+	int		rela;           /** Whether relocations carry addends */
+	uint32_t	reloc;          /** Relocation for an absolute address */
+	uint32_t	flags;          /** ELF header flags */
+} machines[] = {
+	{ "x86_64",  62,  1, 1, 1,   0		},
+	{ "i386",    3,	  0, 0, 1,   0		},
+	{ "arm",     40,  0, 0, 2,   0x05000000 },
+	{ "aarch64", 183, 1, 1, 257, 0		},
+};
+
+/** Return the target called 'name', the host for NULL, or -1. */
+int machine_id(const char *name)
+{
+	if (name == NULL) {
+#if defined(__x86_64__)
+		name = "x86_64";
+#elif defined(__i386__)
+		name = "i386";
+#elif defined(__aarch64__)
+		name = "aarch64";
+#elif defined(__arm__)
+		name = "arm";
+#else
+		return -1;
+#endif
+	}
+	for (size_t i = 0; i < sizeof(machines) / sizeof(machines[0]); i++)
+		if (!strcmp(name, machines[i].name))
+			return i;
+	return -1;
+}
+
+/** A growable output buffer */
+struct buf {
+	uint8_t *data;
+	size_t	length;
+	size_t	alloc;
+	int	big_endian;     /** Whether values are put most significant byte first */
+};
+
+static void put8(struct buf *b, unsigned int v)
+{
+	if (b->length == b->alloc) {
+		b->alloc = b->alloc ? b->alloc * 2 : 256;
+		b->data = realloc(b->data, b->alloc);
+	}
+	b->data[b->length++] = v;
+}
+
+static void put16(struct buf *b, unsigned int v)
+{
+	put8(b, b->big_endian ? (v >> 8) & 0xff : v & 0xff);
+	put8(b, b->big_endian ? v & 0xff : (v >> 8) & 0xff);
+}
+
+static void put32(struct buf *b, uint32_t v)
+{
+	put16(b, b->big_endian ? v >> 16 : v & 0xffff);
+	put16(b, b->big_endian ? v & 0xffff : v >> 16);
+}
+
+static void put64(struct buf *b, uint64_t v)
+{
+	put32(b, b->big_endian ? v >> 32 : v & 0xffffffff);
+	put32(b, b->big_endian ? v & 0xffffffff : v >> 32);
+}
+
+/** Put an address or offset, as wide as the ELF class needs. */
+static void put_addr(struct buf *b, uint64_t v, int elf64)
+{
+	if (elf64)
+		put64(b, v);
+	else
+		put32(b, v);
+}
+
+/** Put a glyph_t, as wide as the layout the font is built for. */
+static void put_glyph(struct buf *b, uint32_t v, int glyph32)
+{
+	if (glyph32)
+		put32(b, v);
+	else
+		put16(b, v);
+}
+
+static void put_bytes(struct buf *b, const void *data, size_t length)
+{
+	for (size_t i = 0; i < length; i++)
+		put8(b, ((const uint8_t *)data)[i]);
+}
+
+static void align(struct buf *b, size_t to)
+{
+	while (b->length % to)
+		put8(b, 0);
+}
+
+/** The arrays that struct font points to, laid out in one block, and where
+ * each starts; NO_DATA marks an array the font does not have. */
+#define NO_DATA SIZE_MAX
+struct font_arrays {
+	struct buf	data;
+	size_t		atlas;
+	size_t		codec_data;
+	size_t		codepoints;
+	size_t		lookup;
+	size_t		glyphs;
+	size_t		glyph_codecs;
+	size_t		kerning;
+	size_t		name;
+	size_t		style;
+};
+
+/** Lay out the arrays of the font as a C compiler would for the target,
+ * in its byte order. The atlas comes first. */
+static void build_arrays(const struct font_layout *fl, struct font_arrays *fa, int big_endian)
+{
+	const struct font_data *fd = fl->fd;
+	const struct kern_classes *kc = &fd->kerning;
+	struct buf *b = &fa->data;
+
+	memset(fa, 0, sizeof(*fa));
+	b->big_endian = big_endian;
+
+	fa->atlas = b->length;
+	if (fl->atlas->length)
+		put_bytes(b, fl->atlas->data, fl->atlas->length);
+	else
+		put8(b, 0);
+
+	fa->codec_data = NO_DATA;
+	if (fd->codec_data_length) {
+		align(b, 4);
+		fa->codec_data = b->length;
+		put_bytes(b, fd->codec_data, fd->codec_data_length);
+	}
+
+	align(b, 4);
+	fa->codepoints = b->length;
+	for (size_t i = 0; i < fd->count; i++)
+		put_glyph(b, fd->glyphs[i].ch, fd->glyph32);
+
+	fa->lookup = NO_DATA;
+	if (fl->lookup_length) {
+		align(b, 4);
+		fa->lookup = b->length;
+		for (size_t i = 0; i < fl->lookup_length; i++)
+			put_glyph(b, fl->lookup_table[i], fd->glyph32);
+	}
+
+	// struct glyph
+	align(b, 4);
+	fa->glyphs = b->length;
+	for (size_t i = 0; i < fd->count; i++) {
+		const struct glyph_data *gd = &fd->glyphs[i];
+
+		put16(b, gd->left);
+		put16(b, gd->top);
+		put16(b, gd->advance);
+		put16(b, gd->cols);
+		put16(b, gd->rows);
+		put8(b, fd->with_kerning ? kc->left[i] : 0);
+		put8(b, fd->with_kerning ? kc->right[i] : 0);
+		put32(b, fl->atlas->offsets[i]);
+	}
+
+	fa->glyph_codecs = NO_DATA;
+	if (fd->codec == FONT_CODEC_MIXED) {
+		fa->glyph_codecs = b->length;
+		for (size_t i = 0; i < fd->count; i++)
+			put8(b, fd->glyphs[i].codec);
+	}
+
+	fa->kerning = NO_DATA;
+	if (fd->with_kerning) {
+		fa->kerning = b->length;
+		put_bytes(b, kc->matrix, (size_t)kc->left_count * kc->right_count);
+	}
+
+	fa->name = b->length;
+	put_bytes(b, fd->name, strlen(fd->name) + 1);
+	fa->style = b->length;
+	put_bytes(b, fd->style, strlen(fd->style) + 1);
+}
+
+/** A field of struct font */
+struct field {
+	const char	*name;          /** Name of the field */
+	int		size;           /** Bytes, or FIELD_PTR for a pointer */
+	int64_t		value;          /** Value, or offset in the arrays of a pointer */
+};
+
+/** Fill in the fields of struct font, in order; pointers that are NULL
+ * have the value NO_DATA. Returns the number of fields. */
+static size_t font_fields(const struct font_layout *fl, const struct font_arrays *fa,
+			  struct field *f)
+{
+	const struct font_data *fd = fl->fd;
+	size_t n = 0;
+
+#define FIELD(n_, s_, v_) f[n++] = (struct field){ n_, s_, (int64_t)(v_) }
+	FIELD("name",		FIELD_PTR,	fa->name);
+	FIELD("style",		FIELD_PTR,	fa->style);
+	FIELD("size",		2,		fd->size);
+	FIELD("dpi",		2,		fd->dpi);
+	FIELD("ascender",	2,		fd->ascender);
+	FIELD("descender",	2,		fd->descender);
+	FIELD("height",		2,		fd->height);
+	FIELD("count",		fd->glyph32 ? 4 : 2, fd->count);
+	FIELD("max",		fd->glyph32 ? 4 : 2, fd->max);
+	FIELD("codepoints",	FIELD_PTR,	fa->codepoints);
+	FIELD("glyphs",		FIELD_PTR,	fa->glyphs);
+	FIELD("lookup_type",	1,		fl->lookup);
+	FIELD("lookup",		FIELD_PTR,	fa->lookup);
+	FIELD("codec",		1,		fd->codec);
+	FIELD("codec_data",	FIELD_PTR,	fa->codec_data);
+	FIELD("glyph_codecs",	FIELD_PTR,	fa->glyph_codecs);
+	FIELD("kerning",	FIELD_PTR,	fa->kerning);
+	FIELD("kerning_cols",	1,		fd->with_kerning ? fd->kerning.right_count : 0);
+	FIELD("atlas",		FIELD_PTR,	fa->atlas);
+	FIELD("atlas_stride",	2,		fl->atlas->width);
+#undef FIELD
+
+	return n;
+}
+
+/** Maximum number of fields of struct font */
+#define MAX_FIELDS 32
+
+/** Write 'fl' as assembler source to 's', with the arrays in 'data', which
+ * the source includes as 'data_name'. Returns non-zero on failure. */
+int write_asm(FILE *s, FILE *data, const char *data_name, const struct font_layout *fl)
+{
+	struct font_arrays fa;
+	struct field fields[MAX_FIELDS];
+
+	build_arrays(fl, &fa, 0);
+	size_t n = font_fields(fl, &fa, fields);
+
+	fprintf(s, "%s",
+		"/* AUTOMATICALLY GENERATED FILE! EDITING NOT RECOMMENDED!\n"
+		" *\n"
+		" * This file is distributed under the terms of the MIT License.\n"
+		" * See the LICENSE file at the top of this tree, or if it is missing a copy can\n"
+		" * be found at http://opensource.org/licenses/MIT\n"
+		" */\n\n");
+	fprintf(s, "/* " HASH_MARKER "%016" PRIx64 " */\n\n", fl->fd->hash);
+	fprintf(s, "/* Definition for font \"%s\"; the arrays it points to are in\n"
+		" * %s. */\n\n", fl->fd->name, data_name);
+	fprintf(s, "\t.section %s,\"a\"\n", fl->section);
+	fprintf(s, "\t.balign 4\n");
+	fprintf(s, ".Ldata_%s:\n", fl->symbol);
+	fprintf(s, "\t.incbin \"%s\"\n\n", data_name);
+
+	fprintf(s, "\t.section %s,\"%s\"\n", fl->font_section,
+		fl->font_writable ? "aw" : "a");
+	fprintf(s, "\t.balign __SIZEOF_POINTER__\n");
+	fprintf(s, "\t.globl %s\n", fl->symbol);
+	fprintf(s, "\t.type %s, %%object\n", fl->symbol);
+	fprintf(s, "%s:\n", fl->symbol);
+	for (size_t i = 0; i < n; i++) {
+		const struct field *f = &fields[i];
+
+		if (f->size == FIELD_PTR && f->value == (int64_t)NO_DATA)
+			fprintf(s, "\t.balign __SIZEOF_POINTER__\n\t.dc.a 0");
+		else if (f->size == FIELD_PTR)
+			fprintf(s, "\t.balign __SIZEOF_POINTER__\n\t.dc.a .Ldata_%s + %" PRId64,
+				fl->symbol, f->value);
+		else if (f->size == 4)
+			fprintf(s, "\t.balign 4\n\t.4byte %" PRId64, f->value);
+		else if (f->size == 2)
+			fprintf(s, "\t.balign 2\n\t.2byte %" PRId64, f->value);
+		else
+			fprintf(s, "\t.byte %" PRId64, f->value);
+		fprintf(s, "  /* %s */\n", f->name);
+	}
+	fprintf(s, "\t.balign __SIZEOF_POINTER__\n");
+	fprintf(s, "\t.size %s, . - %s\n\n", fl->symbol, fl->symbol);
+	fprintf(s, "\t.section .note.GNU-stack,\"\",%%progbits\n");
+
+	int error = fwrite(fa.data.data, 1, fa.data.length, data) != fa.data.length;
+	free(fa.data.data);
+	return error || ferror(s);
+}
+
+/** A section of an ELF object being built */
+struct elf_section {
+	const char	*name;
+	uint32_t	type;
+	uint64_t	flags;
+	struct buf	*data;
+	uint32_t	link;
+	uint32_t	info;
+	uint64_t	align;
+	uint64_t	entsize;
+};
+
+/** Write 'fl' to 'f' as a relocatable ELF object for the target 'machine',
+ * holding the arrays and struct font in their sections, and the hash of the
+ * inputs in .comment. Returns non-zero on failure. */
+int write_obj(FILE *f, const struct font_layout *fl, int machine)
+{
+	const struct machine *m = &machines[machine];
+	size_t ptr = m->elf64 ? 8 : 4;
+	struct font_arrays fa;
+	struct field fields[MAX_FIELDS];
+	struct buf rel = { 0 }, sym = { 0 }, str = { 0 }, shstr = { 0 }, comment = { 0 };
+	struct buf none = { 0 }, font = { 0 };
+
+	build_arrays(fl, &fa, 0);
+	size_t n = font_fields(fl, &fa, fields);
+
+	// Pointers in struct font hold the offset they point to, and are
+	// relocated against the section of the arrays
+	struct buf *data = &font;
+	for (size_t i = 0; i < n; i++) {
+		const struct field *fld = &fields[i];
+
+		if (fld->size == FIELD_PTR) {
+			align(data, ptr);
+			if (fld->value != (int64_t)NO_DATA) {
+				put_addr(&rel, data->length, m->elf64);
+				if (m->elf64)
+					put64(&rel, (uint64_t)1 << 32 | m->reloc);
+				else
+					put32(&rel, 1 << 8 | m->reloc);
+				if (m->rela)
+					put_addr(&rel, fld->value, m->elf64);
+			}
+			put_addr(data, fld->value == (int64_t)NO_DATA ? 0 : fld->value, m->elf64);
+		} else if (fld->size == 4) {
+			align(data, 4);
+			put32(data, fld->value);
+		} else if (fld->size == 2) {
+			align(data, 2);
+			put16(data, fld->value);
+		} else {
+			put8(data, fld->value);
+		}
+	}
+	align(data, ptr);
+
+	char marker[sizeof(HASH_MARKER) + 16];
+	snprintf(marker, sizeof(marker), HASH_MARKER "%016" PRIx64, fl->fd->hash);
+	put_bytes(&comment, marker, strlen(marker) + 1);
+
+	// Symbols: the null symbol, the section of the arrays, then the font
+	put8(&str, 0);
+	size_t name = str.length;
+	put_bytes(&str, fl->symbol, strlen(fl->symbol) + 1);
+	for (int s = 0; s < 3; s++) {
+		uint32_t sname = s == 2 ? name : 0;
+		uint8_t info = s == 1 ? STB_LOCAL << 4 | STT_SECTION :
+			       s == 2 ? STB_GLOBAL << 4 | STT_OBJECT : 0;
+		uint16_t shndx = s == 1 ? 2 : s == 2 ? 3 : 0;
+		uint64_t size = s == 2 ? font.length : 0;
+
+		put32(&sym, sname);
+		if (m->elf64) {
+			put8(&sym, info);
+			put8(&sym, 0);
+			put16(&sym, shndx);
+			put64(&sym, 0);
+			put64(&sym, size);
+		} else {
+			put32(&sym, 0);
+			put32(&sym, size);
+			put8(&sym, info);
+			put8(&sym, 0);
+			put16(&sym, shndx);
+		}
+	}
+
+	char *rel_name = malloc(strlen(fl->font_section) + 6);
+	sprintf(rel_name, "%s%s", m->rela ? ".rela" : ".rel", fl->font_section);
+
+	// .comment comes first, so that the hash is near the start of the file
+	struct elf_section sections[] = {
+		{ "",			0,		0,			&none,	  0, 0, 0,   0 },
+		{ ".comment",		SHT_PROGBITS,	SHF_MERGE | SHF_STRINGS, &comment, 0, 0, 1,   1 },
+		{ fl->section,		SHT_PROGBITS,	SHF_ALLOC,		&fa.data, 0, 0, 4,   0 },
+		{ fl->font_section,	SHT_PROGBITS,	SHF_ALLOC | (fl->font_writable ? SHF_WRITE : 0),
+		  &font, 0, 0, ptr, 0 },
+		{ rel_name,		m->rela ? SHT_RELA : SHT_REL, SHF_INFO_LINK, &rel, 5, 3, ptr,
+		  (m->elf64 ? 8 : 4) * (m->rela ? 3 : 2) },
+		{ ".symtab",		SHT_SYMTAB,	0,			&sym,	  6, 2, ptr, m->elf64 ? 24 : 16 },
+		{ ".strtab",		SHT_STRTAB,	0,			&str,	  0, 0, 1,   0 },
+		{ ".shstrtab",		SHT_STRTAB,	0,			&shstr,	  0, 0, 1,   0 },
+		{ ".note.GNU-stack",	SHT_PROGBITS,	0,			&none,	  0, 0, 1,   0 },
+	};
+	size_t nsections = sizeof(sections) / sizeof(sections[0]);
+	size_t shstrndx = 7;
+
+	uint32_t *names = calloc(nsections, sizeof(uint32_t));
+	size_t *offsets = calloc(nsections, sizeof(size_t));
+	for (size_t i = 0; i < nsections; i++) {
+		names[i] = shstr.length;
+		put_bytes(&shstr, sections[i].name, strlen(sections[i].name) + 1);
+	}
+
+	// Lay out the file: header, section contents, then section headers
+	size_t ehsize = m->elf64 ? 64 : 52;
+	size_t shentsize = m->elf64 ? 64 : 40;
+	size_t offset = ehsize;
+	for (size_t i = 1; i < nsections; i++) {
+		offset = (offset + sections[i].align - 1) & ~(sections[i].align - 1);
+		offsets[i] = offset;
+		offset += sections[i].data->length;
+	}
+	size_t shoff = (offset + 7) & ~(size_t)7;
+
+	struct buf out = { 0 };
+	put8(&out, 0x7f);
+	put_bytes(&out, "ELF", 3);
+	put8(&out, m->elf64 ? 2 : 1);   // Class
+	put8(&out, 1);                  // Little-endian
+	put8(&out, 1);                  // Version
+	align(&out, 16);
+	put16(&out, ET_REL);
+	put16(&out, m->em);
+	put32(&out, 1);
+	put_addr(&out, 0, m->elf64);    // Entry
+	put_addr(&out, 0, m->elf64);    // Program headers
+	put_addr(&out, shoff, m->elf64);
+	put32(&out, m->flags);
+	put16(&out, ehsize);
+	put16(&out, 0);
+	put16(&out, 0);
+	put16(&out, shentsize);
+	put16(&out, nsections);
+	put16(&out, shstrndx);
+
+	for (size_t i = 1; i < nsections; i++) {
+		while (out.length < offsets[i])
+			put8(&out, 0);
+		put_bytes(&out, sections[i].data->data, sections[i].data->length);
+	}
+	while (out.length < shoff)
+		put8(&out, 0);
+
+	for (size_t i = 0; i < nsections; i++) {
+		const struct elf_section *s = &sections[i];
+
+		put32(&out, names[i]);
+		put32(&out, s->type);
+		put_addr(&out, s->flags, m->elf64);
+		put_addr(&out, 0, m->elf64);
+		put_addr(&out, offsets[i], m->elf64);
+		put_addr(&out, s->data->length, m->elf64);
+		put32(&out, s->link);
+		put32(&out, s->info);
+		put_addr(&out, s->align, m->elf64);
+		put_addr(&out, s->entsize, m->elf64);
+	}
+
+	int error = fwrite(out.data, 1, out.length, f) != out.length;
+
+	free(out.data);
+	free(names);
+	free(offsets);
+	free(rel_name);
+	free(fa.data.data);
+	free(font.data);
+	free(rel.data);
+	free(sym.data);
+	free(str.data);
+	free(shstr.data);
+	free(comment.data);
+	return error;
+}
+
+/** Where each field of struct font is on the host */
+static const struct host_field {
+	const char	*name;
+	size_t		offset;
+} host_fields[] = {
+	{ "name",		offsetof(struct font, name)		},
+	{ "style",		offsetof(struct font, style)		},
+	{ "size",		offsetof(struct font, size)		},
+	{ "dpi",		offsetof(struct font, dpi)		},
+	{ "ascender",		offsetof(struct font, ascender)		},
+	{ "descender",		offsetof(struct font, descender)	},
+	{ "height",		offsetof(struct font, height)		},
+	{ "count",		offsetof(struct font, count)		},
+	{ "max",		offsetof(struct font, max)		},
+	{ "codepoints",		offsetof(struct font, codepoints)	},
+	{ "glyphs",		offsetof(struct font, glyphs)		},
+	{ "lookup_type",	offsetof(struct font, lookup_type)	},
+	{ "lookup",		offsetof(struct font, lookup)		},
+	{ "codec",		offsetof(struct font, codec)		},
+	{ "codec_data",		offsetof(struct font, codec_data)	},
+	{ "glyph_codecs",	offsetof(struct font, glyph_codecs)	},
+	{ "kerning",		offsetof(struct font, kerning)		},
+	{ "kerning_cols",	offsetof(struct font, kerning_cols)	},
+	{ "atlas",		offsetof(struct font, atlas)		},
+	{ "atlas_stride",	offsetof(struct font, atlas_stride)	},
+};
+
+/** Lay 'fl' out in memory as a struct font for the host, as write_obj()
+ * lays it out for a target, with its arrays in one block. 'fl' must be
+ * laid out for the glyph_t of the host. Free the block, which starts with
+ * the atlas, and then the font. */
+struct font *build_font(const struct font_layout *fl)
+{
+	static const uint16_t one = 1;
+	struct font_arrays fa;
+	struct field fields[MAX_FIELDS];
+	struct font *font = calloc(1, sizeof(*font));
+
+	build_arrays(fl, &fa, *(const uint8_t *)&one == 0);
+	size_t n = font_fields(fl, &fa, fields);
+
+	for (size_t i = 0; i < n; i++) {
+		const struct field *f = &fields[i];
+		size_t j = 0;
+
+		while (strcmp(host_fields[j].name, f->name))
+			j++;
+		uint8_t *p = (uint8_t *)font + host_fields[j].offset;
+		if (f->size == FIELD_PTR) {
+			const void *ptr = f->value == (int64_t)NO_DATA ? NULL : fa.data.data + f->value;
+			memcpy(p, &ptr, sizeof(ptr));
+		} else if (f->size == 4) {
+			uint32_t v = f->value;
+			memcpy(p, &v, sizeof(v));
+		} else if (f->size == 2) {
+			uint16_t v = f->value;
+			memcpy(p, &v, sizeof(v));
+		} else {
+			*p = f->value;
+		}
+	}
+
+	return font;
+}
+
+// vim: set softtabstop=8 shiftwidth=8 tabstop=8:
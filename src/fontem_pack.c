@@ -0,0 +1,156 @@
+/**
+ * \file src/fontem_pack.c
+ *
+ * Writes a font as a binary font pack.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generator.h"
+#include "resource/fontem.h"
+
+/** Round up to the alignment of the pack structures. */
+#define PACK_ALIGN(x) (((x) + 3) & ~(size_t)3)
+
+static void put8(uint8_t **p, unsigned int v)
+{
+	*(*p)++ = v & 0xff;
+}
+
+static void put16(uint8_t **p, unsigned int v)
+{
+	put8(p, v);
+	put8(p, v >> 8);
+}
+
+static void put32(uint8_t **p, uint32_t v)
+{
+	put16(p, v & 0xffff);
+	put16(p, v >> 16);
+}
+
+/** Bytes of a struct glyph, as written field by field */
+#define PACK_GLYPH_SIZE 16
+
+/** Write 'fd' to 'f' in the layout described by struct font_pack_header.
+ * The pack is built in memory and written little-endian, whatever the
+ * byte order of the host; its arrays are those of a struct font on a
+ * little-endian host, so loading it copies none of them. Returns non-zero
+ * on failure. */
+int write_pack(FILE *f, const struct font_data *fd)
+{
+	const struct kern_classes *kc = &fd->kerning;
+
+	// Lay the pack out: header, glyphs, character codes, bitmap lengths,
+	// glyph codecs, kerning, codec table, strings, then bitmaps
+	size_t glyph_size = fd->glyph32 ? 4 : 2;
+	size_t glyphs = PACK_ALIGN(sizeof(struct font_pack_header));
+	size_t codepoints = glyphs + fd->count * PACK_GLYPH_SIZE;
+	size_t lengths = PACK_ALIGN(codepoints + fd->count * glyph_size);
+	size_t glyph_codecs = lengths + fd->count * 4;
+	size_t glyph_codecs_len = fd->codec == FONT_CODEC_MIXED ? fd->count : 0;
+	size_t kerning = PACK_ALIGN(glyph_codecs + glyph_codecs_len);
+	size_t kerning_len = fd->with_kerning ? (size_t)kc->left_count * kc->right_count : 0;
+	size_t codec_data = PACK_ALIGN(kerning + kerning_len);
+	size_t name = PACK_ALIGN(codec_data + fd->codec_data_length);
+	size_t style = name + strlen(fd->name) + 1;
+	size_t bitmaps = PACK_ALIGN(style + strlen(fd->style) + 1);
+	size_t length = bitmaps;
+
+	for (size_t i = 0; i < fd->count; i++)
+		if (!fd->glyphs[i].same)
+			length += fd->glyphs[i].length;
+	length = PACK_ALIGN(length);
+
+	if (length > UINT32_MAX) {
+		fprintf(stderr, "ERROR: Font too large for a font pack.\n");
+		return 1;
+	}
+
+	uint8_t *pack = calloc(length, 1);
+	uint8_t *p = pack;
+
+	memcpy(p, FONT_PACK_MAGIC, 4);
+	p += 4;
+	put16(&p, FONT_PACK_VERSION);
+	put16(&p, FONT_PACK_BYTE_ORDER);
+	put32(&p, length);
+	put32(&p, name);
+	put32(&p, style);
+	put32(&p, glyphs);
+	put32(&p, codepoints);
+	put32(&p, lengths);
+	put32(&p, glyph_codecs_len ? glyph_codecs : 0);
+	put32(&p, kerning_len ? kerning : 0);
+	put32(&p, fd->codec_data_length ? codec_data : 0);
+	put16(&p, fd->size);
+	put16(&p, fd->dpi);
+	put16(&p, fd->ascender);
+	put16(&p, fd->descender);
+	put16(&p, fd->height);
+	put8(&p, fd->codec);
+	put8(&p, kerning_len ? kc->left_count : 0);
+	put8(&p, kerning_len ? kc->right_count : 0);
+	put8(&p, glyph_size);
+	p += 2;
+	put32(&p, fd->count);
+	put32(&p, fd->max);
+	put32(&p, fd->hash & 0xffffffff);
+	put32(&p, fd->hash >> 32);
+
+	// Glyphs sharing a bitmap point at the copy stored for the first of them
+	size_t offset = bitmaps;
+	size_t *offsets = calloc(fd->count + 1, sizeof(size_t));
+	for (size_t i = 0; i < fd->count; i++) {
+		const struct glyph_data *gd = &fd->glyphs[i];
+
+		if (gd->same) {
+			offsets[i] = offsets[gd->same - fd->glyphs];
+		} else if (gd->length) {
+			offsets[i] = offset;
+			memcpy(pack + offset, gd->bitmap, gd->length);
+			offset += gd->length;
+		}
+
+		p = pack + glyphs + i * PACK_GLYPH_SIZE;
+		put16(&p, gd->left);
+		put16(&p, gd->top);
+		put16(&p, gd->advance);
+		put16(&p, gd->cols);
+		put16(&p, gd->rows);
+		put8(&p, kerning_len ? kc->left[i] : 0);
+		put8(&p, kerning_len ? kc->right[i] : 0);
+		put32(&p, offsets[i]);
+
+		p = pack + codepoints + i * glyph_size;
+		if (glyph_size == 4)
+			put32(&p, gd->ch);
+		else
+			put16(&p, gd->ch);
+		p = pack + lengths + i * 4;
+		put32(&p, gd->length);
+		if (glyph_codecs_len)
+			pack[glyph_codecs + i] = gd->codec;
+	}
+	free(offsets);
+
+	if (kerning_len)
+		memcpy(pack + kerning, kc->matrix, kerning_len);
+	if (fd->codec_data_length)
+		memcpy(pack + codec_data, fd->codec_data, fd->codec_data_length);
+	strcpy((char *)pack + name, fd->name);
+	strcpy((char *)pack + style, fd->style);
+
+	int error = fwrite(pack, 1, length, f) != length;
+	free(pack);
+	return error;
+}
+
+// vim: set softtabstop=8 shiftwidth=8 tabstop=8:
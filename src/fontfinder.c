@@ -22,7 +22,7 @@ const struct font *font_find_all(const char *name, const char *style, const int
 	for (int idx = 0; fonts[idx] != NULL; idx++) {
 		if (size == fonts[idx]->size && !strcasecmp(name, fonts[idx]->name))
 			if (style == NULL || !strcasecmp(style, fonts[idx]->style))
-				if (rle < 0 || rle == fonts[idx]->compressed)
+				if (rle < 0 || rle == (fonts[idx]->codec != FONT_CODEC_RAW))
 					return fonts[idx];
 	}
 	return NULL;
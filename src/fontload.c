@@ -0,0 +1,299 @@
+/**
+ * \file fontload.c
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "fontem.h"
+
+/** A font loaded from a pack. Only the struct font is allocated; its
+ * arrays, names, bitmaps and kerning point straight into the pack, which
+ * serves as the font's atlas. */
+struct loaded_font {
+	struct font	font;           /** Must be first */
+	void		*map;           /** The mapping to release, or NULL */
+	size_t		map_length;     /** Length of 'map' */
+};
+
+/** Check that [offset, offset + length) lies within a pack of 'size' bytes. */
+static int in_pack(size_t size, uint32_t offset, size_t length)
+{
+	return offset <= size && length <= size - offset;
+}
+
+/** Check that a string at 'offset' is NUL-terminated within the pack. */
+static int string_in_pack(const uint8_t *pack, size_t size, uint32_t offset)
+{
+	return offset < size && memchr(pack + offset, '\0', size - offset) != NULL;
+}
+
+/** Check that the pack's codec is known, and that its table is present and
+ * lies within the pack. */
+static int codec_data_in_pack(const uint8_t *pack, const struct font_pack_header *hdr)
+{
+	size_t length = 0;
+
+	switch (hdr->codec) {
+	case FONT_CODEC_RAW:
+	case FONT_CODEC_RLE:
+	case FONT_CODEC_LZ:
+	case FONT_CODEC_BPP1:
+	case FONT_CODEC_BPP2:
+	case FONT_CODEC_BPP4:
+	case FONT_CODEC_SPANS:
+		return 1;
+	case FONT_CODEC_PAL4:
+		length = 4;
+		break;
+	case FONT_CODEC_PAL16:
+		length = 16;
+		break;
+	case FONT_CODEC_MIXED:
+		// The table is only needed if some glyphs use Huffman codes
+		if (hdr->codec_data == 0)
+			return 1;
+		/* Fall through */
+	case FONT_CODEC_HUFFMAN:
+		length = 16;
+		if (hdr->codec_data && in_pack(hdr->length, hdr->codec_data, length))
+			for (int i = 0; i < 16; i++)
+				length += pack[hdr->codec_data + i];
+		break;
+	case FONT_CODEC_ROWS:
+		length = 1;
+		if (hdr->codec_data && in_pack(hdr->length, hdr->codec_data, length) &&
+		    (pack[hdr->codec_data] < 2 || pack[hdr->codec_data] > 4))
+			return 0;
+		break;
+	default:
+		return 0;
+	}
+	return hdr->codec_data && in_pack(hdr->length, hdr->codec_data, length);
+}
+
+/** Bytes past its end that decoding a pixel of a bitmap can read: a span
+ * holds up to 255 edge pixels, and a pixel can end one row and start the
+ * next */
+#define READ_AHEAD	1024
+
+/** Decode the bitmap of 'glyph' once, from a copy in 'scratch' followed by
+ * READ_AHEAD zeros, and check that it uses no more than its 'length' bytes
+ * and, for FONT_CODEC_ROWS, that its rows lie within the 'table_length'
+ * bytes of the dictionary. */
+static int glyph_decodes(const struct font *font, const struct glyph *glyph,
+			 size_t length, size_t table_length, uint8_t *scratch)
+{
+	struct glyph_reader reader;
+	const uint8_t *end = scratch + length;
+
+	memcpy(scratch, font_get_bitmap(font, glyph), length);
+	memset(scratch + length, 0, READ_AHEAD);
+	font_reader_init(&reader, font, glyph);
+	reader.data = scratch;
+
+	// Rows are checked before they are read, as they point into the pack
+	if (reader.codec == FONT_CODEC_ROWS) {
+		for (unsigned int y = 0; y < glyph->rows; y++) {
+			const uint8_t *row = font_reader_row(&reader);
+
+			if (reader.data > end ||
+			    (size_t)(row - reader.table) + glyph->cols > table_length)
+				return 0;
+		}
+		return 1;
+	}
+
+	for (size_t i = 0; i < (size_t)glyph->cols * glyph->rows; i++) {
+		font_reader_next(&reader);
+		if (reader.data > end)
+			return 0;
+	}
+	return 1;
+}
+
+/** Return the codec of glyph 'i', or -1 if it is not one a mixed font can
+ * use. */
+static int glyph_codec(const uint8_t *pack, const struct font_pack_header *hdr, size_t i)
+{
+	if (hdr->codec != FONT_CODEC_MIXED)
+		return hdr->codec;
+
+	uint8_t codec = pack[hdr->glyph_codecs + i];
+	switch (codec) {
+	case FONT_CODEC_RAW:
+	case FONT_CODEC_RLE:
+	case FONT_CODEC_LZ:
+		return codec;
+	case FONT_CODEC_HUFFMAN:
+		return hdr->codec_data ? codec : -1;
+	default:
+		return -1;
+	}
+}
+
+/** Validate the pack in 'data' and build a font around it. 'data' must be
+ * aligned to 4 bytes and must stay valid until the font is unloaded.
+ * Returns NULL with errno set if the pack is not usable on this host. */
+const struct font *font_load_memory(const void *data, size_t length)
+{
+	const uint8_t *pack = data;
+	const struct font_pack_header *hdr = data;
+
+	if (data == NULL || ((uintptr_t)data & 3) || length < sizeof(*hdr) ||
+	    memcmp(hdr->magic, FONT_PACK_MAGIC, 4) || hdr->version != FONT_PACK_VERSION ||
+	    hdr->byte_order != FONT_PACK_BYTE_ORDER || hdr->length > length ||
+	    hdr->glyph_size != sizeof(glyph_t) ||
+	    hdr->max > (glyph_t)~0 || hdr->count > (glyph_t)~0 ||
+	    (hdr->glyphs & 3) || (hdr->codepoints & 3) || (hdr->lengths & 3) ||
+	    !in_pack(hdr->length, hdr->glyphs, (size_t)hdr->count * sizeof(struct glyph)) ||
+	    !in_pack(hdr->length, hdr->codepoints, (size_t)hdr->count * sizeof(glyph_t)) ||
+	    !in_pack(hdr->length, hdr->lengths, (size_t)hdr->count * sizeof(uint32_t)) ||
+	    (hdr->codec == FONT_CODEC_MIXED &&
+	     (hdr->glyph_codecs == 0 || !in_pack(hdr->length, hdr->glyph_codecs, hdr->count))) ||
+	    !in_pack(hdr->length, hdr->kerning, (size_t)hdr->kerning_rows * hdr->kerning_cols) ||
+	    !codec_data_in_pack(pack, hdr) ||
+	    !string_in_pack(pack, hdr->length, hdr->name) ||
+	    !string_in_pack(pack, hdr->length, hdr->style)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	const struct glyph *glyphs = (const struct glyph *)(pack + hdr->glyphs);
+	const glyph_t *codepoints = (const glyph_t *)(pack + hdr->codepoints);
+	const uint32_t *lengths = (const uint32_t *)(pack + hdr->lengths);
+	size_t longest = 0;
+
+	// The renderers trust the glyph table, so check it all up front
+	for (unsigned int i = 0; i < hdr->count; i++) {
+		const struct glyph *g = &glyphs[i];
+		size_t pixels = (size_t)g->cols * g->rows;
+		int codec = glyph_codec(pack, hdr, i);
+
+		if (codec < 0 ||
+		    (i > 0 && codepoints[i] <= codepoints[i - 1]) || codepoints[i] > hdr->max ||
+		    !in_pack(hdr->length, g->offset, lengths[i]) ||
+		    (pixels && g->offset == 0) ||
+		    (codec == FONT_CODEC_RAW && lengths[i] < pixels) ||
+		    (hdr->kerning && (g->kern_left >= hdr->kerning_rows ||
+				      g->kern_right >= hdr->kerning_cols))) {
+			errno = EINVAL;
+			return NULL;
+		}
+		if (lengths[i] > longest)
+			longest = lengths[i];
+	}
+
+	struct loaded_font *lf = calloc(1, sizeof(struct loaded_font));
+	if (lf == NULL)
+		return NULL;
+
+	struct font *font = &lf->font;
+	font->name = (char *)pack + hdr->name;
+	font->style = (char *)pack + hdr->style;
+	font->size = hdr->size;
+	font->dpi = hdr->dpi;
+	font->ascender = hdr->ascender;
+	font->descender = hdr->descender;
+	font->height = hdr->height;
+	font->count = hdr->count;
+	font->max = hdr->max;
+	font->codepoints = codepoints;
+	font->glyphs = glyphs;
+	font->codec = hdr->codec;
+	font->codec_data = hdr->codec_data ? pack + hdr->codec_data : NULL;
+	font->glyph_codecs = hdr->codec == FONT_CODEC_MIXED ? pack + hdr->glyph_codecs : NULL;
+	font->kerning = hdr->kerning ? (const int8_t *)(pack + hdr->kerning) : NULL;
+	font->kerning_cols = hdr->kerning_cols;
+	font->atlas = pack;
+
+	// Every bitmap must decode within its own bytes
+	uint8_t *scratch = malloc(longest + READ_AHEAD);
+	if (scratch == NULL) {
+		free(lf);
+		return NULL;
+	}
+	for (unsigned int i = 0; i < hdr->count; i++) {
+		if (!glyph_decodes(font, &glyphs[i], lengths[i],
+				   hdr->length - hdr->codec_data, scratch)) {
+			free(scratch);
+			free(lf);
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+	free(scratch);
+
+	return font;
+}
+
+/** Map the pack in 'filename' and load it. Pages of the pack are shared
+ * with any other process that maps the same file. */
+const struct font *font_load_mmap(const char *filename)
+{
+#ifdef HAVE_SYS_MMAN_H
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	size_t length = (size_t)st.st_size;
+	void *map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	struct loaded_font *lf = (struct loaded_font *)font_load_memory(map, length);
+	if (lf == NULL) {
+		int err = errno;
+		munmap(map, length);
+		errno = err;
+		return NULL;
+	}
+
+	lf->map = map;
+	lf->map_length = length;
+	return &lf->font;
+#else
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+/** Release a font returned by font_load_memory() or font_load_mmap(). */
+void font_unload(const struct font *font)
+{
+	struct loaded_font *lf = (struct loaded_font *)font;
+
+	if (lf == NULL)
+		return;
+#ifdef HAVE_SYS_MMAN_H
+	if (lf->map)
+		munmap(lf->map, lf->map_length);
+#endif
+	free(lf);
+}
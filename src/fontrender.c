@@ -7,42 +7,108 @@
  */
 
 #include <config.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 
 #include "fontem.h"
 
+/** Return the index of the glyph for 'glyph', or -1 if there is none, using
+ * the lookup the generator chose for the font. */
+static int32_t font_find_index(const struct font *font, glyph_t glyph)
+{
+	const glyph_t *lookup = font->lookup;
+	size_t count = font->count;
+
+	switch (font->lookup_type) {
+	case FONT_LOOKUP_DIRECT:
+		if (glyph < lookup[0])
+			return -1;
+		return (int32_t)lookup[1 + glyph - lookup[0]] - 1;
+
+	case FONT_LOOKUP_RANGES:
+		for (const glyph_t *r = lookup + 1; r < lookup + 1 + 3 * lookup[0]; r += 3)
+			if (glyph >= r[0] && glyph <= r[1])
+				return r[2] + (glyph - r[0]);
+		return -1;
+
+	case FONT_LOOKUP_PAGES: {
+		glyph_t page = lookup[glyph >> 8];
+		if (page == 0)
+			return -1;
+		return (int32_t)lookup[page + (glyph & 0xff)] - 1;
+	}
+
+	case FONT_LOOKUP_EYTZINGER:
+		for (size_t k = 0; k < count; k = 2 * k + 1 + (lookup[k] < glyph))
+			if (lookup[k] == glyph)
+				return lookup[count + k];
+		return -1;
+
+	default: {
+		size_t first = 0, last = count;
+		const glyph_t *codepoints = font->codepoints;
+
+		while (first < last) {
+			size_t mid = first + (last - first) / 2;
+			if (glyph <= codepoints[mid])
+				last = mid;
+			else
+				first = mid + 1;
+		}
+		return (last < count && codepoints[last] == glyph) ? (int32_t)last : -1;
+	}
+	}
+}
+
+#ifdef FONTEM_TRACE
+/** Where every glyph lookup is logged, for fontem --chars-from-trace */
+FILE *font_trace = NULL;
+#endif
+
 const struct glyph *font_get_glyph(const struct font *font, glyph_t glyph)
 {
+#ifdef FONTEM_TRACE
+	if (font_trace)
+		fprintf(font_trace, "U+%04X\t%d\t%s\t%s\n",
+			(unsigned int)glyph, font->size, font->name, font->style);
+#endif
 	if (glyph > font->max)
 		return NULL;
 
-	size_t first = 0, last = font->count;
-	const struct glyph **glyphs = font->glyphs;
+	int32_t idx = font_find_index(font, glyph);
+	return idx < 0 ? NULL : &font->glyphs[idx];
+}
 
-	while (first < last) {
-		size_t mid = first + (last - first) / 2;
-		if (glyph <= glyphs[mid]->glyph)
-			last = mid;
-		else
-			first = mid + 1;
-	}
+int16_t font_get_kerning(const struct font *font, glyph_t left, glyph_t right)
+{
+	if (font == NULL || left == 0 || right == 0 || font->kerning == NULL) return 0;
+	const struct glyph *l = font_get_glyph(font, left);
+	const struct glyph *r = font_get_glyph(font, right);
+	if (l == NULL || r == NULL) return 0;
 
-	return (last < font->count && glyphs[last]->glyph == glyph) ? *(glyphs + last) : NULL;
+	return font->kerning[l->kern_left * font->kerning_cols + r->kern_right];
 }
 
-int16_t font_get_kerning(const struct font *font, glyph_t left, glyph_t right)
+/** Return the bitmap data of a glyph, wherever the font keeps it. */
+const uint8_t *font_get_bitmap(const struct font *font, const struct glyph *glyph)
 {
-	if (font == NULL || left == 0 || right == 0) return 0;
-	const struct glyph *g = font_get_glyph(font, right);
-	if (g == NULL || g->kerning == NULL) return 0;
+	return font->atlas + glyph->offset;
+}
 
-	const struct kerning *k;
-	for (k = g->kerning; k->left != 0; k++)
-		if (k->left == left) return k->offset;
+/** Return the distance in bytes between rows of an uncompressed glyph. */
+unsigned int font_get_stride(const struct font *font, const struct glyph *glyph)
+{
+	return font->atlas_stride ? font->atlas_stride : glyph->cols;
+}
 
-	return 0;
+/** Return the FONT_CODEC_ encoding of the bitmap of 'glyph'. */
+uint8_t font_get_codec(const struct font *font, const struct glyph *glyph)
+{
+	if (font->codec == FONT_CODEC_MIXED)
+		return font->glyph_codecs[glyph - font->glyphs];
+	return font->codec;
 }
 
 int font_calculate_box(const struct font *font,
@@ -13,46 +13,69 @@
 
 #include "fontem.h"
 
+/** Return the character that shows coverage 'val'. */
+static inline uint8_t shade(uint8_t val)
+{
+	if (val < 64) return ' ';
+	else if (val < 128) return '.';
+	else if (val < 192) return '+';
+	else return 'X';
+}
+
+/** Draw a FONT_CODEC_SPANS glyph: opaque pixels are filled a span at a
+ * time, and only edge pixels are shaded one by one. */
+static void draw_spans_L(struct glyph_reader *reader, int x, int y, int width, int height,
+			 uint8_t *buf, unsigned int rows)
+{
+	struct glyph_span span;
+
+	for (unsigned int row = 0; row < rows; row++) {
+		int yofs = row + y;
+		int visible = (yofs >= 0) && (yofs < height);
+		uint8_t *line = visible ? buf + (yofs * width) : NULL;
+		int xofs = x;
+
+		while (font_reader_span(reader, &span)) {
+			xofs += span.skip;
+			for (unsigned int e = 0; e < span.edges; e++, xofs++)
+				if (visible && (xofs >= 0) && (xofs < width))
+					line[xofs] = shade(span.coverage[e]);
+
+			int from = xofs < 0 ? 0 : xofs;
+			int to = xofs + span.fill > width ? width : xofs + span.fill;
+			if (visible && from < to)
+				memset(line + from, 'X', to - from);
+			xofs += span.fill;
+		}
+	}
+}
+
 int font_draw_glyph_L(const struct font *font,
 		      int x, int y, int width, int height,
 		      uint8_t *buf, const struct glyph *glyph)
 {
 	unsigned int rows = glyph->rows, cols = glyph->cols;
-	const unsigned char *data = glyph->bitmap;
-	unsigned char count = 0, class = 0;
+	struct glyph_reader reader;
+
+	font_reader_init(&reader, font, glyph);
+
+	if (reader.codec == FONT_CODEC_SPANS) {
+		draw_spans_L(&reader, x + glyph->left, y + (font->ascender - glyph->top),
+			     width, height, buf, rows);
+		return glyph->advance;
+	}
 
 	for (unsigned int row = 0; row < rows; row++) {
 		int yofs = row + y + (font->ascender - glyph->top);
+		const uint8_t *line = font_reader_row(&reader);
 
 		for (unsigned int col = 0; col < cols; col++) {
 			int xofs = col + x + glyph->left;
 
-			uint8_t val;
-			if (font->compressed) {
-				if (count == 0) {
-					count = (*data & 0x3f) + 1;
-					class = *data >> 6;
-					data++;
-				}
-
-				if (class == 0)
-					val = *(data++);
-				else if (class == 3)
-					val = 0xff;
-				else
-					val = 0;
-				count--;
-			} else {
-				val = data[(row * cols) + col];
-			}
+			uint8_t val = line ? line[col] : font_reader_next(&reader);
 
 			if ((yofs >= 0) && (yofs < height) && (xofs >= 0) && (xofs < width)) {
-				uint8_t *pixel = buf + (yofs * width) + xofs;
-
-				if (val < 64) *pixel = ' ';
-				else if (val < 128) *pixel = '.';
-				else if (val < 192) *pixel = '+';
-				else *pixel = 'X';
+				buf[(yofs * width) + xofs] = shade(val);
 			}
 		}
 	}
@@ -73,3 +96,16 @@ int font_draw_char_L(const struct font *font,
 	return font_draw_glyph_L(font, x + kerning_offset, y, width, height,
 				 buf, g) + kerning_offset;
 }
+
+int font_draw_run_L(const struct font_run *run,
+		    int x, int y, int width, int height,
+		    uint8_t *buf)
+{
+	if (run == NULL) return -1;
+
+	for (uint16_t i = 0; i < run->count; i++)
+		font_draw_glyph_L(run->font, x + run->glyphs[i].x, y, width, height,
+				  buf, run->glyphs[i].glyph);
+
+	return run->advance;
+}
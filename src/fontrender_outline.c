@@ -0,0 +1,461 @@
+/**
+ * \file fontrender_outline.c
+ *
+ * Renders the glyphs of fonts made by "fontem --outlines" at any size, into
+ * a cache that the usual renderers draw them from.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fontem.h"
+
+/** Rows sampled in each row of pixels. A span across a pixel on each adds
+ * 64, so that a pixel wholly inside the glyph adds up to 256. */
+#define OUTLINE_SAMPLES 4
+
+/** Most lines a curve is split into */
+#define OUTLINE_MAX_SPLIT 16
+
+/** Furthest a line may stray from the curve it stands for, in 1/64 pixel */
+#define OUTLINE_TOLERANCE 16
+
+/** A glyph's outline, scaled to a size, being turned into edges. All
+ * positions are 26.6 fixed point pixels from the top left of the bitmap,
+ * with y down. */
+struct outline_walk {
+	const struct font_outlines *outlines;
+	int32_t		ppem;           /** Pixels per em, 26.6 */
+	int32_t		dx, dy;         /** Position of the origin in the bitmap */
+	int32_t		*edges;         /** x0, y0, x1, y1 of each edge, or NULL to count them */
+	uint32_t	count;          /** Edges found */
+	int32_t		x, y;           /** Current point */
+};
+
+/** Return a / b rounded down, for any sign of 'a'. */
+static int32_t floor_div(int32_t a, int32_t b)
+{
+	return a < 0 ? -((-a + b - 1) / b) : a / b;
+}
+
+/** Scale 'v', in font units, to 26.6 pixels. */
+static int32_t outline_scale(const struct font_outlines *outlines, int32_t ppem, int32_t v)
+{
+	return v * ppem / outlines->units_per_em;
+}
+
+/** Add the edge from the current point to 'x', 'y'. Horizontal edges are
+ * never crossed by a row, so they are left out. */
+static void walk_line(struct outline_walk *w, int32_t x, int32_t y)
+{
+	if (y != w->y) {
+		if (w->edges) {
+			int32_t *e = w->edges + 4 * w->count;
+
+			e[0] = w->x;
+			e[1] = w->y;
+			e[2] = x;
+			e[3] = y;
+		}
+		w->count++;
+	}
+	w->x = x;
+	w->y = y;
+}
+
+/** Add the curve from the current point through control point 'cx', 'cy'
+ * to 'x', 'y', split into lines; each split in two strays a quarter as far. */
+static void walk_curve(struct outline_walk *w, int32_t cx, int32_t cy, int32_t x, int32_t y)
+{
+	int32_t x0 = w->x, y0 = w->y;
+	int32_t ddx = x0 - 2 * cx + x, ddy = y0 - 2 * cy + y;
+	int32_t stray = ((ddx < 0 ? -ddx : ddx) + (ddy < 0 ? -ddy : ddy)) / 4;
+	int32_t n = 1;
+
+	while (stray > OUTLINE_TOLERANCE && n < OUTLINE_MAX_SPLIT) {
+		stray >>= 2;
+		n <<= 1;
+	}
+	for (int32_t i = 1; i <= n; i++) {
+		int32_t a = (n - i) * (n - i), b = 2 * i * (n - i), c = i * i;
+
+		walk_line(w, (x0 * a + cx * b + x * c) / (n * n),
+			  (y0 * a + cy * b + y * c) / (n * n));
+	}
+}
+
+/** Return whether point 'i' of the font is on the curve. */
+static int outline_on(const struct font_outlines *outlines, uint32_t i)
+{
+	return (outlines->on[i >> 3] >> (i & 7)) & 1;
+}
+
+/** Set 'x', 'y' to point 'i' of the font, in the bitmap. */
+static void outline_point(const struct outline_walk *w, uint32_t i, int32_t *x, int32_t *y)
+{
+	*x = outline_scale(w->outlines, w->ppem, w->outlines->points[2 * i]) - w->dx;
+	*y = -outline_scale(w->outlines, w->ppem, w->outlines->points[2 * i + 1]) - w->dy;
+}
+
+/** Walk every contour of 'og', adding its edges to 'w'. */
+static void walk_outline(struct outline_walk *w, const struct font_outline_glyph *og)
+{
+	const struct font_outlines *outlines = w->outlines;
+	uint32_t first = og->point;
+
+	for (uint16_t c = 0; c < og->contour_count; c++) {
+		uint32_t last = og->point + outlines->ends[og->contour + c];
+		uint32_t from = first, to = last;
+		int32_t sx, sy, px, py, qx = 0, qy = 0;
+		int pending = 0;
+
+		// Start on the curve: at the first point, the last, or the
+		// point implied between them
+		if (outline_on(outlines, first)) {
+			outline_point(w, first, &sx, &sy);
+			from++;
+		} else if (outline_on(outlines, last)) {
+			outline_point(w, last, &sx, &sy);
+			to--;
+		} else {
+			outline_point(w, first, &sx, &sy);
+			outline_point(w, last, &px, &py);
+			sx = (sx + px) / 2;
+			sy = (sy + py) / 2;
+		}
+		w->x = sx;
+		w->y = sy;
+
+		for (uint32_t i = from; i <= to; i++) {
+			outline_point(w, i, &px, &py);
+			if (outline_on(outlines, i)) {
+				if (pending)
+					walk_curve(w, qx, qy, px, py);
+				else
+					walk_line(w, px, py);
+				pending = 0;
+			} else {
+				if (pending)
+					walk_curve(w, qx, qy, (qx + px) / 2, (qy + py) / 2);
+				qx = px;
+				qy = py;
+				pending = 1;
+			}
+		}
+		if (pending)
+			walk_curve(w, qx, qy, sx, sy);
+		else
+			walk_line(w, sx, sy);
+
+		first = last + 1;
+	}
+}
+
+/** Add the part of a row from 'xa' to 'xb' to the coverage in 'acc'. */
+static void fill_span(uint16_t *acc, unsigned int cols, int32_t xa, int32_t xb)
+{
+	int32_t right = (int32_t)cols * 64;
+
+	if (xa < 0) xa = 0;
+	if (xb > right) xb = right;
+	if (xa >= xb)
+		return;
+
+	int32_t ia = xa >> 6, ib = xb >> 6;
+	if (ia == ib) {
+		acc[ia] += xb - xa;
+		return;
+	}
+	acc[ia] += 64 - (xa & 63);
+	for (int32_t i = ia + 1; i < ib; i++)
+		acc[i] += 64;
+	if (ib < (int32_t)cols)
+		acc[ib] += xb & 63;
+}
+
+/** Fill 'bitmap' with the coverage of the 'count' edges, with the non-zero
+ * winding rule. 'crossings' has room for an entry per edge, and 'acc' for
+ * one per column. */
+static void fill_outline(uint8_t *bitmap, unsigned int cols, unsigned int rows,
+			 const int32_t *edges, uint32_t count, int32_t *crossings, uint16_t *acc)
+{
+	for (unsigned int row = 0; row < rows; row++) {
+		memset(acc, 0, cols * sizeof(uint16_t));
+
+		for (int s = 0; s < OUTLINE_SAMPLES; s++) {
+			int32_t sy = (int32_t)row * 64 + s * (64 / OUTLINE_SAMPLES) + 32 / OUTLINE_SAMPLES;
+			uint32_t n = 0;
+
+			// Where the edges cross the row, in order, each with
+			// the direction of its edge in the low bit
+			for (uint32_t i = 0; i < count; i++) {
+				const int32_t *e = edges + 4 * i;
+
+				if ((e[1] <= sy) == (e[3] <= sy))
+					continue;
+
+				int32_t x = e[0] + (sy - e[1]) * (e[2] - e[0]) / (e[3] - e[1]);
+				int32_t key = x * 2 + (e[3] > e[1]);
+				uint32_t j = n++;
+
+				for (; j > 0 && crossings[j - 1] > key; j--)
+					crossings[j] = crossings[j - 1];
+				crossings[j] = key;
+			}
+
+			int winding = 0;
+			int32_t prev = 0;
+			for (uint32_t i = 0; i < n; i++) {
+				int32_t x = crossings[i] >> 1;
+
+				if (winding)
+					fill_span(acc, cols, prev, x);
+				winding += (crossings[i] & 1) ? 1 : -1;
+				prev = x;
+			}
+		}
+
+		for (unsigned int col = 0; col < cols; col++)
+			bitmap[row * cols + col] = acc[col] > 255 ? 255 : (uint8_t)acc[col];
+	}
+}
+
+/** Use 'outlines' to draw with 'cache', which keeps up to 'entry_count'
+ * glyphs in 'entries' and their bitmaps in the 'pixels_size' bytes of
+ * 'pixels'. Rendering a glyph also takes room in 'pixels' for its edges. */
+void font_cache_init(struct font_cache *cache, const struct font_outlines *outlines,
+		     struct font_cache_entry *entries, uint16_t entry_count,
+		     uint8_t *pixels, uint32_t pixels_size)
+{
+	memset(cache, 0, sizeof(*cache));
+	memset(entries, 0, entry_count * sizeof(struct font_cache_entry));
+	cache->outlines = outlines;
+	cache->entries = entries;
+	cache->entry_count = entry_count;
+	cache->pixels = pixels;
+	cache->pixels_size = pixels_size;
+}
+
+/** Move the bitmaps of the glyphs in 'cache' to the start of its pixels,
+ * in the order they are in, so that the free space is in one piece. */
+static void cache_compact(struct font_cache *cache)
+{
+	uint32_t next = 0;
+
+	for (;;) {
+		struct font_cache_entry *low = NULL;
+
+		for (uint16_t i = 0; i < cache->entry_count; i++) {
+			struct font_cache_entry *e = &cache->entries[i];
+
+			if (e->source && e->glyph.cols && e->glyph.rows && e->glyph.offset >= next &&
+			    (low == NULL || e->glyph.offset < low->glyph.offset))
+				low = e;
+		}
+		if (low == NULL)
+			break;
+
+		uint32_t length = (uint32_t)low->glyph.cols * low->glyph.rows;
+		memmove(cache->pixels + next, cache->pixels + low->glyph.offset, length);
+		low->glyph.offset = next;
+		next += length;
+	}
+	cache->pixels_used = next;
+}
+
+/** Drop the least recently drawn glyph from 'cache', and return its entry,
+ * or NULL if there are none. */
+static struct font_cache_entry *cache_evict(struct font_cache *cache)
+{
+	struct font_cache_entry *lru = NULL;
+
+	for (uint16_t i = 0; i < cache->entry_count; i++) {
+		struct font_cache_entry *e = &cache->entries[i];
+
+		if (e->source && (lru == NULL || cache->clock - e->used > cache->clock - lru->used))
+			lru = e;
+	}
+	if (lru) {
+		lru->source = NULL;
+		cache_compact(cache);
+	}
+	return lru;
+}
+
+/** Return the glyph for 'glyph' at 'size' from 'cache', rendering it from
+ * its outline if it isn't there, or NULL if the font has no such character
+ * or the cache can't hold it. The bitmap is at the glyph's offset in the
+ * cache's pixels, and is only valid until the next glyph is rendered. */
+const struct glyph *font_cache_get(struct font_cache *cache, int size, glyph_t glyph)
+{
+	const struct font_outlines *outlines = cache->outlines;
+	const struct font *font = outlines->font;
+	const struct glyph *source = font_get_glyph(font, glyph);
+
+	if (source == NULL || size <= 0 || size > UINT16_MAX)
+		return NULL;
+
+	cache->clock++;
+	for (uint16_t i = 0; i < cache->entry_count; i++) {
+		struct font_cache_entry *e = &cache->entries[i];
+
+		if (e->source == source && e->size == size) {
+			e->used = cache->clock;
+			cache->hits++;
+			return &e->glyph;
+		}
+	}
+	cache->misses++;
+
+	// The bitmap covers every point, which bounds the curves too
+	const struct font_outline_glyph *og = &outlines->glyphs[source - font->glyphs];
+	struct outline_walk w = {
+		.outlines	= outlines,
+		.ppem		= size * font->dpi * 64 / 72,
+	};
+	int32_t x0 = INT32_MAX, y0 = INT32_MAX, x1 = INT32_MIN, y1 = INT32_MIN;
+	uint32_t points = og->contour_count ?
+			  outlines->ends[og->contour + og->contour_count - 1] + 1 : 0;
+	for (uint32_t i = og->point; i < og->point + points; i++) {
+		int32_t x, y;
+
+		outline_point(&w, i, &x, &y);
+		if (x < x0) x0 = x;
+		if (x > x1) x1 = x;
+		if (y < y0) y0 = y;
+		if (y > y1) y1 = y;
+	}
+	int32_t left = 0, top = 0;
+	uint32_t cols = 0, rows = 0;
+	if (points) {
+		left = floor_div(x0, 64);
+		top = floor_div(y0, 64);
+		cols = -floor_div(-x1, 64) - left;
+		rows = -floor_div(-y1, 64) - top;
+	}
+	w.dx = left * 64;
+	w.dy = top * 64;
+	walk_outline(&w, og);
+
+	// Room for the bitmap, then the edges, crossings and coverage of a
+	// row, aligned for the edges
+	uint32_t length = cols * rows;
+	uint32_t needed = length + 3 + w.count * 5 * sizeof(int32_t) + cols * sizeof(uint16_t);
+	struct font_cache_entry *entry = NULL;
+
+	if (needed > cache->pixels_size)
+		return NULL;
+	for (uint16_t i = 0; i < cache->entry_count && entry == NULL; i++)
+		if (cache->entries[i].source == NULL)
+			entry = &cache->entries[i];
+	if (entry == NULL)
+		entry = cache_evict(cache);
+	while (entry && cache->pixels_size - cache->pixels_used < needed)
+		if (cache_evict(cache) == NULL)
+			return NULL;
+	if (entry == NULL)
+		return NULL;
+
+	uint8_t *bitmap = cache->pixels + cache->pixels_used;
+	uintptr_t scratch = ((uintptr_t)(bitmap + length) + 3) & ~(uintptr_t)3;
+	int32_t *edges = (int32_t *)scratch;
+	int32_t *crossings = edges + 4 * w.count;
+	uint16_t *acc = (uint16_t *)(crossings + w.count);
+
+	w.edges = edges;
+	w.count = 0;
+	walk_outline(&w, og);
+	fill_outline(bitmap, cols, rows, edges, w.count, crossings, acc);
+
+	entry->source = source;
+	entry->size = (uint16_t)size;
+	entry->used = cache->clock;
+	entry->glyph = *source;
+	entry->glyph.left = (int16_t)left;
+	entry->glyph.top = (int16_t)-top;
+	entry->glyph.advance = (int16_t)((outline_scale(outlines, w.ppem, og->advance) + 32) >> 6);
+	entry->glyph.cols = (uint16_t)cols;
+	entry->glyph.rows = (uint16_t)rows;
+	entry->glyph.offset = length ? cache->pixels_used : 0;
+	cache->pixels_used += length;
+
+	return &entry->glyph;
+}
+
+/** Find 'glyph' at 'size' in 'cache', and set up 'view' so that the usual
+ * renderers draw it from the cache, and 'kerning' to its kerning after
+ * 'prev'. Returns NULL if it can't be drawn. */
+static const struct glyph *outline_glyph(struct font_cache *cache, int size,
+					 glyph_t glyph, glyph_t prev,
+					 struct font *view, int *kerning)
+{
+	const struct font_outlines *outlines = cache->outlines;
+	const struct font *font = outlines->font;
+	const struct glyph *g = font_cache_get(cache, size, glyph);
+
+	if (g == NULL)
+		return NULL;
+
+	int32_t ppem = size * font->dpi * 64 / 72;
+	memset(view, 0, sizeof(*view));
+	view->ascender = (int16_t)((outline_scale(outlines, ppem, outlines->ascender) + 63) >> 6);
+	view->codec = FONT_CODEC_RAW;
+	view->atlas = cache->pixels;
+
+	int k = font_get_kerning(font, prev, glyph) * size;
+	*kerning = k < 0 ? -((-k + font->size / 2) / font->size) : (k + font->size / 2) / font->size;
+	return g;
+}
+
+int font_draw_char_outline_L(struct font_cache *cache, int size,
+			     int x, int y, int width, int height,
+			     uint8_t *buf, glyph_t glyph, glyph_t prev)
+{
+	struct font view;
+	int kerning_offset;
+
+	if (cache == NULL) return -1;
+	const struct glyph *g = outline_glyph(cache, size, glyph, prev, &view, &kerning_offset);
+	if (g == NULL) return -2;
+
+	return font_draw_glyph_L(&view, x + kerning_offset, y, width, height,
+				 buf, g) + kerning_offset;
+}
+
+int font_draw_char_outline_RGBA32(struct font_cache *cache, int size,
+				  int x, int y, int width, int height,
+				  uint8_t *buf, glyph_t glyph, glyph_t prev,
+				  uint32_t rgb)
+{
+	struct font view;
+	int kerning_offset;
+
+	if (cache == NULL) return -1;
+	const struct glyph *g = outline_glyph(cache, size, glyph, prev, &view, &kerning_offset);
+	if (g == NULL) return -2;
+
+	return font_draw_glyph_RGBA32(&view, x + kerning_offset, y, width, height,
+				      buf, g, rgb) + kerning_offset;
+}
+
+int font_draw_char_outline_RGB16(struct font_cache *cache, int size,
+				 int x, int y, int width, int height,
+				 uint8_t *buf, glyph_t glyph, glyph_t prev,
+				 uint16_t rgb)
+{
+	struct font view;
+	int kerning_offset;
+
+	if (cache == NULL) return -1;
+	const struct glyph *g = outline_glyph(cache, size, glyph, prev, &view, &kerning_offset);
+	if (g == NULL) return -2;
+
+	return font_draw_glyph_RGB16(&view, x + kerning_offset, y, width, height,
+				     buf, g, rgb) + kerning_offset;
+}
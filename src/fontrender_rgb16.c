@@ -13,47 +13,76 @@
 
 #include "fontem.h"
 
+/** Blend 'rgb' over the pixel by the coverage 'val'. */
+static inline void blend_RGB16(uint16_t *pixel, uint16_t rgb, uint8_t val)
+{
+	uint16_t r = alpha_blend(rgb16_get_r(*pixel), 0, rgb16_get_r(rgb), val);
+	uint16_t g = alpha_blend(rgb16_get_g(*pixel), 0, rgb16_get_g(rgb), val);
+	uint16_t b = alpha_blend(rgb16_get_b(*pixel), 0, rgb16_get_b(rgb), val);
+
+	*pixel = rgb16_combine(r, g, b);
+}
+
+/** Draw a FONT_CODEC_SPANS glyph: opaque pixels are filled a span at a
+ * time, and only edge pixels are blended one by one. */
+static void draw_spans_RGB16(struct glyph_reader *reader, int x, int y, int width, int height,
+			     uint8_t *buf, unsigned int rows, uint16_t rgb)
+{
+	struct glyph_span span;
+
+	// Opaque pixels blend to the same value whatever was there
+	uint16_t solid = 0;
+	blend_RGB16(&solid, rgb, 0xff);
+
+	for (unsigned int row = 0; row < rows; row++) {
+		int yofs = row + y;
+		int visible = (yofs >= 0) && (yofs < height);
+		uint16_t *line = visible ? (uint16_t *)(buf + (yofs * width * 2)) : NULL;
+		int xofs = x;
+
+		while (font_reader_span(reader, &span)) {
+			xofs += span.skip;
+			for (unsigned int e = 0; e < span.edges; e++, xofs++)
+				if (visible && (xofs >= 0) && (xofs < width))
+					blend_RGB16(&line[xofs], rgb, span.coverage[e]);
+
+			int from = xofs < 0 ? 0 : xofs;
+			int to = xofs + span.fill > width ? width : xofs + span.fill;
+			if (visible)
+				for (int i = from; i < to; i++)
+					line[i] = solid;
+			xofs += span.fill;
+		}
+	}
+}
+
 int font_draw_glyph_RGB16(const struct font *font,
 			  int x, int y, int width, int height,
 			  uint8_t *buf, const struct glyph *glyph,
 			  uint16_t rgb)
 {
 	unsigned int rows = glyph->rows, cols = glyph->cols;
-	const unsigned char *data = glyph->bitmap;
-	unsigned char count = 0, class = 0;
+	struct glyph_reader reader;
+
+	font_reader_init(&reader, font, glyph);
+
+	if (reader.codec == FONT_CODEC_SPANS) {
+		draw_spans_RGB16(&reader, x + glyph->left, y + (font->ascender - glyph->top),
+				 width, height, buf, rows, rgb);
+		return glyph->advance;
+	}
 
 	for (unsigned int row = 0; row < rows; row++) {
 		int yofs = row + y + (font->ascender - glyph->top);
+		const uint8_t *line = font_reader_row(&reader);
 
 		for (unsigned int col = 0; col < cols; col++) {
 			int xofs = col + x + glyph->left;
 
-			uint8_t val;
-			if (font->compressed) {
-				if (count == 0) {
-					count = (*data & 0x3f) + 1;
-					class = *(data++) >> 6;
-				}
-
-				if (class == 0)
-					val = *(data++);
-				else if (class == 3)
-					val = 0xff;
-				else
-					val = 0;
-				count--;
-			} else {
-				val = data[(row * glyph->cols) + col];
-			}
+			uint8_t val = line ? line[col] : font_reader_next(&reader);
 
 			if ((yofs >= 0) && (yofs < height) && (xofs >= 0) && (xofs < width)) {
-				uint16_t *pixel = (uint16_t *)(buf + (yofs * width * 2) + (xofs * 2));
-
-				uint16_t r = alpha_blend(rgb16_get_r(*pixel), 0, rgb16_get_r(rgb), val);
-				uint16_t g = alpha_blend(rgb16_get_g(*pixel), 0, rgb16_get_g(rgb), val);
-				uint16_t b = alpha_blend(rgb16_get_b(*pixel), 0, rgb16_get_b(rgb), val);
-
-				*pixel = rgb16_combine(r, g, b);
+				blend_RGB16((uint16_t *)(buf + (yofs * width * 2) + (xofs * 2)), rgb, val);
 			}
 		}
 	}
@@ -100,3 +129,119 @@ char *font_draw_string_RGB16(const struct font *font,
 
 	return str;
 }
+
+int font_draw_run_RGB16(const struct font_run *run,
+			int x, int y, int width, int height,
+			uint8_t *buf, uint16_t rgb)
+{
+	if (run == NULL) return -1;
+
+	for (uint16_t i = 0; i < run->count; i++)
+		font_draw_glyph_RGB16(run->font, x + run->glyphs[i].x, y, width, height,
+				      buf, run->glyphs[i].glyph, rgb);
+
+	return run->advance;
+}
+
+/** Draw 'glyph' of the font of 'tint' in its color number 'color', which
+ * must be from 0 to tint->color_count - 1; nothing is checked here, see
+ * font_draw_char_RGB16_tinted(). */
+int font_draw_glyph_RGB16_tinted(const struct font_tint *tint,
+				 int x, int y, int width, int height,
+				 uint8_t *buf, const struct glyph *glyph,
+				 int color)
+{
+	const struct font *font = tint->font;
+	const uint8_t *coverage = tint->coverage + tint->offsets[glyph - font->glyphs];
+	const uint32_t *premultiplied = tint->premultiplied + color * (FONT_TINT_LEVELS + 1);
+	unsigned int rows = glyph->rows, cols = glyph->cols;
+
+	for (unsigned int row = 0; row < rows; row++) {
+		int yofs = row + y + (font->ascender - glyph->top);
+
+		for (unsigned int col = 0; col < cols; col++) {
+			int xofs = col + x + glyph->left;
+
+			uint8_t val = *coverage++;
+
+			if (val && (yofs >= 0) && (yofs < height) && (xofs >= 0) && (xofs < width)) {
+				uint16_t *pixel = (uint16_t *)(buf + (yofs * width * 2) + (xofs * 2));
+
+				// The color is already scaled by the coverage, and
+				// the background is scaled by what is left
+				uint32_t bg = rgb16_spread(*pixel);
+				bg = ((bg * (FONT_TINT_LEVELS - val)) >> 5) & RGB16_SPREAD_MASK;
+				*pixel = rgb16_unspread(bg + premultiplied[val]);
+			}
+		}
+	}
+
+	return glyph->advance;
+}
+
+int font_draw_char_RGB16_tinted(const struct font_tint *tint,
+				int x, int y, int width, int height,
+				uint8_t *buf, glyph_t glyph, glyph_t prev,
+				int color)
+{
+	if (tint == NULL || color < 0 || color >= tint->color_count) return -1;
+	const struct glyph *g = font_get_glyph(tint->font, glyph);
+	if (g == NULL) return -2;
+
+	int kerning_offset = font_get_kerning(tint->font, prev, glyph);
+
+	return font_draw_glyph_RGB16_tinted(tint, x + kerning_offset, y, width, height,
+					    buf, g, color) + kerning_offset;
+}
+
+int font_draw_glyph_RGB16_lcd(const struct font *font,
+			      int x, int y, int width, int height,
+			      uint8_t *buf, const struct glyph *glyph,
+			      uint16_t rgb)
+{
+	unsigned int rows = glyph->rows, cols = glyph->cols;
+	struct glyph_reader reader;
+
+	font_reader_init(&reader, font, glyph);
+
+	for (unsigned int row = 0; row < rows; row++) {
+		int yofs = row + y + (font->ascender - glyph->top);
+		const uint8_t *line = font_reader_row(&reader);
+
+		// Each pixel is the coverage of its red, green and blue stripes
+		for (unsigned int col = 0; col + 2 < cols; col += 3) {
+			int xofs = col / 3 + x + glyph->left;
+
+			uint8_t vr = line ? line[col] : font_reader_next(&reader);
+			uint8_t vg = line ? line[col + 1] : font_reader_next(&reader);
+			uint8_t vb = line ? line[col + 2] : font_reader_next(&reader);
+
+			if ((yofs >= 0) && (yofs < height) && (xofs >= 0) && (xofs < width)) {
+				uint16_t *pixel = (uint16_t *)(buf + (yofs * width * 2) + (xofs * 2));
+
+				uint16_t r = alpha_blend(rgb16_get_r(*pixel), 0, rgb16_get_r(rgb), vr);
+				uint16_t g = alpha_blend(rgb16_get_g(*pixel), 0, rgb16_get_g(rgb), vg);
+				uint16_t b = alpha_blend(rgb16_get_b(*pixel), 0, rgb16_get_b(rgb), vb);
+
+				*pixel = rgb16_combine(r, g, b);
+			}
+		}
+	}
+
+	return glyph->advance;
+}
+
+int font_draw_char_RGB16_lcd(const struct font *font,
+			     int x, int y, int width, int height,
+			     uint8_t *buf, glyph_t glyph, glyph_t prev,
+			     uint16_t rgb)
+{
+	if (font == NULL) return -1;
+	const struct glyph *g = font_get_glyph(font, glyph);
+	if (g == NULL) return -2;
+
+	int kerning_offset = font_get_kerning(font, prev, glyph);
+
+	return font_draw_glyph_RGB16_lcd(font, x + kerning_offset, y, width, height,
+					 buf, g, rgb) + kerning_offset;
+}
@@ -13,6 +13,48 @@
 
 #include "fontem.h"
 
+/** Draw a FONT_CODEC_SPANS glyph: opaque pixels are filled a span at a
+ * time, and only edge pixels are blended one by one. */
+static void draw_spans_RGBA32(struct glyph_reader *reader, int x, int y, int width, int height,
+			      uint8_t *buf, unsigned rows, uint32_t rgb)
+{
+	uint8_t r = rgba32_get_r(rgb);
+	uint8_t g = rgba32_get_g(rgb);
+	uint8_t b = rgba32_get_b(rgb);
+	struct glyph_span span;
+
+	// Opaque pixels blend to the same value whatever was there
+	uint8_t solid[3] = { blend(0, r, 0xff), blend(0, g, 0xff), blend(0, b, 0xff) };
+
+	for (unsigned row = 0; row < rows; row++) {
+		int yofs = row + y;
+		int visible = (yofs >= 0) && (yofs < height);
+		uint8_t *line = visible ? buf + (yofs * width * 3) : NULL;
+		int xofs = x;
+
+		while (font_reader_span(reader, &span)) {
+			xofs += span.skip;
+			for (unsigned e = 0; e < span.edges; e++, xofs++) {
+				if (visible && (xofs >= 0) && (xofs < width)) {
+					uint8_t *pixel = line + (xofs * 3);
+					uint8_t val = span.coverage[e];
+
+					pixel[0] = blend(pixel[0], r, val);
+					pixel[1] = blend(pixel[1], g, val);
+					pixel[2] = blend(pixel[2], b, val);
+				}
+			}
+
+			int from = xofs < 0 ? 0 : xofs;
+			int to = xofs + span.fill > width ? width : xofs + span.fill;
+			if (visible)
+				for (int i = from; i < to; i++)
+					memcpy(line + (i * 3), solid, 3);
+			xofs += span.fill;
+		}
+	}
+}
+
 int font_draw_glyph_RGBA32(const struct font *font,
 			   int x, int y, int width, int height,
 			   uint8_t *buf, const struct glyph *glyph,
@@ -23,32 +65,24 @@ int font_draw_glyph_RGBA32(const struct font *font,
 	uint8_t b = rgba32_get_b(rgb);
 
 	unsigned rows = glyph->rows, cols = glyph->cols;
-	const unsigned char *data = glyph->bitmap;
-	unsigned char count = 0, class = 0;
+	struct glyph_reader reader;
+
+	font_reader_init(&reader, font, glyph);
+
+	if (reader.codec == FONT_CODEC_SPANS) {
+		draw_spans_RGBA32(&reader, x + glyph->left, y + (font->ascender - glyph->top),
+				  width, height, buf, rows, rgb);
+		return glyph->advance;
+	}
 
 	for (unsigned row = 0; row < rows; row++) {
 		int yofs = row + y + (font->ascender - glyph->top);
+		const uint8_t *line = font_reader_row(&reader);
 
 		for (unsigned col = 0; col < cols; col++) {
 			int xofs = col + x + glyph->left;
 
-			uint8_t val;
-			if (font->compressed) {
-				if (count == 0) {
-					count = (*data & 0x3f) + 1;
-					class = *(data++) >> 6;
-				}
-
-				if (class == 0)
-					val = *(data++);
-				else if (class == 3)
-					val = 0xff;
-				else
-					val = 0;
-				count--;
-			} else {
-				val = data[(row * cols) + col];
-			}
+			uint8_t val = line ? line[col] : font_reader_next(&reader);
 
 			if ((yofs >= 0) && (yofs < height) && (xofs >= 0) && (xofs < width)) {
 				uint8_t *pixel = buf + (yofs * width * 3) + (xofs * 3);
@@ -78,3 +112,71 @@ int font_draw_char_RGBA32(const struct font *font,
 	return font_draw_glyph_RGBA32(font, x + kerning_offset, y, width, height,
 				      buf, g, rgb) + kerning_offset;
 }
+
+int font_draw_run_RGBA32(const struct font_run *run,
+			 int x, int y, int width, int height,
+			 uint8_t *buf, uint32_t rgb)
+{
+	if (run == NULL) return -1;
+
+	for (uint16_t i = 0; i < run->count; i++)
+		font_draw_glyph_RGBA32(run->font, x + run->glyphs[i].x, y, width, height,
+				       buf, run->glyphs[i].glyph, rgb);
+
+	return run->advance;
+}
+
+int font_draw_glyph_RGBA32_lcd(const struct font *font,
+			       int x, int y, int width, int height,
+			       uint8_t *buf, const struct glyph *glyph,
+			       uint32_t rgb)
+{
+	uint8_t r = rgba32_get_r(rgb);
+	uint8_t g = rgba32_get_g(rgb);
+	uint8_t b = rgba32_get_b(rgb);
+
+	unsigned rows = glyph->rows, cols = glyph->cols;
+	struct glyph_reader reader;
+
+	font_reader_init(&reader, font, glyph);
+
+	for (unsigned row = 0; row < rows; row++) {
+		int yofs = row + y + (font->ascender - glyph->top);
+		const uint8_t *line = font_reader_row(&reader);
+
+		// Each pixel is the coverage of its red, green and blue stripes
+		for (unsigned col = 0; col + 2 < cols; col += 3) {
+			int xofs = col / 3 + x + glyph->left;
+
+			uint8_t vr = line ? line[col] : font_reader_next(&reader);
+			uint8_t vg = line ? line[col + 1] : font_reader_next(&reader);
+			uint8_t vb = line ? line[col + 2] : font_reader_next(&reader);
+
+			if ((yofs >= 0) && (yofs < height) && (xofs >= 0) && (xofs < width)) {
+				uint8_t *pixel = buf + (yofs * width * 3) + (xofs * 3);
+				*pixel = blend(*pixel, r, vr);
+				pixel++;
+				*pixel = blend(*pixel, g, vg);
+				pixel++;
+				*pixel = blend(*pixel, b, vb);
+			}
+		}
+	}
+
+	return glyph->advance;
+}
+
+int font_draw_char_RGBA32_lcd(const struct font *font,
+			      int x, int y, int width, int height,
+			      uint8_t *buf, glyph_t glyph, glyph_t prev,
+			      uint32_t rgb)
+{
+	if (font == NULL) return -1;
+	const struct glyph *g = font_get_glyph(font, glyph);
+	if (g == NULL) return -2;
+
+	int kerning_offset = font_get_kerning(font, prev, glyph);
+
+	return font_draw_glyph_RGBA32_lcd(font, x + kerning_offset, y, width, height,
+					  buf, g, rgb) + kerning_offset;
+}
@@ -0,0 +1,262 @@
+/**
+ * \file fontrender_sdf.c
+ *
+ * Draws fonts made by "fontem --sdf" at any size, by sampling the distance
+ * field of each glyph and turning the distance into coverage.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fontem.h"
+
+/** Where a glyph's distance field lands when drawn at some size, and how to
+ * sample it there. Positions in the field are 16.16 fixed point. */
+struct sdf_sampler {
+	const uint8_t	*field;         /** The glyph's distance field */
+	unsigned int	stride;         /** Bytes between its rows */
+	int		cols, rows;     /** Size of the field */
+	int32_t		step;           /** Field pixels per pixel drawn */
+	int32_t		u0, v0;         /** Field position of the centre of the first pixel drawn */
+	int		x0, y0;         /** First pixel drawn, from the pen position on the baseline */
+	int		width, height;  /** Pixels drawn */
+	int32_t		ramp;           /** Field value, in 8.8, that changes across one pixel drawn */
+	int32_t		rcp;            /** (256 << 16) / ramp */
+	int		baseline;       /** Baseline, from the top of the line */
+};
+
+/** Scale 'v', a distance at the size of the fields, to 'size'. */
+static int sdf_scale(int v, int size, int font_size)
+{
+	if (v < 0)
+		return -((-v * size + font_size / 2) / font_size);
+	return (v * size + font_size / 2) / font_size;
+}
+
+/** Return a / b rounded down, for any sign of 'a'. */
+static int floor_div(int a, int b)
+{
+	return a < 0 ? -((-a + b - 1) / b) : a / b;
+}
+
+/** Work out where 'glyph' of 'sdf' is drawn at 'size', and how. */
+static void sdf_setup(struct sdf_sampler *s, const struct font_sdf *sdf, int size,
+		      const struct glyph *glyph)
+{
+	const struct font *font = sdf->font;
+	int font_size = font->size;
+	int left = glyph->left, top = glyph->top;
+
+	s->field = font_get_bitmap(font, glyph);
+	s->stride = font_get_stride(font, glyph);
+	s->cols = glyph->cols;
+	s->rows = glyph->rows;
+	s->step = (int32_t)(((int64_t)font_size << 16) / size);
+
+	// The pixels the field covers at 'size', rounded outwards
+	s->x0 = floor_div(left * size, font_size);
+	s->width = glyph->cols ? -floor_div(-(left + s->cols) * size, font_size) - s->x0 : 0;
+	s->y0 = floor_div(-top * size, font_size);
+	s->height = glyph->rows ? -floor_div(-(s->rows - top) * size, font_size) - s->y0 : 0;
+	s->u0 = (2 * s->x0 + 1) * s->step / 2 - (left << 16) - 0x8000;
+	s->v0 = (2 * s->y0 + 1) * s->step / 2 + (top << 16) - 0x8000;
+
+	s->ramp = s->step / (2 * sdf->spread);
+	if (s->ramp < 2)
+		s->ramp = 2;
+	s->rcp = (256 << 16) / s->ramp;
+	s->baseline = sdf_scale(font->ascender, size, font_size);
+}
+
+/** Return the field value at row 'iy', column 'ix'; everything beyond the
+ * field is far outside the glyph. */
+static inline int sdf_fetch(const struct sdf_sampler *s, int ix, int iy)
+{
+	if (ix < 0 || iy < 0 || ix >= s->cols || iy >= s->rows)
+		return 0;
+	return s->field[iy * s->stride + ix];
+}
+
+/** Return the coverage, 0-255, of the pixel drawn at column 'i' and row 'j'
+ * of the glyph set up in 's'. The field is sampled bilinearly, and the
+ * coverage rises along a smoothstep across one pixel of the outline. */
+static inline uint8_t sdf_coverage(const struct sdf_sampler *s, int i, int j)
+{
+	int32_t u = s->u0 + i * s->step, v = s->v0 + j * s->step;
+	int ix = u >> 16, iy = v >> 16;
+	int32_t fu = (u >> 8) & 0xff, fv = (v >> 8) & 0xff;
+
+	int32_t upper = sdf_fetch(s, ix, iy) * (256 - fu) + sdf_fetch(s, ix + 1, iy) * fu;
+	int32_t lower = sdf_fetch(s, ix, iy + 1) * (256 - fu) + sdf_fetch(s, ix + 1, iy + 1) * fu;
+	int32_t e = ((upper * (256 - fv) + lower * fv) >> 8) - (FONT_SDF_EDGE << 8);
+
+	if (e <= -s->ramp / 2)
+		return 0;
+	if (e >= s->ramp / 2)
+		return 255;
+
+	int32_t t = 128 + ((e * s->rcp) >> 16);
+	int32_t cov = (t * t * (768 - 2 * t)) >> 16;
+	return cov > 255 ? 255 : (uint8_t)cov;
+}
+
+int font_draw_glyph_sdf_L(const struct font_sdf *sdf, int size,
+			  int x, int y, int width, int height,
+			  uint8_t *buf, const struct glyph *glyph)
+{
+	struct sdf_sampler s;
+
+	sdf_setup(&s, sdf, size, glyph);
+
+	for (int row = 0; row < s.height; row++) {
+		int yofs = y + s.baseline + s.y0 + row;
+
+		if ((yofs < 0) || (yofs >= height))
+			continue;
+		for (int col = 0; col < s.width; col++) {
+			int xofs = x + s.x0 + col;
+
+			if ((xofs < 0) || (xofs >= width))
+				continue;
+
+			uint8_t val = sdf_coverage(&s, col, row);
+			uint8_t *pixel = buf + (yofs * width) + xofs;
+
+			if (val < 64) *pixel = ' ';
+			else if (val < 128) *pixel = '.';
+			else if (val < 192) *pixel = '+';
+			else *pixel = 'X';
+		}
+	}
+
+	return sdf_scale(glyph->advance, size, sdf->font->size);
+}
+
+int font_draw_char_sdf_L(const struct font_sdf *sdf, int size,
+			 int x, int y, int width, int height,
+			 uint8_t *buf, glyph_t glyph, glyph_t prev)
+{
+	if (sdf == NULL || size <= 0) return -1;
+	const struct glyph *g = font_get_glyph(sdf->font, glyph);
+	if (g == NULL) return -2;
+
+	int kerning_offset = sdf_scale(font_get_kerning(sdf->font, prev, glyph),
+				       size, sdf->font->size);
+
+	return font_draw_glyph_sdf_L(sdf, size, x + kerning_offset, y, width, height,
+				     buf, g) + kerning_offset;
+}
+
+int font_draw_glyph_sdf_RGBA32(const struct font_sdf *sdf, int size,
+			       int x, int y, int width, int height,
+			       uint8_t *buf, const struct glyph *glyph,
+			       uint32_t rgb)
+{
+	uint8_t r = rgba32_get_r(rgb);
+	uint8_t g = rgba32_get_g(rgb);
+	uint8_t b = rgba32_get_b(rgb);
+	struct sdf_sampler s;
+
+	sdf_setup(&s, sdf, size, glyph);
+
+	for (int row = 0; row < s.height; row++) {
+		int yofs = y + s.baseline + s.y0 + row;
+
+		if ((yofs < 0) || (yofs >= height))
+			continue;
+		for (int col = 0; col < s.width; col++) {
+			int xofs = x + s.x0 + col;
+
+			if ((xofs < 0) || (xofs >= width))
+				continue;
+
+			uint8_t val = sdf_coverage(&s, col, row);
+			if (val == 0)
+				continue;
+
+			uint8_t *pixel = buf + (yofs * width * 3) + (xofs * 3);
+			*pixel = blend(*pixel, r, val);
+			pixel++;
+			*pixel = blend(*pixel, g, val);
+			pixel++;
+			*pixel = blend(*pixel, b, val);
+		}
+	}
+
+	return sdf_scale(glyph->advance, size, sdf->font->size);
+}
+
+int font_draw_char_sdf_RGBA32(const struct font_sdf *sdf, int size,
+			      int x, int y, int width, int height,
+			      uint8_t *buf, glyph_t glyph, glyph_t prev,
+			      uint32_t rgb)
+{
+	if (sdf == NULL || size <= 0) return -1;
+	const struct glyph *g = font_get_glyph(sdf->font, glyph);
+	if (g == NULL) return -2;
+
+	int kerning_offset = sdf_scale(font_get_kerning(sdf->font, prev, glyph),
+				       size, sdf->font->size);
+
+	return font_draw_glyph_sdf_RGBA32(sdf, size, x + kerning_offset, y, width, height,
+					  buf, g, rgb) + kerning_offset;
+}
+
+int font_draw_glyph_sdf_RGB16(const struct font_sdf *sdf, int size,
+			      int x, int y, int width, int height,
+			      uint8_t *buf, const struct glyph *glyph,
+			      uint16_t rgb)
+{
+	struct sdf_sampler s;
+
+	sdf_setup(&s, sdf, size, glyph);
+
+	for (int row = 0; row < s.height; row++) {
+		int yofs = y + s.baseline + s.y0 + row;
+
+		if ((yofs < 0) || (yofs >= height))
+			continue;
+		for (int col = 0; col < s.width; col++) {
+			int xofs = x + s.x0 + col;
+
+			if ((xofs < 0) || (xofs >= width))
+				continue;
+
+			uint8_t val = sdf_coverage(&s, col, row);
+			if (val == 0)
+				continue;
+
+			uint16_t *pixel = (uint16_t *)(buf + (yofs * width * 2) + (xofs * 2));
+
+			uint16_t r = alpha_blend(rgb16_get_r(*pixel), 0, rgb16_get_r(rgb), val);
+			uint16_t g = alpha_blend(rgb16_get_g(*pixel), 0, rgb16_get_g(rgb), val);
+			uint16_t b = alpha_blend(rgb16_get_b(*pixel), 0, rgb16_get_b(rgb), val);
+
+			*pixel = rgb16_combine(r, g, b);
+		}
+	}
+
+	return sdf_scale(glyph->advance, size, sdf->font->size);
+}
+
+int font_draw_char_sdf_RGB16(const struct font_sdf *sdf, int size,
+			     int x, int y, int width, int height,
+			     uint8_t *buf, glyph_t glyph, glyph_t prev,
+			     uint16_t rgb)
+{
+	if (sdf == NULL || size <= 0) return -1;
+	const struct glyph *g = font_get_glyph(sdf->font, glyph);
+	if (g == NULL) return -2;
+
+	int kerning_offset = sdf_scale(font_get_kerning(sdf->font, prev, glyph),
+				       size, sdf->font->size);
+
+	return font_draw_glyph_sdf_RGB16(sdf, size, x + kerning_offset, y, width, height,
+					 buf, g, rgb) + kerning_offset;
+}
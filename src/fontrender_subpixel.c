@@ -0,0 +1,117 @@
+/**
+ * \file fontrender_subpixel.c
+ *
+ * Draws fonts made by "fontem --subpixel" with the pen in 1/64 pixels, each
+ * glyph taken from the phase nearest the pen.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fontem.h"
+
+/** Return a / b rounded down, for any sign of 'a'. */
+static int32_t floor_div(int32_t a, int32_t b)
+{
+	return a < 0 ? -((-a + b - 1) / b) : a / b;
+}
+
+/** Return the glyph of 'sp' for 'glyph' with the pen at 'x', in 1/64
+ * pixels, from the phase nearest the pen. The font of that phase is put in
+ * 'font', and the whole pixel to draw the glyph at in 'px'. */
+static const struct glyph *subpixel_glyph(const struct font_subpixel *sp, int32_t x,
+					  glyph_t glyph, const struct font **font, int *px)
+{
+	const struct glyph *g = font_get_glyph(sp->font, glyph);
+	if (g == NULL) return NULL;
+
+	int32_t step = floor_div(x * sp->phases + 32, 64);
+	int32_t whole = floor_div(step, sp->phases);
+
+	*font = sp->phase_fonts[step - whole * sp->phases];
+	*px = whole;
+	return &(*font)->glyphs[g - sp->font->glyphs];
+}
+
+int32_t font_draw_char_subpixel_L(const struct font_subpixel *sp,
+				  int32_t x, int y, int width, int height,
+				  uint8_t *buf, glyph_t glyph, glyph_t prev)
+{
+	if (sp == NULL) return -1;
+
+	int32_t kerning_offset = font_get_kerning(sp->font, prev, glyph) * 64;
+	const struct font *font;
+	int px;
+	const struct glyph *g = subpixel_glyph(sp, x + kerning_offset, glyph, &font, &px);
+	if (g == NULL) return -2;
+
+	font_draw_glyph_L(font, px, y, width, height, buf, g);
+	return sp->advances[g - font->glyphs] + kerning_offset;
+}
+
+int32_t font_draw_char_subpixel_RGBA32(const struct font_subpixel *sp,
+				       int32_t x, int y, int width, int height,
+				       uint8_t *buf, glyph_t glyph, glyph_t prev,
+				       uint32_t rgb)
+{
+	if (sp == NULL) return -1;
+
+	int32_t kerning_offset = font_get_kerning(sp->font, prev, glyph) * 64;
+	const struct font *font;
+	int px;
+	const struct glyph *g = subpixel_glyph(sp, x + kerning_offset, glyph, &font, &px);
+	if (g == NULL) return -2;
+
+	font_draw_glyph_RGBA32(font, px, y, width, height, buf, g, rgb);
+	return sp->advances[g - font->glyphs] + kerning_offset;
+}
+
+int32_t font_draw_char_subpixel_RGB16(const struct font_subpixel *sp,
+				      int32_t x, int y, int width, int height,
+				      uint8_t *buf, glyph_t glyph, glyph_t prev,
+				      uint16_t rgb)
+{
+	if (sp == NULL) return -1;
+
+	int32_t kerning_offset = font_get_kerning(sp->font, prev, glyph) * 64;
+	const struct font *font;
+	int px;
+	const struct glyph *g = subpixel_glyph(sp, x + kerning_offset, glyph, &font, &px);
+	if (g == NULL) return -2;
+
+	font_draw_glyph_RGB16(font, px, y, width, height, buf, g, rgb);
+	return sp->advances[g - font->glyphs] + kerning_offset;
+}
+
+/** Draw 'str' from the pen at '*x', in 1/64 pixels, leaving the pen after
+ * the last character drawn. Characters the font lacks are skipped. Stops
+ * at the first character that would end beyond 'width', and returns where
+ * it stopped. */
+char *font_draw_string_subpixel_RGB16(const struct font_subpixel *sp,
+				      int32_t *x, int y, int width, int height,
+				      uint8_t *buf, char *str, char prev,
+				      uint16_t rgb)
+{
+	if (sp == NULL) return NULL;
+
+	for (; *str; prev = *str++) {
+		const struct glyph *g = font_get_glyph(sp->font, *str);
+		if (g == NULL) continue;
+
+		int32_t advance = sp->advances[g - sp->font->glyphs] +
+				  font_get_kerning(sp->font, prev, *str) * 64;
+		if (*x + advance > (int32_t)width * 64)
+			break;
+
+		*x += font_draw_char_subpixel_RGB16(sp, *x, y, width, height, buf,
+						    *str, prev, rgb);
+	}
+
+	return str;
+}
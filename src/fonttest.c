@@ -7,6 +7,8 @@
  */
 
 #include <config.h>
+#include <errno.h>
+#include <locale.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -14,6 +16,7 @@
 #include <popt.h>
 
 #include "resource/fontem.h"
+#include "resource/fontemgen.h"
 #include "fonts/font_all.h"
 
 #ifndef EOL
@@ -24,21 +27,21 @@ static void fia_print_table(struct font *font, void *opaque)
 {
 	FILE *out = (FILE *)opaque;
 
-	fprintf(out, "%-20s %-8s %-6d %-6d %-6d %-3c" EOL,
+	fprintf(out, "%-20s %-8s %-6d %-6d %-6d %-7s" EOL,
 		font->name,
 		font->style,
 		font->size,
 		font->height,
 		font->ascender + font->descender,
-		font->compressed ? 'Y' : ' ');
+		font_codec_name(font->codec));
 }
 
 /** Dumps a table of all the fonts we know about. */
 static void font_print_all(FILE *out)
 {
-	fprintf(out, "%-20s %-8s %-6s %-6s %-6s %-3s" EOL,
+	fprintf(out, "%-20s %-8s %-6s %-6s %-6s %-7s" EOL,
 		"Font name", "Style", "Size",
-		"Vdist", "Height", "RLE");
+		"Vdist", "Height", "Codec");
 	font_iterate_all(fia_print_table, (void *)out);
 }
 
@@ -51,7 +54,7 @@ static void fia_print_args(struct font *font, void *opaque)
 		font->name,
 		font->style,
 		font->size,
-		font->compressed);
+		font->codec != FONT_CODEC_RAW);
 }
 
 /** Dumps the fonttable as a set of args that can be used
@@ -66,6 +69,14 @@ int main(int argc, const char *argv[])
 	char *string = "Test";
 	char *font_name = "DejaVu Serif";
 	char *font_style = NULL;
+	char *font_pack = NULL;
+	char *font_build = NULL;
+	char *run_name = NULL;
+	int tint_color = -1;
+	int sdf_size = 0;
+	int outline_size = 0;
+	int subpixel = 0;
+	int lcd = 0;
 	int font_size = 10;
 	int font_rle = -1;
 	int width = -1;
@@ -77,6 +88,14 @@ int main(int argc, const char *argv[])
 		{ "fontstyle", 'S', POPT_ARG_STRING | POPT_ARGFLAG_SHOW_DEFAULT, &font_style, 1, "Style of the font to use",	       "style" },
 		{ "fontsize",  's', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT,	 &font_size,  1, "Size of the fonr to use",	       "pts"   },
 		{ "fontrle",   'r', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT,	 &font_rle,   1, "0 = no RLE, 1 = RLE only, -1 = any", "mode"  },
+		{ "pack",      'p', POPT_ARG_STRING,				 &font_pack,  1, "Load the font from a font pack",     "file"  },
+		{ "build",     'b', POPT_ARG_STRING,				 &font_build, 1, "Build the font from a TrueType font", "file" },
+		{ "run",       'R', POPT_ARG_STRING,				 &run_name,   1, "Draw the string laid out as this run", "name" },
+		{ "tint",      'T', POPT_ARG_INT,				 &tint_color, 1, "Draw in this color of the font's tint", "index" },
+		{ "sdf",       'D', POPT_ARG_INT,				 &sdf_size,   1, "Draw the font's distance fields at this size", "pts" },
+		{ "outlines",  'O', POPT_ARG_INT,				 &outline_size, 1, "Render the font's outlines at this size", "pts" },
+		{ "subpixel",  'P', POPT_ARG_NONE,				 &subpixel,   1, "Draw at the font's subpixel phases",    NULL    },
+		{ "lcd",       'L', POPT_ARG_NONE,				 &lcd,	      1, "Draw the font's stripes of red, green and blue", NULL },
 		{ "width",     'w', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT,	 &width,      1, "Canvas width",		       "chars" },
 		{ "height",    'h', POPT_ARG_INT | POPT_ARGFLAG_SHOW_DEFAULT,	 &height,     1, "Canvas height",		       "chars" },
 		{ "list",      'l', 0,						 NULL,	      2, "List available fonts",	       NULL    },
@@ -111,7 +130,33 @@ int main(int argc, const char *argv[])
 		return 1;
 	}
 
-	const struct font *font = font_find_all(font_name, font_style, font_size, (char)font_rle);
+	const struct font *font;
+
+	if (font_pack != NULL) {
+		font = font_load_mmap(font_pack);
+		if (font == NULL) {
+			fprintf(stderr, "ERROR: Unable to load font pack \"%s\": %s.\n",
+				font_pack, strerror(errno));
+			return 1;
+		}
+	} else if (font_build != NULL) {
+		struct fontem_build_options build_opts = {
+			.codec	= font_rle == 1 ? FONT_CODEC_RLE : FONT_CODEC_RAW,
+			.lookup = FONTEM_LOOKUP_AUTO,
+			.jobs	= 1,
+		};
+
+		// The default characters are multibyte in the locale's encoding
+		setlocale(LC_ALL, "");
+		font = fontem_build(font_build, font_size, NULL, &build_opts);
+		if (font == NULL) {
+			fprintf(stderr, "ERROR: Unable to build font \"%s\": %s.\n",
+				font_build, strerror(errno));
+			return 1;
+		}
+	} else {
+		font = font_find_all(font_name, font_style, font_size, (char)font_rle);
+	}
 
 	if (font == NULL) {
 		fprintf(stderr, "ERROR: Unable to find a font matching \"%s\" size \"%d\".\n",
@@ -119,9 +164,76 @@ int main(int argc, const char *argv[])
 		return 1;
 	}
 
+	const struct font_sdf *sdf = NULL;
+	if (sdf_size > 0) {
+		for (int i = 0; i < font_sdf_count; i++)
+			if (font_sdfs[i]->font == font)
+				sdf = font_sdfs[i];
+		if (sdf == NULL) {
+			fprintf(stderr, "ERROR: The font has no distance fields.\n");
+			return 1;
+		}
+	}
+
+	// Outlines are rendered into a cache that holds a few glyphs, so that
+	// most of a string is rendered again as it is drawn
+	static struct font_cache_entry entries[8];
+	static uint8_t pixels[32768];
+	struct font_cache cache;
+	if (outline_size > 0) {
+		const struct font_outlines *outlines = NULL;
+
+		for (int i = 0; i < font_outline_count; i++)
+			if (font_outline_fonts[i]->font == font)
+				outlines = font_outline_fonts[i];
+		if (outlines == NULL) {
+			fprintf(stderr, "ERROR: The font has no outlines.\n");
+			return 1;
+		}
+		font_cache_init(&cache, outlines, entries, 8, pixels, sizeof(pixels));
+	}
+
+	const struct font_subpixel *sp = NULL;
+	if (subpixel) {
+		for (int i = 0; i < font_subpixel_count; i++)
+			if (font_subpixels[i]->font == font)
+				sp = font_subpixels[i];
+		if (sp == NULL) {
+			fprintf(stderr, "ERROR: The font has no subpixel phases.\n");
+			return 1;
+		}
+	}
+
 	if (width == -1 || height == -1) {
 		int w = 0, h = 0;
 		font_calculate_box(font, &w, &h, string);
+		if (sdf) {
+			// Measure by drawing on an empty canvas
+			char prev = 0;
+
+			w = 0;
+			for (char *p = string; *p; prev = *p++)
+				w += font_draw_char_sdf_L(sdf, sdf_size, w, 0, 0, 0, NULL, *p, prev);
+			h = (font->height * sdf_size + font->size / 2) / font->size;
+		}
+		if (outline_size > 0) {
+			char prev = 0;
+
+			w = 0;
+			for (char *p = string; *p; prev = *p++)
+				w += font_draw_char_outline_L(&cache, outline_size, w, 0, 0, 0, NULL,
+							      *p, prev);
+			h = (cache.outlines->height * outline_size * font->dpi / 72 +
+			     cache.outlines->units_per_em - 1) / cache.outlines->units_per_em;
+		}
+		if (sp) {
+			int32_t x = 0;
+			char prev = 0;
+
+			for (char *p = string; *p; prev = *p++)
+				x += font_draw_char_subpixel_L(sp, x, 0, 0, 0, NULL, *p, prev);
+			w = (x + 63) / 64;
+		}
 		if (width == -1) width = w;
 		if (height == -1) height = h;
 	}
@@ -129,14 +241,117 @@ int main(int argc, const char *argv[])
 	uint8_t *canvas = malloc(((size_t)width * (size_t)height) + 1);
 	memset(canvas, ' ', (size_t)width * (size_t)height);
 
-	char *p = string;
+	if (run_name != NULL) {
+		const struct font_run *run = NULL;
+
+		for (int i = 0; i < font_run_count; i++)
+			if (font_runs[i]->font == font && !strcmp(font_runs[i]->name, run_name))
+				run = font_runs[i];
+		if (run == NULL) {
+			fprintf(stderr, "ERROR: The font has no run named \"%s\".\n", run_name);
+			return 1;
+		}
+		font_draw_run_L(run, 0, 0, width, height, canvas);
+	} else if (tint_color >= 0) {
+		const struct font_tint *tint = NULL;
+
+		for (int i = 0; i < font_tint_count; i++)
+			if (font_tints[i]->font == font)
+				tint = font_tints[i];
+		if (tint == NULL || tint_color >= tint->color_count) {
+			fprintf(stderr, "ERROR: The font has no tint color %d.\n", tint_color);
+			return 1;
+		}
+
+		// Draw on black, and show the green channel as the L renderer
+		// shows coverage
+		uint16_t *rgb = calloc((size_t)width * (size_t)height + 1, sizeof(uint16_t));
+		char *p = string;
+		int x = 0;
+		char prev = 0;
+		while (*p) {
+			x += font_draw_char_RGB16_tinted(tint, x, 0, width, height, (uint8_t *)rgb,
+							 *p, prev, tint_color);
+			prev = *p;
+			p++;
+		}
+		for (size_t i = 0; i < (size_t)width * (size_t)height; i++) {
+			unsigned int val = rgb16_get_g(rgb[i]);
+
+			val |= val >> 6;
+			canvas[i] = val < 64 ? ' ' : val < 128 ? '.' : val < 192 ? '+' : 'X';
+		}
+		free(rgb);
+	} else if (lcd) {
+		// Draw white on black, and show each pixel as its red, green and
+		// blue channels side by side
+		uint16_t *rgb = calloc((size_t)width * (size_t)height + 1, sizeof(uint16_t));
+		char *p = string;
+		int x = 0;
+		char prev = 0;
+		while (*p) {
+			x += font_draw_char_RGB16_lcd(font, x, 0, width, height, (uint8_t *)rgb,
+						      *p, prev, 0xffff);
+			prev = *p;
+			p++;
+		}
+		free(canvas);
+		canvas = malloc(((size_t)width * (size_t)height * 3) + 1);
+		for (size_t i = 0; i < (size_t)width * (size_t)height; i++) {
+			unsigned int val[3] = {
+				rgb16_get_r(rgb[i]) | rgb16_get_r(rgb[i]) >> 5,
+				rgb16_get_g(rgb[i]) | rgb16_get_g(rgb[i]) >> 6,
+				rgb16_get_b(rgb[i]) | rgb16_get_b(rgb[i]) >> 5,
+			};
 
-	int x = 0;
-	char prev = 0;
-	while (*p) {
-		x += font_draw_char_L(font, x, 0, width, height, canvas, *p, prev);
-		prev = *p;
-		p++;
+			for (int c = 0; c < 3; c++)
+				canvas[i * 3 + c] = val[c] < 64 ? ' ' : val[c] < 128 ? '.' :
+						    val[c] < 192 ? '+' : 'X';
+		}
+		width *= 3;
+		free(rgb);
+	} else if (outline_size > 0) {
+		char *p = string;
+
+		int x = 0;
+		char prev = 0;
+		while (*p) {
+			x += font_draw_char_outline_L(&cache, outline_size, x, 0, width, height,
+						      canvas, *p, prev);
+			prev = *p;
+			p++;
+		}
+	} else if (sp) {
+		// The pen is kept in 1/64 pixels
+		char *p = string;
+
+		int32_t x = 0;
+		char prev = 0;
+		while (*p) {
+			x += font_draw_char_subpixel_L(sp, x, 0, width, height, canvas, *p, prev);
+			prev = *p;
+			p++;
+		}
+	} else if (sdf) {
+		char *p = string;
+
+		int x = 0;
+		char prev = 0;
+		while (*p) {
+			x += font_draw_char_sdf_L(sdf, sdf_size, x, 0, width, height, canvas, *p, prev);
+			prev = *p;
+			p++;
+		}
+	} else {
+		char *p = string;
+
+		int x = 0;
+		char prev = 0;
+		while (*p) {
+			x += font_draw_char_L(font, x, 0, width, height, canvas, *p, prev);
+			prev = *p;
+			p++;
+		}
 	}
 
 	for (int y = 0; y < height; y++) {
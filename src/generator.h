@@ -0,0 +1,337 @@
+/**
+ * \file src/generator.h
+ *
+ * Internal definitions shared by the parts of the font generator.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#ifndef _FONTEM_GENERATOR_H
+#define _FONTEM_GENERATOR_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+/** Version of the generated output; bump this whenever fontem would write
+ * something different for the same inputs, so that cached output is
+ * regenerated. */
+#define FONTEM_OUTPUT_VERSION 8
+
+/** Initial value of an input hash */
+#define HASH_INIT UINT64_C(0xcbf29ce484222325)
+
+/** Precedes the input hash, in hex, in generated source files */
+#define HASH_MARKER "fontem-hash: "
+
+/** Resolution fonts are rendered at */
+#define FONT_DPI 100
+
+/** Characters generated when none are given */
+#define DEFAULT_CHAR_LIST "!@#$%^&*()_+-={}|[]\\:\";'<>?,./`~" \
+	" " \
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZ" \
+	"abcdefghijklmnopqrstuvwxyz" \
+	"0123456789" \
+	"ÄÖÜßäöü"
+
+/** Kerning classes for a character list; each character has a left and a
+ * right class, and the offset for a pair of classes is held in a matrix.
+ * Class 0 is the class of characters that are never kerned. */
+struct kern_classes {
+	uint8_t *left;          /** Left class of each character */
+	uint8_t *right;         /** Right class of each character */
+	int	left_count;     /** Number of left classes, including class 0 */
+	int	right_count;    /** Number of right classes, including class 0 */
+	int8_t	*matrix;        /** left_count x right_count offsets */
+};
+
+/** The outline of a glyph in font units, as TrueType holds it. */
+struct outline_data {
+	int		advance;        /** Horizontal advance, in font units */
+	unsigned int	point_count;    /** Number of points */
+	int16_t		*points;        /** x and y of each point, y up */
+	uint8_t		*on;            /** Whether each point is on the curve */
+	unsigned int	contour_count;  /** Number of contours */
+	uint16_t	*ends;          /** Index of the last point of each contour */
+};
+
+/** A rendered glyph, with its bitmap encoded as it will be stored. */
+struct glyph_data {
+	wchar_t		ch;             /** Character code */
+	int		left;           /** Offset of the left edge of the glyph */
+	int		top;            /** Offset of the top edge of the glyph */
+	int		advance;        /** Horizontal advance */
+	int		advance64;      /** Horizontal advance, in 1/64 pixels and unrounded */
+	unsigned int	cols;           /** Width of the bitmap */
+	unsigned int	rows;           /** Height of the bitmap */
+	uint8_t		*bitmap;        /** Encoded bitmap, or NULL if it is empty */
+	size_t		length;         /** Length of the encoded bitmap */
+	unsigned int	line;           /** Bytes per line when printed as C */
+	int		codec;          /** FONT_CODEC_ encoding of 'bitmap' */
+	const struct glyph_data *same;  /** Earlier glyph with an identical bitmap, or NULL */
+	struct outline_data *outline;   /** Outline of the glyph, with no bitmap, or NULL */
+};
+
+/** Everything needed to write out a font once its glyphs are rendered. */
+struct font_data {
+	const char		*name;          /** Family name */
+	const char		*style;         /** Style name */
+	int			size;           /** Point size */
+	int			dpi;            /** Resolution */
+	int			ascender;       /** Ascender height */
+	int			descender;      /** Descender height */
+	int			height;         /** Baseline-to-baseline height */
+	int			codec;          /** FONT_CODEC_ encoding of the bitmaps */
+	uint8_t			*codec_data;    /** Codec table, or NULL */
+	size_t			codec_data_length; /** Length of 'codec_data' */
+	uint64_t		hash;           /** Hash of the inputs */
+
+	size_t			count;          /** Number of glyphs */
+	wchar_t			max;            /** Highest character code */
+	int			glyph32;        /** Whether glyph_t must be 32 bits wide */
+	struct glyph_data	*glyphs;        /** Glyphs, in character order */
+
+	int			with_kerning;   /** Whether 'kerning' is valid */
+	struct kern_classes	kerning;        /** Kerning classes */
+};
+
+/** Ways of storing the glyph bitmaps */
+#define ATLAS_1D	1       /** Encoded bitmaps concatenated in one array */
+#define ATLAS_2D	2       /** Uncompressed bitmaps packed in one image */
+
+/** The glyph bitmaps of a font, packed into one array. */
+struct atlas {
+	uint8_t		*data;          /** The packed bitmaps */
+	size_t		length;         /** Length of 'data' */
+	unsigned int	width;          /** Bytes per row of a 2D atlas, otherwise 0 */
+	unsigned int	height;         /** Rows of a 2D atlas */
+	size_t		*offsets;       /** Offset in 'data' of each glyph's bitmap */
+};
+
+/* fontem_atlas.c */
+int build_atlas(const struct font_data *fd, int mode, struct atlas *atlas);
+
+/** How the glyphs of a font are rendered, shared read-only by the workers
+ * rendering them. */
+struct render_options {
+	const char	*font_filename; /** Font to load */
+	int		font_size;      /** Font size */
+	const wchar_t	*char_list;     /** Sorted, NUL-terminated list of characters */
+	int		codec;          /** FONT_CODEC_ to encode bitmaps with */
+	int		rotate;         /** Whether to rotate bitmaps */
+	int		mono;           /** Whether to render monochrome bitmaps */
+	int		sdf;            /** Spread of distance fields, in pixels, or 0 for coverage */
+	int		outlines;       /** Whether to keep outlines instead of bitmaps */
+	int		lcd;            /** Whether to render red, green and blue coverage */
+	int		phase;          /** Offset of the outline to the right, in 1/64 pixels */
+};
+
+/** Spread, in pixels, of the distance fields of a font rendered at 'size';
+ * enough for the outline to be found when the fields are drawn smaller. */
+#define SDF_SPREAD(size) ((size) * FONT_DPI / 72 / 8 > 2 ? (size) * FONT_DPI / 72 / 8 : 2)
+
+/** Most horizontal phases a glyph is rendered at by --subpixel */
+#define SUBPIXEL_MAX 16
+
+/** A font that glyphs are taken from, given by --font=file[:chars]. */
+struct source {
+	const char	*filename;      /** Font file */
+	const char	*chars;         /** Characters taken from it, as given, or NULL for any */
+	wchar_t		*list;          /** Sorted characters of 'chars' */
+	size_t		count;
+	FT_Face		face;           /** The face, at the size of the font */
+};
+
+/** The glyphs rendered for one or more fonts. Fonts that differ only in how
+ * the glyphs are stored share a rendering. */
+struct rendering {
+	const struct source	*fonts;         /** Fonts the glyphs are rendered from */
+	size_t			font_count;
+	int			font_size;      /** Font size */
+	int			rotate;         /** Whether the bitmaps are rotated */
+	int			mono;           /** Whether the bitmaps are monochrome */
+	int			sdf;            /** Whether the bitmaps are distance fields */
+	int			outlines;       /** Whether outlines are kept instead of bitmaps */
+	int			subpixel;       /** Horizontal phases the glyphs are rendered at, or 0 */
+	int			lcd;            /** Whether the bitmaps are red, green and blue coverage */
+	int			codec;          /** FONT_CODEC_ encoding of the bitmaps */
+	const wchar_t		*list;          /** Sorted characters rendered */
+	size_t			count;
+	int			ascender;       /** Highest ascender of the fonts used */
+	int			descender;      /** Lowest descender of the fonts used */
+	int			height;         /** Largest line height of the fonts used */
+	struct glyph_data	*glyphs;        /** Rendered glyphs */
+	struct glyph_data	*phases;        /** Glyphs at phases 1 to subpixel - 1, 'count' each */
+	int			with_kerning;   /** Whether 'kerning' is valid */
+	struct kern_classes	kerning;        /** Kerning classes of 'list' */
+	struct rendering	*next;          /** Next in the generator's list */
+};
+
+/** How build_font_data() stores the glyphs of a rendering. */
+struct build_settings {
+	int		codec;          /** FONT_CODEC_ encoding */
+	int		optimize;       /** OPTIMIZE_ goal of a mixed codec */
+	size_t		budget;         /** Most bytes the bitmaps may take */
+	int		atlas;          /** ATLAS_ layout */
+	int		lookup;         /** FONT_LOOKUP_ type, or LOOKUP_AUTO */
+	int		glyph32;        /** Whether to lay the font out for 32-bit glyph_t */
+};
+
+/** A font built from a rendering, ready to be written out. */
+struct built_font {
+	struct font_data	fd;             /** The encoded glyphs */
+	struct atlas		atlas;          /** Their bitmaps */
+	int			lookup;         /** FONT_LOOKUP_ type, or -1 if the one asked for doesn't fit */
+	uint32_t		*table;         /** Lookup table, or NULL */
+	size_t			table_len;      /** Entries in 'table' */
+	size_t			dups;           /** Glyphs sharing the bitmap of an earlier one */
+	size_t			saved;          /** Bytes saved by sharing them */
+};
+
+/* fontem_build.c */
+int render_char(FT_Face face, wchar_t ch, const struct render_options *opts,
+		struct glyph_data *gd);
+int render_glyphs(FT_Face face, const struct render_options *opts, size_t count,
+		  struct glyph_data *glyphs, int jobs);
+const struct source *char_source(const struct source *fonts, size_t font_count,
+				 wchar_t ch, int *found);
+size_t drop_missing_chars(const struct source *fonts, size_t font_count,
+			  wchar_t *list, size_t count);
+int render_codec(int codec, int rotate);
+int render_font(struct rendering *r, int jobs);
+void free_rendering(struct rendering *r);
+int build_font_data(const struct rendering *r, int phase, const struct build_settings *bs,
+		    struct built_font *bf);
+void free_built_font(struct built_font *bf);
+
+/* fontem_cache.c */
+void hash_data(uint64_t *hash, const void *data, size_t length);
+void hash_int(uint64_t *hash, long value);
+void hash_string(uint64_t *hash, const char *str);
+int hash_file(uint64_t *hash, const char *filename);
+int output_is_current(const char *filename, uint64_t hash);
+
+/** What the mixed codec chooses each glyph's codec for */
+#define OPTIMIZE_SIZE	0       /** The smallest bitmaps */
+#define OPTIMIZE_SPEED	1       /** The fastest decoding that fits the budget */
+
+/** No limit on the size of the encoded bitmaps */
+#define NO_BUDGET	SIZE_MAX
+
+/** A growable list of characters */
+struct char_set {
+	wchar_t		*chars;         /** The characters */
+	size_t		count;          /** Number of characters in 'chars' */
+	size_t		alloc;          /** Number allocated */
+};
+
+/** A string given by --strings, to be laid out in the font */
+struct text_string {
+	int		line;           /** Line number, for messages */
+	char		*name;          /** Name of the string, usable in C symbols */
+	char		*text;          /** The string, in UTF-8 */
+	wchar_t		*chars;         /** Its characters */
+	size_t		length;         /** Number of characters in 'chars' */
+};
+
+/** Size of a buffer big enough for any string returned by char_to_mb() */
+#define MB_BUFLEN (MB_LEN_MAX + 1)
+
+/* fontem_chars.c */
+int cmp_char(const void *p1, const void *p2);
+void char_set_add(struct char_set *set, wchar_t ch);
+void char_set_sort(struct char_set *set);
+int scan_chars(const char *filename, struct char_set *set);
+int scan_trace(const char *filename, const char *name, const char *style, int size,
+	       struct char_set *set);
+char *char_to_mb(wchar_t wchar, char *ch_mb);
+int parse_char_list(const char *str, wchar_t **list, size_t *count);
+int read_strings(const char *filename, struct text_string **strings, size_t *count);
+
+/* fontem_codec.c */
+int codec_id(const char *name);
+const char *codec_macro(int codec);
+unsigned char *rle_compress(const unsigned char *data, size_t *length);
+int encode_glyphs(struct font_data *fd, int codec, int optimize, size_t budget);
+
+/* fontem_dedup.c */
+size_t dedup_bitmaps(struct font_data *fd, size_t *dups);
+
+/* fontem_kern.c */
+int build_kern_classes(FT_Face face, const wchar_t *char_list, size_t char_count,
+		       struct kern_classes *kc);
+int merge_kern_classes(struct kern_classes *kc, const struct kern_classes *part,
+		       const size_t *index, size_t count);
+
+/** Largest character code or glyph count of a font for 16-bit glyph_t */
+#define GLYPH16_MAX	0xffff
+
+/** Let the generator choose the lookup type */
+#define LOOKUP_AUTO	-2
+
+/* fontem_lookup.c */
+int lookup_type(const char *name);
+const char *lookup_macro(int type);
+int choose_lookup(const struct font_data *fd);
+int fit_lookup(const struct font_data *fd, int type);
+size_t build_lookup(const struct font_data *fd, int type, uint32_t **table);
+
+/** Everything written out for a font by the asm and obj formats */
+struct font_layout {
+	const struct font_data	*fd;            /** The font */
+	const struct atlas	*atlas;         /** Its bitmaps */
+	int			lookup;         /** FONT_LOOKUP_ type of 'lookup_table' */
+	const uint32_t		*lookup_table;  /** Lookup table, or NULL */
+	size_t			lookup_length;  /** Entries in 'lookup_table' */
+	const char		*symbol;        /** Name of the struct font */
+	const char		*section;       /** Section to hold the arrays */
+	const char		*font_section;  /** Section to hold the struct font */
+	int			font_writable;  /** Whether that section is relocated at load time */
+};
+
+/** The options on one line of a manifest */
+struct manifest_line {
+	int		line;           /** Line number, for messages */
+	int		argc;           /** Number of arguments, with the program name */
+	const char	**argv;         /** The arguments */
+};
+
+/** What font_all.h and font_all.c list */
+struct registry {
+	const char	**headers;      /** Header of each font */
+	const char	**fonts;        /** struct font of each font */
+	size_t		font_count;
+	const char	**runs;         /** struct font_run of each string laid out */
+	size_t		run_count;
+	const char	**tints;        /** struct font_tint of each tinted font */
+	size_t		tint_count;
+	const char	**sdfs;         /** struct font_sdf of each distance field font */
+	size_t		sdf_count;
+	const char	**outlines;     /** struct font_outlines of each outline font */
+	size_t		outline_count;
+	const char	**subpixels;    /** struct font_subpixel of each subpixel font */
+	size_t		subpixel_count;
+};
+
+/* fontem_manifest.c */
+int read_manifest(const char *filename, struct manifest_line **lines, size_t *count);
+const char *manifest_path(const char *manifest, const char *path);
+int write_registry(const char *dir, struct registry *reg);
+
+/* fontem_obj.c */
+int machine_id(const char *name);
+int write_asm(FILE *s, FILE *data, const char *data_name, const struct font_layout *fl);
+int write_obj(FILE *f, const struct font_layout *fl, int machine);
+struct font *build_font(const struct font_layout *fl);
+
+/* fontem_pack.c */
+int write_pack(FILE *f, const struct font_data *fd);
+
+#endif /* _FONTEM_GENERATOR_H */
@@ -37,33 +37,109 @@
 	((((r) & 0xf8) << 8) | \
 	 (((g) & 0xfc) << 3) | \
 	 (((b) & 0xf8) >> 3))
+/** Spread a 16-bit RGB value over 32 bits, green in the upper half, so that
+ * all three channels can be scaled by a coverage of 0-32 in one multiply */
+#define rgb16_spread(rgb) \
+	((((uint32_t)(rgb) << 16) | (uint32_t)(rgb)) & RGB16_SPREAD_MASK)
+/** Fold a spread 16-bit RGB value back into 16 bits */
+#define rgb16_unspread(v) ((uint16_t)((v) | ((v) >> 16)))
+/** The bits of the channels of a spread 16-bit RGB value */
+#define RGB16_SPREAD_MASK 0x07e0f81f
 
 
-/** Glyph character value rype */
+/** Glyph character value type. Define FONTEM_GLYPH32 when building with
+ * fonts that have characters beyond U+FFFF; such fonts refuse to build
+ * without it. */
+#ifdef FONTEM_GLYPH32
+typedef uint32_t glyph_t;
+#else
 typedef uint16_t glyph_t;
+#endif
 
-/** Description of a glyph; a single character in a font. */
-struct glyph {
-	glyph_t			glyph;          /** The glyph this entry refers to */
+/** Version of the layout of struct font and struct glyph. Fonts generated
+ * for one layout can't be used with another. */
+#define FONT_LAYOUT_VERSION 2
 
+/** Description of a glyph; a single character in a font. Glyphs hold no
+ * pointers, so tables of them need no relocation when loaded. */
+struct glyph {
 	int16_t			left;           /** Offset of the left edge of the glyph */
 	int16_t			top;            /** Offset of the top edge of the glyph */
 	int16_t			advance;        /** Horizonal offset when advancing to the next glyph */
 
 	uint16_t		cols;           /** Width of the bitmap */
 	uint16_t		rows;           /** Height of the bitmap */
-	const uint8_t		*bitmap;        /** Bitmap data */
 
-	const struct kerning	*kerning;       /** Font kerning data */
+	uint8_t			kern_left;      /** Kerning class when this is the left glyph */
+	uint8_t			kern_right;     /** Kerning class when this is the right glyph */
+	uint32_t		offset;         /** Offset of the bitmap in the font atlas */
 };
 
-/** Kerning table; for a pair of glyphs, provides the horizontal adjustment. */
-struct kerning {
-	glyph_t left;   /** The left-glyph */
-	int16_t offset; /** The kerning offset for this glyph pair */
-};
+/** How font_get_glyph() finds the index of a character in a font. Tables
+ * that map characters to glyphs store the glyph index plus one, so that 0
+ * means the font has no such character. */
+/** Binary search of 'codepoints'; there is no lookup table */
+#define FONT_LOOKUP_SEARCH	0
+/** lookup[0] is the first character, and lookup[1 + ch - lookup[0]] the
+ * glyph for each character up to 'max' */
+#define FONT_LOOKUP_DIRECT	1
+/** lookup[0] is the number of ranges of consecutive characters, followed by
+ * the first character, last character and first glyph index of each */
+#define FONT_LOOKUP_RANGES	2
+/** lookup[ch >> 8] is the offset in 'lookup' of a block of 256 glyphs for
+ * the page of 'ch', or 0 if the font has nothing in that page */
+#define FONT_LOOKUP_PAGES	3
+/** The 'count' characters in the order of a breadth-first walk of their
+ * binary search tree, then the glyph index of each */
+#define FONT_LOOKUP_EYTZINGER	4
 
-/** Description of a font. */
+/** How glyph bitmaps are encoded */
+/** One byte of coverage per pixel */
+#define FONT_CODEC_RAW		0
+/** Runs of up to 64 bytes of 0x00 or 0xff, or of literal bytes; a byte of
+ * (class << 6 | length - 1) with class 0 for literals (which follow), 2 for
+ * 0x00 and 3 for 0xff */
+#define FONT_CODEC_RLE		1
+/** Coverage quantized to the 4 levels in 'codec_data'; a byte of
+ * (level << 6 | length - 1) per run */
+#define FONT_CODEC_PAL4		2
+/** Coverage quantized to the 16 levels in 'codec_data'; a byte of
+ * (level << 4 | length - 1) per run */
+#define FONT_CODEC_PAL16	3
+/** LZ77 with a 256-byte window: a byte of (length - 1) followed by that many
+ * literals, or of (0x80 | length - 3) and a distance of 1-255 to copy from */
+#define FONT_CODEC_LZ		4
+/** Canonical Huffman codes, most significant bit first and padded to a byte
+ * per glyph; 'codec_data' has the number of codes of each length from 0 to
+ * 15, then the coded values in code order */
+#define FONT_CODEC_HUFFMAN	5
+/** Each glyph has its own codec, one of the above, in 'glyph_codecs'; any
+ * Huffman glyphs share the table in 'codec_data' */
+#define FONT_CODEC_MIXED	6
+/** Rows are taken from a dictionary of the rows of the font: 'codec_data'
+ * is a byte giving the width W (2-4) of an entry, then the dictionary. A
+ * glyph is a W-byte little-endian entry of (offset << 1 | repeat) per run
+ * of identical rows, where 'offset' is that of the row in 'codec_data',
+ * followed by a byte of (length - 2) if 'repeat' is set */
+#define FONT_CODEC_ROWS		7
+/** Coverage quantized to 2^N even levels, 0 to 255, and packed N bits per
+ * pixel with the leftmost pixel in the most significant bits; each row
+ * starts on a byte. N is 1 for FONT_CODEC_BPP1 and doubles with each codec
+ * after it */
+#define FONT_CODEC_BPP1		8
+/** As FONT_CODEC_BPP1, with 2 bits per pixel */
+#define FONT_CODEC_BPP2		9
+/** As FONT_CODEC_BPP1, with 4 bits per pixel */
+#define FONT_CODEC_BPP4		10
+/** Each row is a byte giving the number of its spans, then the spans: a
+ * byte of clear pixels to skip, a byte giving the number of edge pixels
+ * followed by their coverage, and a byte of opaque pixels. Pixels after the
+ * last span of a row are clear. A count of 255 is followed, after those
+ * spans, by the count of the rest of the row's */
+#define FONT_CODEC_SPANS	11
+
+/** Description of a font. The glyphs are held as parallel arrays: lookups
+ * search only the character codes, and then index the glyph metrics. */
 struct font {
 	char			*name;          /** Name of the font */
 	char			*style;         /** Style of the font */
@@ -75,30 +151,277 @@ struct font {
 	int16_t			descender;      /** Descender height */
 	int16_t			height;         /** Baseline-to-baseline height */
 
+	glyph_t			count;          /** Number of glyphs */
+	glyph_t			max;            /** Maximum glyph index */
+	const glyph_t		*codepoints;    /** Character of each glyph, ascending */
+	const struct glyph	*glyphs;        /** Glyphs, in the order of 'codepoints' */
+	uint8_t			lookup_type;    /** FONT_LOOKUP_ type of 'lookup' */
+	const glyph_t		*lookup;        /** Table used to find glyphs, or NULL */
+	uint8_t			codec;          /** FONT_CODEC_ encoding of the bitmaps */
+	const uint8_t		*codec_data;    /** Table used by the codec, or NULL */
+	const uint8_t		*glyph_codecs;  /** Codec of each glyph if 'codec' is FONT_CODEC_MIXED, else NULL */
+
+	const int8_t		*kerning;       /** Kerning offsets by [kern_left * kerning_cols + kern_right], or NULL */
+	uint8_t			kerning_cols;   /** Number of right-hand kerning classes */
+
+	const uint8_t		*atlas;         /** Bitmaps of all glyphs, found by their offsets */
+	uint16_t		atlas_stride;   /** Bytes per row of a 2D atlas, or 0 if bitmaps are concatenated */
+};
+
+/** A glyph of a run of text laid out by "fontem --strings". */
+struct font_run_glyph {
+	const struct glyph	*glyph;         /** The glyph to draw */
+	int16_t			x;              /** Offset of the glyph from the start of the run, kerning applied */
+};
+
+/** A string laid out by "fontem --strings"; drawing it takes no lookups or
+ * kerning. The ink box is where drawing the run at (0, 0) may touch. */
+struct font_run {
+	const char		*name;          /** Name of the string */
+	const char		*text;          /** The string, in UTF-8 */
+	const struct font	*font;          /** Font the string is laid out in */
+	const struct font_run_glyph *glyphs;    /** Glyphs of the string, in order */
 	uint16_t		count;          /** Number of glyphs */
-	uint16_t		max;            /** Maximum glyph index */
-	const struct glyph	**glyphs;       /** Font glyphs */
-	char			compressed;     /** TRUE if glyph bitmaps are RLE compressed */
+	int16_t			advance;        /** Horizontal offset to whatever follows the run */
+	int16_t			ink_left;       /** Left edge of the ink */
+	int16_t			ink_top;        /** Top edge of the ink */
+	int16_t			ink_right;      /** Right edge of the ink, exclusive */
+	int16_t			ink_bottom;     /** Bottom edge of the ink, exclusive */
+};
+
+/** Highest coverage of a pixel of a tinted font */
+#define FONT_TINT_LEVELS 32
+
+/** The glyphs of a font made ready by "fontem --tint" for drawing in fixed
+ * 16-bit RGB colors. Each pixel is a coverage of 0 to FONT_TINT_LEVELS, and
+ * each color has the value to add at every coverage, premultiplied and
+ * spread by rgb16_spread(). */
+struct font_tint {
+	const struct font	*font;          /** The font */
+	const uint8_t		*coverage;      /** Coverage of every pixel of every glyph */
+	const uint32_t		*offsets;       /** Offset in 'coverage' of each glyph, in the order of 'font->glyphs' */
+	uint8_t			color_count;    /** Number of colors */
+	const uint16_t		*colors;        /** The colors */
+	const uint32_t		*premultiplied; /** FONT_TINT_LEVELS + 1 values per color */
+};
+
+/** Distance field value on the outline of a glyph drawn by the SDF
+ * renderers; values above it are inside the glyph */
+#define FONT_SDF_EDGE 128
+
+/** A font made by "fontem --sdf", whose bitmaps are signed distance fields
+ * rather than coverage: each pixel holds FONT_SDF_EDGE plus the distance to
+ * the outline, scaled so that 'spread' pixels away is 128 further. The
+ * fields are stored raw, and are drawn at any size by the SDF renderers. */
+struct font_sdf {
+	const struct font	*font;          /** The font, at the size of its fields */
+	uint8_t			spread;         /** Pixels from the outline to the furthest value */
+};
+
+/** Where the outline of a glyph of a font made by "fontem --outlines" is. */
+struct font_outline_glyph {
+	uint32_t		point;          /** Index of its first point in 'points' */
+	uint32_t		contour;        /** Index of its first contour in 'ends' */
+	uint16_t		contour_count;  /** Number of contours */
+	int16_t			advance;        /** Horizontal advance, in font units */
+};
+
+/** A font made by "fontem --outlines", whose glyphs are the quadratic
+ * contours of the TrueType font rather than bitmaps. Its glyphs are
+ * rendered at any size into a struct font_cache, and drawn from there.
+ * Points are in font units, with y up; each contour is closed, and a point
+ * between two that are off the curve is implied, as in TrueType. */
+struct font_outlines {
+	const struct font	*font;          /** The font, with no bitmaps */
+	uint16_t		units_per_em;   /** Font units per em */
+	int16_t			ascender;       /** Ascender height, in font units */
+	int16_t			height;         /** Baseline-to-baseline height, in font units */
+	const struct font_outline_glyph *glyphs; /** Outline of each glyph, in the order of 'font->glyphs' */
+	const int16_t		*points;        /** x and y of every point */
+	const uint8_t		*on;            /** Bit (i & 7) of byte (i >> 3) is set if point i is on the curve */
+	const uint16_t		*ends;          /** Last point of each contour, from the first of its glyph */
+};
+
+/** A glyph rendered from its outline at some size, held in a font cache. */
+struct font_cache_entry {
+	const struct glyph	*source;        /** The glyph of the outline font, or NULL if unused */
+	uint16_t		size;           /** Size it is rendered at */
+	uint32_t		used;           /** When it was last drawn */
+	struct glyph		glyph;          /** Its metrics at 'size', and the offset of its bitmap */
+};
+
+/** Glyphs of an outline font, rendered as they are first drawn and kept
+ * until the space they take is needed; the least recently drawn go first.
+ * The entries and pixels are given by the caller, and nothing else is
+ * allocated. */
+struct font_cache {
+	const struct font_outlines *outlines;   /** The font */
+	struct font_cache_entry	*entries;       /** The glyphs */
+	uint16_t		entry_count;    /** Number of entries */
+	uint8_t			*pixels;        /** Bitmaps of the glyphs, and room to render */
+	uint32_t		pixels_size;    /** Bytes in 'pixels' */
+	uint32_t		pixels_used;    /** Bytes taken by the bitmaps */
+	uint32_t		clock;          /** Counts the glyphs drawn */
+	uint32_t		hits;           /** Glyphs drawn from the cache */
+	uint32_t		misses;         /** Glyphs rendered to draw them */
+};
+
+/** A font made by "fontem --subpixel", rendered at several horizontal
+ * phases: phase p is the font drawn p / phases of a pixel to the right.
+ * Every phase has the characters, lookup and kerning of the first, and the
+ * pen is kept in 1/64 pixels, so that text is laid out with the advances
+ * of the outlines rather than whole pixels. */
+struct font_subpixel {
+	const struct font	*font;          /** The font, at phase 0 */
+	uint8_t			phases;         /** Number of phases */
+	const struct font *const *phase_fonts;  /** The font at each phase, the first being 'font' */
+	const int32_t		*advances;      /** Advance of each glyph in 1/64 pixels, in the order of 'font->glyphs' */
+};
+
+
+/** Magic number at the start of a binary font pack */
+#define FONT_PACK_MAGIC "FNTM"
+/** Version of the binary font pack format */
+#define FONT_PACK_VERSION 6
+/** Reads as this value only on a host with the byte order of the pack */
+#define FONT_PACK_BYTE_ORDER 0x0102
+
+/** Header of a binary font pack, as written by "fontem --format=blob".
+ * Packs are little-endian; all offsets are from the start of the pack, so
+ * a pack can be used wherever it is loaded or mapped. The glyphs, character
+ * codes and glyph codecs are the arrays struct font points at, laid out as
+ * on a little-endian host with a glyph_t of 'glyph_size' bytes, and the
+ * pack is the font's atlas. */
+struct font_pack_header {
+	char		magic[4];       /** FONT_PACK_MAGIC */
+	uint16_t	version;        /** FONT_PACK_VERSION */
+	uint16_t	byte_order;     /** FONT_PACK_BYTE_ORDER */
+	uint32_t	length;         /** Length of the whole pack */
+
+	uint32_t	name;           /** Offset of the NUL-terminated font name */
+	uint32_t	style;          /** Offset of the NUL-terminated font style */
+	uint32_t	glyphs;         /** Offset of 'count' struct glyph */
+	uint32_t	codepoints;     /** Offset of 'count' glyph_t, the character of each glyph */
+	uint32_t	lengths;        /** Offset of 'count' uint32_t, the length of each bitmap */
+	uint32_t	glyph_codecs;   /** Offset of 'count' uint8_t if 'codec' is FONT_CODEC_MIXED, or 0 */
+	uint32_t	kerning;        /** Offset of the kerning matrix, or 0 */
+	uint32_t	codec_data;     /** Offset of the codec table, or 0 */
+
+	uint16_t	size;           /** Point size of the font */
+	uint16_t	dpi;            /** Resolution of the font */
+	int16_t		ascender;       /** Ascender height */
+	int16_t		descender;      /** Descender height */
+	int16_t		height;         /** Baseline-to-baseline height */
+	uint8_t		codec;          /** FONT_CODEC_ encoding of the bitmaps */
+	uint8_t		kerning_rows;   /** Number of left-hand kerning classes */
+	uint8_t		kerning_cols;   /** Number of right-hand kerning classes */
+	uint8_t		glyph_size;     /** sizeof(glyph_t) the pack is laid out for */
+	uint8_t		reserved[2];
+	uint32_t	count;          /** Number of glyphs */
+	uint32_t	max;            /** Maximum glyph index */
+	uint8_t		hash[8];        /** Hash of the generator inputs, little-endian */
 };
 
 
 /* fontrender.c */
+#ifdef FONTEM_TRACE
+/** When the library is built with FONTEM_TRACE and this is set, every
+ * character looked up is written to it, in the form read by
+ * "fontem --chars-from-trace". */
+extern FILE *font_trace;
+#endif
 const struct glyph *font_get_glyph(const struct font *font, glyph_t glyph);
 int16_t font_get_kerning(const struct font *font, glyph_t left, glyph_t right);
+const uint8_t *font_get_bitmap(const struct font *font, const struct glyph *glyph);
+unsigned int font_get_stride(const struct font *font, const struct glyph *glyph);
+uint8_t font_get_codec(const struct font *font, const struct glyph *glyph);
 int font_calculate_box(const struct font *font, int *maxx, int *maxy, const char *str);
 
+/** A span of a row of a FONT_CODEC_SPANS bitmap: clear pixels, then edge
+ * pixels of the given coverage, then opaque pixels. */
+struct glyph_span {
+	uint8_t			skip;           /** Clear pixels */
+	uint8_t			edges;          /** Edge pixels */
+	uint8_t			fill;           /** Opaque pixels */
+	const uint8_t		*coverage;      /** Coverage of each edge pixel */
+};
+
+/** State of a streaming decoder for one glyph bitmap; pixels are produced
+ * one at a time, so a glyph is never decoded as a whole. */
+struct glyph_reader {
+	const uint8_t		*data;          /** Next byte of the encoded bitmap */
+	const uint8_t		*table;         /** The font's codec table */
+	uint8_t			codec;          /** FONT_CODEC_ of the bitmap */
+	uint8_t			mode;           /** Kind of the current run */
+	uint8_t			value;          /** Value of the current run */
+	uint8_t			count;          /** Pixels left in the current run */
+	uint8_t			distance;       /** LZ match distance */
+	uint8_t			pos;            /** LZ window position */
+	uint32_t		bits;           /** Huffman or packed bits not yet used */
+	uint8_t			nbits;          /** Number of bits left in 'bits' */
+	uint16_t		col;            /** Raw column within the row */
+	uint16_t		cols;           /** Raw bitmap width */
+	uint16_t		skip;           /** Raw bytes between rows */
+	const uint8_t		*row;           /** Current dictionary row */
+	struct glyph_span	span;           /** What is left of the current span */
+	uint8_t			row_done;       /** Whether the spans of the row are all read */
+	uint8_t			window[256];    /** LZ history */
+};
+
+/* fontdecode.c */
+void font_reader_init(struct glyph_reader *reader, const struct font *font, const struct glyph *glyph);
+uint8_t font_reader_next(struct glyph_reader *reader);
+const uint8_t *font_reader_row(struct glyph_reader *reader);
+int font_reader_span(struct glyph_reader *reader, struct glyph_span *span);
+const char *font_codec_name(uint8_t codec);
+
 /* fontrender_l.c */
 int font_draw_glyph_L(const struct font *font, int x, int y, int width, int height, uint8_t *buf, const struct glyph *g);
 int font_draw_char_L(const struct font *font, int x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev);
+int font_draw_run_L(const struct font_run *run, int x, int y, int width, int height, uint8_t *buf);
 
 /* fontrender_rgba32.c */
 int font_draw_glyph_RGBA32(const struct font *font, int x, int y, int width, int height, uint8_t *buf, const struct glyph *g, uint32_t rgb);
 int font_draw_char_RGBA32(const struct font *font, int x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev, uint32_t rgb);
+int font_draw_run_RGBA32(const struct font_run *run, int x, int y, int width, int height, uint8_t *buf, uint32_t rgb);
+int font_draw_glyph_RGBA32_lcd(const struct font *font, int x, int y, int width, int height, uint8_t *buf, const struct glyph *g, uint32_t rgb);
+int font_draw_char_RGBA32_lcd(const struct font *font, int x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev, uint32_t rgb);
 
 /* fontrender_rgb16.c */
 int font_draw_glyph_RGB16(const struct font *font, int x, int y, int width, int height, uint8_t *buf, const struct glyph *g, uint16_t rgb);
 int font_draw_char_RGB16(const struct font *font, int x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev, uint16_t rgb);
 char *font_draw_string_RGB16(const struct font *font, int x, int y, int width, int height, uint8_t *buf, char *str, char prev, uint16_t rgb);
+int font_draw_run_RGB16(const struct font_run *run, int x, int y, int width, int height, uint8_t *buf, uint16_t rgb);
+int font_draw_glyph_RGB16_tinted(const struct font_tint *tint, int x, int y, int width, int height, uint8_t *buf, const struct glyph *g, int color);
+int font_draw_char_RGB16_tinted(const struct font_tint *tint, int x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev, int color);
+int font_draw_glyph_RGB16_lcd(const struct font *font, int x, int y, int width, int height, uint8_t *buf, const struct glyph *g, uint16_t rgb);
+int font_draw_char_RGB16_lcd(const struct font *font, int x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev, uint16_t rgb);
+
+/* fontrender_sdf.c */
+int font_draw_glyph_sdf_L(const struct font_sdf *sdf, int size, int x, int y, int width, int height, uint8_t *buf, const struct glyph *g);
+int font_draw_char_sdf_L(const struct font_sdf *sdf, int size, int x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev);
+int font_draw_glyph_sdf_RGBA32(const struct font_sdf *sdf, int size, int x, int y, int width, int height, uint8_t *buf, const struct glyph *g, uint32_t rgb);
+int font_draw_char_sdf_RGBA32(const struct font_sdf *sdf, int size, int x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev, uint32_t rgb);
+int font_draw_glyph_sdf_RGB16(const struct font_sdf *sdf, int size, int x, int y, int width, int height, uint8_t *buf, const struct glyph *g, uint16_t rgb);
+int font_draw_char_sdf_RGB16(const struct font_sdf *sdf, int size, int x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev, uint16_t rgb);
+
+/* fontrender_outline.c */
+void font_cache_init(struct font_cache *cache, const struct font_outlines *outlines, struct font_cache_entry *entries, uint16_t entry_count, uint8_t *pixels, uint32_t pixels_size);
+const struct glyph *font_cache_get(struct font_cache *cache, int size, glyph_t glyph);
+int font_draw_char_outline_L(struct font_cache *cache, int size, int x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev);
+int font_draw_char_outline_RGBA32(struct font_cache *cache, int size, int x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev, uint32_t rgb);
+int font_draw_char_outline_RGB16(struct font_cache *cache, int size, int x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev, uint16_t rgb);
+
+/* fontrender_subpixel.c */
+int32_t font_draw_char_subpixel_L(const struct font_subpixel *sp, int32_t x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev);
+int32_t font_draw_char_subpixel_RGBA32(const struct font_subpixel *sp, int32_t x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev, uint32_t rgb);
+int32_t font_draw_char_subpixel_RGB16(const struct font_subpixel *sp, int32_t x, int y, int width, int height, uint8_t *buf, glyph_t glyph, glyph_t prev, uint16_t rgb);
+char *font_draw_string_subpixel_RGB16(const struct font_subpixel *sp, int32_t *x, int y, int width, int height, uint8_t *buf, char *str, char prev, uint16_t rgb);
+
+/* fontload.c */
+const struct font *font_load_memory(const void *data, size_t length);
+const struct font *font_load_mmap(const char *filename);
+void font_unload(const struct font *font);
 
 /* fontfind.c */
 const struct font *font_find_all(const char *name, const char *style, const int size, const char rle);
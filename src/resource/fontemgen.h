@@ -0,0 +1,34 @@
+/** In-process font generation.
+ *
+ * libfontemgen renders a TrueType font with FreeType and builds a struct
+ * font in memory, laid out as "fontem" would generate it, for programs that
+ * use arbitrary fonts at arbitrary sizes without generating code first.
+ *
+ * This file is distributed under the terms of the MIT License.
+ * See the LICENSE file at the top of this tree, or if it is missing a copy can
+ * be found at http://opensource.org/licenses/MIT
+ */
+
+#ifndef _FONTEMGEN_H
+#define _FONTEMGEN_H
+
+#include "fontem.h"
+
+/** Let fontem_build() choose the lookup type, as fontem does */
+#define FONTEM_LOOKUP_AUTO	-2
+
+/** How fontem_build() renders and stores a font. */
+struct fontem_build_options {
+	int	codec;          /** FONT_CODEC_ encoding of the bitmaps */
+	int	lookup;         /** FONT_LOOKUP_ type, or FONTEM_LOOKUP_AUTO */
+	int	atlas_2d;       /** Whether to pack the bitmaps into one image */
+	int	rotate;         /** Whether to rotate the bitmaps by 90 cw */
+	int	mono;           /** Whether to render monochrome bitmaps */
+	int	jobs;           /** Worker threads rendering the glyphs (0 = one per CPU) */
+};
+
+const struct font *fontem_build(const char *ttf, int size, const char *chars,
+				const struct fontem_build_options *opts);
+void fontem_build_free(const struct font *font);
+
+#endif /* _FONTEMGEN_H */